@@ -0,0 +1,30 @@
+#ifndef _VMS_CORE_AFFINITY_H_
+#define _VMS_CORE_AFFINITY_H_
+
+#include "Vms/Core/Types.h"
+#include <system_error>
+
+namespace Vms { namespace Core
+{
+    // Set of logical CPU ids, empty set means "no affinity", i.e. run anywhere.
+    using CpuSet = std::vector<std::uint32_t>;
+
+    // Number of logical CPUs, never 0.
+    std::uint32_t numCpus();
+
+    // Parses a comma separated list of CPU ids, CPU ranges and NUMA nodes, i.e.
+    // "0-1", "2,4,6-15" or "node1". "nodeN" expands to all CPUs of NUMA node N. The result
+    // is sorted and has no duplicates.
+    std::error_code parseCpuSet(const std::string& str, CpuSet& cpus);
+
+    // Restricts the calling thread to 'cpus'. Empty 'cpus' is a no-op.
+    std::error_code pinThisThread(const CpuSet& cpus);
+
+    // If all 'cpus' belong to a single NUMA node makes that node the preferred one for
+    // the calling thread's memory allocations. No-op on non-NUMA systems, for empty 'cpus'
+    // or 'cpus' spanning several nodes, in the latter case the kernel's default first-touch
+    // policy still allocates on the node the pinned thread runs on.
+    std::error_code preferLocalMemory(const CpuSet& cpus);
+} }
+
+#endif
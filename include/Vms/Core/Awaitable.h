@@ -0,0 +1,28 @@
+#ifndef _VMS_CORE_AWAITABLE_H_
+#define _VMS_CORE_AWAITABLE_H_
+
+#include "Vms/Core/Strand.h"
+#include <utility> // Boost 1.75 awaitable.hpp uses std::exchange without including it.
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+namespace Vms { namespace Core
+{
+    // Coroutines in vms always run on a strand, i.e. co_spawn(*strand, ...).
+    // They're typed on the concrete strand executor rather than asio's default any_io_executor:
+    // a strand doesn't fit into any_io_executor's small buffer, so every work guard and handler
+    // dispatch of the default awaitable heap allocates a copy of it. Coroutine frames and
+    // operations are recycled by asio's per-thread allocator, so with the concrete executor
+    // a read or write costs no allocations in the steady state.
+    using StrandExecutor = boost::asio::strand<boost::asio::io_context::executor_type>;
+
+    template <class T>
+    using Awaitable = boost::asio::awaitable<T, StrandExecutor>;
+
+    // Completion token, i.e. "co_await s.async_read_some(b, useAwaitable)". Use
+    // boost::asio::redirect_error(useAwaitable, ec) to get errors as error codes.
+    constexpr boost::asio::use_awaitable_t<StrandExecutor> useAwaitable;
+} }
+
+#endif
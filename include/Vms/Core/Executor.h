@@ -2,20 +2,68 @@
 #define _VMS_CORE_EXECUTOR_H_
 
 #include "Vms/Core/Types.h"
+#include "Vms/Core/Affinity.h"
+#include "Vms/Core/HandlerCounters.h"
 #include <boost/asio/io_service.hpp>
+#include <array>
+#include <chrono>
+#include <ostream>
 #include <thread>
 
 namespace Vms { namespace Core
 {
+    class TimedTask;
+
     class Executor
     {
     public:
-        Executor();
+        struct Stats
+        {
+            // False if built without VMS_HANDLER_TRACKING (the default, it puts shared counters
+            // on every handler), then only loop lag is available and the figures below stay 0.
+            // Loop lag is then the measure of how backed up the ready queue is.
+            bool handlerTracking = false;
+
+            // Handlers created and not completed yet, i.e. waiting in the ready queue or for
+            // their I/O, e.g. every pending read of an idle client. Not the ready queue depth,
+            // asio doesn't expose that.
+            std::int64_t queuedHandlers = 0;
+
+            std::uint64_t handlersRun = 0;
+            std::chrono::nanoseconds totalRunTime{0};
+            std::chrono::nanoseconds maxRunTime{0};
+
+            // See HandlerCounters::runTimeHistogram.
+            std::array<std::uint64_t, HandlerCounters::numRunTimeBuckets> runTimeHistogram{};
+
+            // How late the lag probe handler ran, last and max seen, see startLagProbe().
+            std::chrono::nanoseconds loopLag{0};
+            std::chrono::nanoseconds maxLoopLag{0};
+        };
+
+        // 'numThreads' threads will be calling ioService().run(), i.e. handlers that
+        // aren't serialized by a strand may be executed concurrently when numThreads > 1.
+        // If 'cpus' is not empty all threads are pinned to that set of CPUs and prefer
+        // allocating memory on its NUMA node.
+        // If 'busyPoll' is not zero threads don't block as soon as there's nothing to do, they
+        // keep polling ioService for that long first, i.e. trade CPU for wakeup latency.
+        explicit Executor(std::size_t numThreads = 1, const CpuSet& cpus = CpuSet(),
+            std::chrono::microseconds busyPoll = std::chrono::microseconds(0));
         ~Executor();
 
         inline boost::asio::io_service& ioService() { return ioService_; }
         inline const boost::asio::io_service& ioService() const { return ioService_; }
 
+        inline std::size_t numThreads() const { return threads_.size(); }
+
+        // Schedules a probe handler every 'interval', the difference between the time it
+        // was due and the time it actually ran is the event loop lag. Typically called once.
+        void startLagProbe(std::chrono::steady_clock::duration interval = std::chrono::milliseconds(100));
+
+        // Thread-safe, values are collected with relaxed atomics, so they're not
+        // necessarily consistent with each other.
+        Stats stats() const;
+
         // 'force' means stop any outstanding I/O on ioService and return immediately.
         // If you set it to false it'll wait until ALL I/O handlers are done. Note that using
         // force = false may hang forever if some other thread keeps posting new handlers to
@@ -28,11 +76,30 @@ namespace Vms { namespace Core
         Executor(const Executor&) = delete;
         Executor& operator=(const Executor&) = delete;
 
+        void run(const CpuSet& cpus);
+
+        void runBusyPoll(boost::system::error_code& ec);
+
+        void scheduleLagProbe();
+
         boost::asio::io_service ioService_;
         std::unique_ptr<boost::asio::io_service::work> work_;
 
-        std::thread thread_;
+        const std::chrono::microseconds busyPoll_;
+
+        HandlerCounters handlerCounters_;
+
+        std::shared_ptr<TimedTask> lagProbe_;
+        std::chrono::steady_clock::duration lagProbeInterval_{};
+        std::chrono::steady_clock::time_point lagProbeDue_;
+        std::atomic<bool> lagProbing_{false};
+        std::atomic<std::int64_t> loopLagNs_{0};
+        std::atomic<std::int64_t> maxLoopLagNs_{0};
+
+        std::vector<std::thread> threads_;
     };
+
+    std::ostream& operator<<(std::ostream& os, const Executor::Stats& stats);
 } }
 
 #endif
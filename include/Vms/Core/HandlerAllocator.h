@@ -0,0 +1,123 @@
+#ifndef _VMS_CORE_HANDLERALLOCATOR_H_
+#define _VMS_CORE_HANDLERALLOCATOR_H_
+
+#include "Vms/Core/Types.h"
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Vms { namespace Core
+{
+    // Memory for one outstanding asynchronous operation at a time, i.e. a chain of reads
+    // or a chain of writes on a socket. Once the operation is done its memory is reused
+    // by the next one, so steady state reads/writes don't touch the heap at all. Falls back
+    // to the heap if the block is busy or too small.
+    // Not thread-safe, same as the operation chain it serves, i.e. must be used from
+    // a strand or a single thread.
+    class HandlerMemory
+    {
+    public:
+        static const std::size_t size = 1024;
+
+        HandlerMemory() = default;
+        ~HandlerMemory() = default;
+
+        inline void* allocate(std::size_t sz)
+        {
+            if (!inUse_ && (sz <= sizeof(storage_))) {
+                inUse_ = true;
+                return &storage_;
+            }
+            ++numHeapAllocations_;
+            return ::operator new(sz);
+        }
+
+        inline void deallocate(void* p)
+        {
+            if (p == &storage_) {
+                inUse_ = false;
+            } else {
+                ::operator delete(p);
+            }
+        }
+
+        // Number of times this memory block couldn't be used.
+        inline std::uint64_t numHeapAllocations() const { return numHeapAllocations_; }
+
+    private:
+        HandlerMemory(const HandlerMemory&) = delete;
+        HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+        std::aligned_storage<size>::type storage_;
+        bool inUse_ = false;
+        std::uint64_t numHeapAllocations_ = 0;
+    };
+
+    // Allocator that asio picks up via associated_allocator, see makeAllocHandler().
+    template <class T>
+    class HandlerAllocator
+    {
+    public:
+        using value_type = T;
+
+        explicit HandlerAllocator(HandlerMemory& memory) : memory_(memory) {}
+
+        template <class U>
+        HandlerAllocator(const HandlerAllocator<U>& other) noexcept : memory_(other.memory_) {}
+
+        inline bool operator==(const HandlerAllocator& other) const noexcept { return &memory_ == &other.memory_; }
+        inline bool operator!=(const HandlerAllocator& other) const noexcept { return &memory_ != &other.memory_; }
+
+        inline T* allocate(std::size_t n) const
+        {
+            return static_cast<T*>(memory_.allocate(sizeof(T) * n));
+        }
+
+        inline void deallocate(T* p, std::size_t /*n*/) const
+        {
+            return memory_.deallocate(p);
+        }
+
+    private:
+        template <class> friend class HandlerAllocator;
+
+        HandlerMemory& memory_;
+    };
+
+    template <class Handler>
+    class AllocHandler
+    {
+    public:
+        using allocator_type = HandlerAllocator<Handler>;
+
+        AllocHandler(HandlerMemory& memory, Handler h) : memory_(memory), handler_(std::move(h)) {}
+
+        inline allocator_type get_allocator() const noexcept
+        {
+            return allocator_type(memory_);
+        }
+
+        template <class... Args>
+        inline void operator()(Args&&... args)
+        {
+            handler_(std::forward<Args>(args)...);
+        }
+
+    private:
+        HandlerMemory& memory_;
+        Handler handler_;
+    };
+
+    // Wraps 'h' so that asio allocates the operation it's passed to from 'memory'. 'memory'
+    // must outlive the operation, typically both the memory and the object the handler
+    // holds a shared_ptr to are the same object.
+    template <class Handler>
+    inline AllocHandler<typename std::decay<Handler>::type> makeAllocHandler(HandlerMemory& memory, Handler&& h)
+    {
+        return AllocHandler<typename std::decay<Handler>::type>(memory, std::forward<Handler>(h));
+    }
+} }
+
+#endif
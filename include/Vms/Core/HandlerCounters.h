@@ -0,0 +1,37 @@
+#ifndef _VMS_CORE_HANDLERCOUNTERS_H_
+#define _VMS_CORE_HANDLERCOUNTERS_H_
+
+#include "Vms/Core/Types.h"
+#include <atomic>
+
+namespace Vms { namespace Core
+{
+    // Handler statistics of a single io_service, updated by HandlerTracking.
+    struct HandlerCounters
+    {
+        // runTimeHistogram[0] counts handlers that ran for less than 1us, runTimeHistogram[i]
+        // counts handlers that ran for [2^(i-1), 2^i) us, the last one counts all the rest.
+        static const std::size_t numRunTimeBuckets = 24;
+
+        HandlerCounters()
+        {
+            for (auto& bucket : runTimeHistogram) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        std::atomic<std::int64_t> queued{0};
+        std::atomic<std::uint64_t> numRun{0};
+        std::atomic<std::uint64_t> totalRunTimeNs{0};
+        std::atomic<std::uint64_t> maxRunTimeNs{0};
+        std::atomic<std::uint64_t> runTimeHistogram[numRunTimeBuckets];
+    };
+
+    // Associates 'counters' with all handlers created on 'context' from now on. Only
+    // has effect when built with VMS_HANDLER_TRACKING.
+    void registerHandlerCounters(const void* context, HandlerCounters* counters);
+
+    void unregisterHandlerCounters(const void* context);
+} }
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef _VMS_CORE_HANDLERTRACKING_H_
+#define _VMS_CORE_HANDLERTRACKING_H_
+
+// Custom asio handler tracking, included by asio itself via BOOST_ASIO_CUSTOM_HANDLER_TRACKING
+// (see VMS_HANDLER_TRACKING in CMakeLists.txt). It feeds Executor::stats(), i.e. counts handlers
+// that are queued and measures how long each handler runs.
+// Don't include it directly.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace Vms { namespace Core
+{
+    struct HandlerCounters;
+
+    class TrackedHandler
+    {
+    protected:
+        TrackedHandler() = default;
+        ~TrackedHandler() = default;
+
+    private:
+        friend struct HandlerTracking;
+        HandlerCounters* counters_ = nullptr;
+    };
+
+    struct HandlerTracking
+    {
+        static void creation(boost::asio::execution_context& context, TrackedHandler& h,
+            const char* objectType, void* object, std::uintmax_t nativeHandle, const char* opName);
+
+        class Completion
+        {
+        public:
+            explicit Completion(const TrackedHandler& h);
+            ~Completion();
+
+            template <class... Args>
+            inline void invocationBegin(const Args&...)
+            {
+                begin();
+            }
+
+            void invocationEnd();
+
+        private:
+            Completion(const Completion&) = delete;
+            Completion& operator=(const Completion&) = delete;
+
+            void begin();
+
+            HandlerCounters* counters_;
+            std::chrono::steady_clock::time_point start_;
+            bool active_ = false;
+            bool outermost_ = false;
+        };
+    };
+} }
+
+# define BOOST_ASIO_INHERIT_TRACKED_HANDLER \
+  : public ::Vms::Core::TrackedHandler
+
+# define BOOST_ASIO_ALSO_INHERIT_TRACKED_HANDLER \
+  , public ::Vms::Core::TrackedHandler
+
+# define BOOST_ASIO_HANDLER_TRACKING_INIT (void)0
+
+# define BOOST_ASIO_HANDLER_LOCATION(args) (void)0
+
+# define BOOST_ASIO_HANDLER_CREATION(args) \
+  ::Vms::Core::HandlerTracking::creation args
+
+# define BOOST_ASIO_HANDLER_COMPLETION(args) \
+  ::Vms::Core::HandlerTracking::Completion tracked_completion args
+
+# define BOOST_ASIO_HANDLER_INVOCATION_BEGIN(args) \
+  tracked_completion.invocationBegin args
+
+# define BOOST_ASIO_HANDLER_INVOCATION_END \
+  tracked_completion.invocationEnd()
+
+# define BOOST_ASIO_HANDLER_OPERATION(args) (void)0
+# define BOOST_ASIO_HANDLER_REACTOR_REGISTRATION(args) (void)0
+# define BOOST_ASIO_HANDLER_REACTOR_DEREGISTRATION(args) (void)0
+# define BOOST_ASIO_HANDLER_REACTOR_READ_EVENT 0
+# define BOOST_ASIO_HANDLER_REACTOR_WRITE_EVENT 0
+# define BOOST_ASIO_HANDLER_REACTOR_ERROR_EVENT 0
+# define BOOST_ASIO_HANDLER_REACTOR_EVENTS(args) (void)0
+# define BOOST_ASIO_HANDLER_REACTOR_OPERATION(args) (void)0
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef _VMS_CORE_LOGRECORD_H_
+#define _VMS_CORE_LOGRECORD_H_
+
+#include "Vms/Core/Types.h"
+#include <boost/asio/ip/basic_endpoint.hpp>
+#include <boost/system/error_code.hpp>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+namespace Vms { namespace Core
+{
+    // Specialize it to true for 'T' to be copied into log records as is and formatted with its
+    // operator<< only when the record is, instead of right away. 'T' must be trivially
+    // copyable, default constructible and must not point to anything that may be gone by then.
+    template <class T>
+    struct LogAsRaw : std::false_type {};
+
+    // Arguments of a log message as they were passed to VMS_LOG_*, encoded as raw values
+    // and formatted later, i.e. by the async logger's sink thread. Numbers, strings, IP
+    // endpoints, error codes and LogAsRaw types are just copied, anything else is formatted
+    // with its operator<< right away.
+    // Fixed-size, lives on the caller's stack, what doesn't fit is cut off.
+    class LogRecord
+    {
+    public:
+        static const std::size_t maxSize = 1024;
+
+        LogRecord() = default;
+        ~LogRecord() = default;
+
+        inline const char* data() const { return data_; }
+        inline std::size_t size() const { return size_; }
+
+        template <class T>
+        inline LogRecord& operator<<(const T& value)
+        {
+            if constexpr (std::is_same<T, bool>::value) {
+                putBool(value);
+            } else if constexpr (std::is_same<T, char>::value || std::is_same<T, signed char>::value ||
+                std::is_same<T, unsigned char>::value) {
+                // Same as std::ostream, i.e. std::uint8_t is a character.
+                putChar(static_cast<char>(value));
+            } else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value) {
+                putInt(static_cast<std::int64_t>(value));
+            } else if constexpr (std::is_integral<T>::value) {
+                putUInt(static_cast<std::uint64_t>(value));
+            } else if constexpr (std::is_floating_point<T>::value) {
+                putDouble(static_cast<double>(value));
+            } else if constexpr (std::is_convertible<const T&, const char*>::value) {
+                const char* str = value;
+                putString(str ? std::string_view(str) : std::string_view("(null)"));
+            } else if constexpr (std::is_convertible<const T&, std::string_view>::value) {
+                putString(std::string_view(value));
+            } else if constexpr (IsEndpoint<T>::value) {
+                putEndpoint(value);
+            } else if constexpr (std::is_same<T, std::error_code>::value || std::is_same<T, boost::system::error_code>::value) {
+                putRaw(&formatErrorCode<T>, value);
+            } else if constexpr (LogAsRaw<T>::value) {
+                putRaw(&formatStreamed<T>, value);
+            } else {
+                std::ostringstream os;
+                os << value;
+                putString(os.str());
+            }
+            return *this;
+        }
+
+        // Appends the text of a record encoded in 'data' to 'out'.
+        static void format(const char* data, std::size_t size, std::string& out);
+
+        // Appends the text of this record to 'out'.
+        inline void format(std::string& out) const { format(data_, size_, out); }
+
+    private:
+        enum Tag : std::uint8_t
+        {
+            TagInt = 0,
+            TagUInt,
+            TagDouble,
+            TagChar,
+            TagBool,
+            TagString,
+            // A FormatFn and the value it formats.
+            TagRaw,
+            // Something was cut off, always the last one.
+            TagTruncated
+        };
+
+        // Appends the text of the raw value at 'data' to 'out', returns its size.
+        using FormatFn = std::size_t (*)(const char* data, std::string& out);
+
+        template <class T>
+        struct IsEndpoint : std::false_type {};
+
+        template <class Protocol>
+        struct IsEndpoint<boost::asio::ip::basic_endpoint<Protocol>> : std::true_type {};
+
+        // An IPv4 or IPv6 endpoint, what's needed to print it like asio does.
+        struct RawEndpoint
+        {
+            unsigned char address[16];
+            std::uint32_t scopeId;
+            std::uint16_t port;
+            bool v6;
+        };
+
+        LogRecord(const LogRecord&) = delete;
+        LogRecord& operator=(const LogRecord&) = delete;
+
+        template <class T>
+        inline void putValue(Tag tag, const T& value)
+        {
+            if (truncated_) {
+                return;
+            }
+            if (size_ + 1 + sizeof(value) > maxSize - 1) {
+                truncate();
+                return;
+            }
+            data_[size_++] = static_cast<char>(tag);
+            std::memcpy(&data_[size_], &value, sizeof(value));
+            size_ += sizeof(value);
+        }
+
+        inline void putInt(std::int64_t value) { putValue(TagInt, value); }
+        inline void putUInt(std::uint64_t value) { putValue(TagUInt, value); }
+        inline void putDouble(double value) { putValue(TagDouble, value); }
+        inline void putChar(char value) { putValue(TagChar, value); }
+        inline void putBool(bool value) { putValue(TagBool, static_cast<std::uint8_t>(value)); }
+
+        void putString(std::string_view value);
+
+        template <class T>
+        inline void putRaw(FormatFn fn, const T& value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "LogRecord: raw values must be trivially copyable");
+            if (truncated_) {
+                return;
+            }
+            if (size_ + 1 + sizeof(fn) + sizeof(value) > maxSize - 1) {
+                truncate();
+                return;
+            }
+            data_[size_++] = static_cast<char>(TagRaw);
+            std::memcpy(&data_[size_], &fn, sizeof(fn));
+            size_ += sizeof(fn);
+            std::memcpy(&data_[size_], &value, sizeof(value));
+            size_ += sizeof(value);
+        }
+
+        template <class Protocol>
+        inline void putEndpoint(const boost::asio::ip::basic_endpoint<Protocol>& endpoint)
+        {
+            RawEndpoint raw;
+            auto address = endpoint.address();
+            raw.v6 = address.is_v6();
+            if (raw.v6) {
+                auto bytes = address.to_v6().to_bytes();
+                std::memcpy(raw.address, bytes.data(), bytes.size());
+                raw.scopeId = address.to_v6().scope_id();
+            } else {
+                auto bytes = address.to_v4().to_bytes();
+                std::memcpy(raw.address, bytes.data(), bytes.size());
+                raw.scopeId = 0;
+            }
+            raw.port = endpoint.port();
+            putRaw(&formatEndpoint, raw);
+        }
+
+        static std::size_t formatEndpoint(const char* data, std::string& out);
+
+        static void appendInt(std::int64_t value, std::string& out);
+
+        // Same text as their operator<<, i.e. "category:value".
+        template <class T>
+        static std::size_t formatErrorCode(const char* data, std::string& out)
+        {
+            T ec;
+            std::memcpy(static_cast<void*>(&ec), data, sizeof(ec));
+            out.append(ec.category().name()).push_back(':');
+            appendInt(ec.value(), out);
+            return sizeof(ec);
+        }
+
+        template <class T>
+        static std::size_t formatStreamed(const char* data, std::string& out)
+        {
+            T value;
+            std::memcpy(static_cast<void*>(&value), data, sizeof(value));
+            std::ostringstream os;
+            os << value;
+            out.append(os.str());
+            return sizeof(value);
+        }
+
+        void truncate();
+
+        // The last byte is reserved for TagTruncated.
+        char data_[maxSize];
+        std::size_t size_ = 0;
+        bool truncated_ = false;
+    };
+} }
+
+#endif
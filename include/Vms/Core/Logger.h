@@ -1,9 +1,21 @@
 #ifndef _VMS_CORE_LOGGER_H_
 #define _VMS_CORE_LOGGER_H_
 
+#include "Vms/Core/LogRecord.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <mutex>
 #include <string>
-#include <sstream>
+#include <system_error>
+#include <vector>
+
+// Call sites below that level are compiled out, i.e. -DVMS_LOG_MIN_LEVEL=1 strips all
+// VMS_LOG_DEBUG()s, their arguments aren't evaluated.
+#if !defined(VMS_LOG_MIN_LEVEL)
+#define VMS_LOG_MIN_LEVEL 0
+#endif
 
 namespace Vms { namespace Core
 {
@@ -16,48 +28,299 @@ namespace Vms { namespace Core
         LogLevelOFF = 4
     };
 
+    // A VMS_LOG_* call site, has static storage duration, so records refer to it by address.
+    struct LogSite
+    {
+        LogLevel level;
+        const char* facility;
+        const char* file;
+        int line;
+    };
+
+    struct AsyncLogOptions
+    {
+        // Log file, empty = stderr.
+        std::string path;
+        // The file is rotated when it grows over that many bytes, 0 = never.
+        // Rotated files are path.1 (the newest) ... path.maxFiles.
+        std::uint64_t maxFileSize = 0;
+        std::uint32_t maxFiles = 5;
+        // Size of each thread's ring buffer, bytes. Messages that don't fit are dropped.
+        std::size_t bufferSize = 1 << 20;
+        // How long the sink thread sleeps when all the rings are empty.
+        std::chrono::milliseconds flushInterval{ 10 };
+    };
+
+    class LogRateLimiter;
+
     class Logger
     {
     public:
-        Logger() = default;
-        ~Logger() = default;
+        Logger();
+        ~Logger();
 
-        inline LogLevel level() const { return level_; }
-        inline void setLevel(LogLevel logLevel) { level_ = logLevel; }
+        // Max. number of distinct facilities, the ones over it share the level of slot 0.
+        static const std::size_t maxFacilities = 32;
+
+        // The default level, of all the facilities without their own one.
+        LogLevel level() const;
+        void setLevel(LogLevel logLevel);
+
+        // Per-facility levels, i.e. DEBUG for "Connection" only. Thread-safe, takes effect
+        // for all the threads right away.
+        void setFacilityLevel(const std::string& facility, LogLevel logLevel);
+        void resetFacilityLevel(const std::string& facility);
+
+        // Parses "facility=level,..." where level is debug, info, warn, error or off, and sets them.
+        std::error_code setFacilityLevels(const std::string& spec);
+
+        // Slot of 'facility' in the level table, the same one for the same name. Called once
+        // per call site by VMS_LOG_*.
+        std::size_t facilityId(const char* facility);
 
         inline bool isVerbose() const { return verbose_; }
         inline void setVerbose(bool value) { verbose_ = value; }
 
-        inline bool isEnabledFor(LogLevel logLevel) const { return logLevel >= level_; }
+        inline bool isEnabledFor(LogLevel logLevel, std::size_t facilityId = 0) const
+        {
+            return logLevel >= levels_[facilityId].load(std::memory_order_relaxed);
+        }
+
+        // Formats 'record' and writes it out, or in async mode just queues it.
+        void log(const LogSite& site, const LogRecord& record);
+
+        // Async mode: log() copies the record into the calling thread's lock-free ring and
+        // returns, a sink thread drains the rings and writes them out in batches. When a
+        // ring is full the message is dropped and counted, log() never blocks.
+        // Messages of a single thread keep their order, messages of different threads
+        // may interleave differently than they were logged.
+        // Not thread-safe, call at startup.
+        std::error_code startAsync(const AsyncLogOptions& options);
+
+        // Writes out everything logged so far and goes back to synchronous mode.
+        // Messages logged by other threads while it's running may be lost.
+        void stopAsync();
+
+        inline bool isAsync() const { return async_.load(std::memory_order_relaxed); }
 
-        void log(LogLevel logLevel, const char* facility, const std::string& message,
-            const char* file, int line);
+        // Number of messages dropped because of full rings.
+        inline std::uint64_t numDropped() const { return numDropped_.load(std::memory_order_relaxed); }
+
+        // Called by a LogRateLimiter when it first suppresses a message. From then on its
+        // count is reported once its second is over even if no later message gets through,
+        // by the sink thread in async mode, by the next log() anywhere otherwise.
+        void registerLimiter(LogRateLimiter& limiter);
 
     private:
+        struct AsyncSink;
+
+        // True at most once a second, when the registered limiters are due to be checked.
+        bool isReportDue();
+
+        // Appends a line for every registered limiter that has messages suppressed in a second
+        // that's over, or for every one with any if 'all'.
+        void reportSuppressed(std::string& out, bool verbose, bool all);
+
         Logger(const Logger&) = delete;
         Logger& operator=(const Logger&) = delete;
 
+        void logAsync(const LogSite& site, const LogRecord& record);
+
+        std::atomic<bool> async_{ false };
+        std::atomic<std::uint64_t> numDropped_{ 0 };
+        // The sink of the current or last async mode, one of 'sinks_'.
+        std::atomic<AsyncSink*> sink_{ nullptr };
+        // Every sink ever started, a thread that saw async mode just before stopAsync() may
+        // still be pushing to an old one, so they're all kept until the logger goes.
+        std::vector<std::unique_ptr<AsyncSink>> sinks_;
+
+        // Registered limiters, linked through LogRateLimiter::next_. They're all static.
+        std::mutex limitersMtx_;
+        LogRateLimiter* limiters_ = nullptr;
+        std::atomic<std::int64_t> lastReport_{ 0 };
+
+        // Must be called with 'facilitiesMtx_' held.
+        std::size_t findOrAddFacility(const std::string& facility);
+
         std::mutex mtx_;
-        LogLevel level_ = LogLevelDEBUG;
         bool verbose_ = false;
+
+        // Effective level of every facility, the only thing VMS_LOG_* reads.
+        std::array<std::atomic<int>, maxFacilities> levels_;
+
+        // Guards everything below.
+        mutable std::mutex facilitiesMtx_;
+        LogLevel level_ = LogLevelDEBUG;
+        std::vector<std::string> facilityNames_;
+        std::vector<bool> hasOwnLevel_;
     };
 
     extern Logger logger;
+
+    // State of a VMS_LOG_*_LIMITED() call site: lets through at most 'perSecond' messages
+    // a second and counts the rest. Lock-free, approximate under contention.
+    class LogRateLimiter
+    {
+    public:
+        LogRateLimiter(std::uint32_t perSecond, const LogSite& site) : perSecond_(perSecond), site_(site) {}
+
+        inline const LogSite& site() const { return site_; }
+
+        static inline std::int64_t currentSecond()
+        {
+            return std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // True if a message may be logged now, 'suppressed' is then the number of messages
+        // suppressed since the last one let through or reported by the logger.
+        inline bool allow(std::uint64_t& suppressed)
+        {
+            auto second = currentSecond();
+            auto window = window_.load(std::memory_order_relaxed);
+            if ((second != window) && window_.compare_exchange_strong(window, second, std::memory_order_relaxed)) {
+                count_.store(0, std::memory_order_relaxed);
+            }
+            if (count_.fetch_add(1, std::memory_order_relaxed) >= perSecond_) {
+                suppressed_.fetch_add(1, std::memory_order_relaxed);
+                if (!registered_.load(std::memory_order_relaxed) && !registered_.exchange(true)) {
+                    logger.registerLimiter(*this);
+                }
+                return false;
+            }
+            suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+
+        // Takes the number of messages suppressed, 0 if still within 'second' unless 'all'.
+        inline std::uint64_t takeSuppressed(std::int64_t second, bool all)
+        {
+            if (!all && (window_.load(std::memory_order_relaxed) >= second)) {
+                return 0;
+            }
+            return suppressed_.exchange(0, std::memory_order_relaxed);
+        }
+
+    private:
+        friend class Logger;
+
+        const std::uint64_t perSecond_;
+        const LogSite& site_;
+        std::atomic<std::int64_t> window_{ 0 };
+        std::atomic<std::uint64_t> count_{ 0 };
+        std::atomic<std::uint64_t> suppressed_{ 0 };
+        std::atomic<bool> registered_{ false };
+        LogRateLimiter* next_ = nullptr;
+    };
+
+    // State of a VMS_LOG_*_SAMPLED() call site: lets through every 'everyN'-th message.
+    class LogSampler
+    {
+    public:
+        explicit LogSampler(std::uint32_t everyN) : everyN_((everyN > 0) ? everyN : 1) {}
+
+        inline bool sample() { return (counter_.fetch_add(1, std::memory_order_relaxed) % everyN_) == 0; }
+
+    private:
+        const std::uint64_t everyN_;
+        std::atomic<std::uint64_t> counter_{ 0 };
+    };
 } }
 
 #define VMS_LOG_IMPL(facility, logEvent, logLevel) \
     do { \
-        if (Vms::Core::logger.isEnabledFor(Vms::Core::LogLevel##logLevel)) { \
-            std::ostringstream __os; \
-            __os << logEvent; \
-            Vms::Core::logger.log(Vms::Core::LogLevel##logLevel, facility, __os.str(), \
-                __FILE__, __LINE__); \
+        static const std::size_t __facilityId = Vms::Core::logger.facilityId(facility); \
+        if (Vms::Core::logger.isEnabledFor(Vms::Core::LogLevel##logLevel, __facilityId)) { \
+            static const Vms::Core::LogSite __site{ Vms::Core::LogLevel##logLevel, facility, __FILE__, __LINE__ }; \
+            Vms::Core::LogRecord __record; \
+            __record << logEvent; \
+            Vms::Core::logger.log(__site, __record); \
         } \
     } while (0)
 
+// Like VMS_LOG_IMPL, but at most 'perSecond' messages a second get through. The next message
+// that gets through tells how many were suppressed, if none does the logger reports them once
+// the second is over, see Logger::registerLimiter().
+#define VMS_LOG_LIMITED_IMPL(facility, perSecond, logEvent, logLevel) \
+    do { \
+        static const std::size_t __facilityId = Vms::Core::logger.facilityId(facility); \
+        if (Vms::Core::logger.isEnabledFor(Vms::Core::LogLevel##logLevel, __facilityId)) { \
+            static const Vms::Core::LogSite __site{ Vms::Core::LogLevel##logLevel, facility, __FILE__, __LINE__ }; \
+            static Vms::Core::LogRateLimiter __limiter(perSecond, __site); \
+            std::uint64_t __suppressed; \
+            if (__limiter.allow(__suppressed)) { \
+                Vms::Core::LogRecord __record; \
+                __record << logEvent; \
+                if (__suppressed > 0) { \
+                    __record << " (suppressed " << __suppressed << " similar message(s))"; \
+                } \
+                Vms::Core::logger.log(__site, __record); \
+            } \
+        } \
+    } while (0)
+
+// Like VMS_LOG_IMPL, but only every 'everyN'-th message gets through.
+#define VMS_LOG_SAMPLED_IMPL(facility, everyN, logEvent, logLevel) \
+    do { \
+        static const std::size_t __facilityId = Vms::Core::logger.facilityId(facility); \
+        if (Vms::Core::logger.isEnabledFor(Vms::Core::LogLevel##logLevel, __facilityId)) { \
+            static Vms::Core::LogSampler __sampler(everyN); \
+            if (__sampler.sample()) { \
+                static const Vms::Core::LogSite __site{ Vms::Core::LogLevel##logLevel, facility, __FILE__, __LINE__ }; \
+                Vms::Core::LogRecord __record; \
+                __record << logEvent << " (sampled 1 of " << (everyN) << ")"; \
+                Vms::Core::logger.log(__site, __record); \
+            } \
+        } \
+    } while (0)
+
+// A compiled out call site, still type-checked so that its arguments count as used.
+#define VMS_LOG_NONE(facility, logEvent) \
+    do { \
+        if (false) { \
+            Vms::Core::LogRecord __record; \
+            __record << facility << logEvent; \
+        } \
+    } while (0)
+
+#if VMS_LOG_MIN_LEVEL <= 0
 #define VMS_LOG_DEBUG(facility, logEvent) VMS_LOG_IMPL(facility, logEvent, DEBUG)
+#define VMS_LOG_DEBUG_LIMITED(facility, perSecond, logEvent) VMS_LOG_LIMITED_IMPL(facility, perSecond, logEvent, DEBUG)
+#define VMS_LOG_DEBUG_SAMPLED(facility, everyN, logEvent) VMS_LOG_SAMPLED_IMPL(facility, everyN, logEvent, DEBUG)
+#else
+#define VMS_LOG_DEBUG(facility, logEvent) VMS_LOG_NONE(facility, logEvent)
+#define VMS_LOG_DEBUG_LIMITED(facility, perSecond, logEvent) VMS_LOG_NONE(facility, (perSecond) << logEvent)
+#define VMS_LOG_DEBUG_SAMPLED(facility, everyN, logEvent) VMS_LOG_NONE(facility, (everyN) << logEvent)
+#endif
+
+#if VMS_LOG_MIN_LEVEL <= 1
 #define VMS_LOG_INFO(facility, logEvent) VMS_LOG_IMPL(facility, logEvent, INFO)
+#define VMS_LOG_INFO_LIMITED(facility, perSecond, logEvent) VMS_LOG_LIMITED_IMPL(facility, perSecond, logEvent, INFO)
+#define VMS_LOG_INFO_SAMPLED(facility, everyN, logEvent) VMS_LOG_SAMPLED_IMPL(facility, everyN, logEvent, INFO)
+#else
+#define VMS_LOG_INFO(facility, logEvent) VMS_LOG_NONE(facility, logEvent)
+#define VMS_LOG_INFO_LIMITED(facility, perSecond, logEvent) VMS_LOG_NONE(facility, (perSecond) << logEvent)
+#define VMS_LOG_INFO_SAMPLED(facility, everyN, logEvent) VMS_LOG_NONE(facility, (everyN) << logEvent)
+#endif
+
+#if VMS_LOG_MIN_LEVEL <= 2
 #define VMS_LOG_WARN(facility, logEvent) VMS_LOG_IMPL(facility, logEvent, WARN)
+#define VMS_LOG_WARN_LIMITED(facility, perSecond, logEvent) VMS_LOG_LIMITED_IMPL(facility, perSecond, logEvent, WARN)
+#define VMS_LOG_WARN_SAMPLED(facility, everyN, logEvent) VMS_LOG_SAMPLED_IMPL(facility, everyN, logEvent, WARN)
+#else
+#define VMS_LOG_WARN(facility, logEvent) VMS_LOG_NONE(facility, logEvent)
+#define VMS_LOG_WARN_LIMITED(facility, perSecond, logEvent) VMS_LOG_NONE(facility, (perSecond) << logEvent)
+#define VMS_LOG_WARN_SAMPLED(facility, everyN, logEvent) VMS_LOG_NONE(facility, (everyN) << logEvent)
+#endif
+
+#if VMS_LOG_MIN_LEVEL <= 3
 #define VMS_LOG_ERROR(facility, logEvent) VMS_LOG_IMPL(facility, logEvent, ERROR)
+#define VMS_LOG_ERROR_LIMITED(facility, perSecond, logEvent) VMS_LOG_LIMITED_IMPL(facility, perSecond, logEvent, ERROR)
+#define VMS_LOG_ERROR_SAMPLED(facility, everyN, logEvent) VMS_LOG_SAMPLED_IMPL(facility, everyN, logEvent, ERROR)
+#else
+#define VMS_LOG_ERROR(facility, logEvent) VMS_LOG_NONE(facility, logEvent)
+#define VMS_LOG_ERROR_LIMITED(facility, perSecond, logEvent) VMS_LOG_NONE(facility, (perSecond) << logEvent)
+#define VMS_LOG_ERROR_SAMPLED(facility, everyN, logEvent) VMS_LOG_NONE(facility, (everyN) << logEvent)
+#endif
 
 #endif
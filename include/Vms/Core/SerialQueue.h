@@ -0,0 +1,99 @@
+#ifndef _VMS_CORE_SERIALQUEUE_H_
+#define _VMS_CORE_SERIALQUEUE_H_
+
+#include "Vms/Core/Strand.h"
+#include <boost/asio/io_service.hpp>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace Vms { namespace Core
+{
+    // Serial executor for hot paths with many tiny posts from many threads. Tasks are
+    // never run concurrently and run in the order they were posted, same as with a strand,
+    // but:
+    //  - post() is lock-free, it's a push to an MPSC linked list whose nodes hold the tasks,
+    //    i.e. a single allocation per task, for the node,
+    //  - the queue is drained by a single handler that runs many tasks in one scheduling slot,
+    //    so there's a single io_service post per burst instead of one per task.
+    // If 'strand' is given the drain handler runs on it, i.e. tasks are also serialized with
+    // all the other handlers of that strand.
+    class SerialQueue : public std::enable_shared_from_this<SerialQueue>
+    {
+    public:
+        // Max. number of tasks run in a single scheduling slot, the rest is rescheduled
+        // so other handlers get their share of ioService.
+        static const std::size_t maxBatch = 256;
+
+        explicit SerialQueue(boost::asio::io_service& ioService, const StrandPtr& strand = StrandPtr());
+        ~SerialQueue();
+
+        inline const StrandPtr& strand() const { return strand_; }
+
+        // Thread-safe.
+        template <class T>
+        inline void post(T&& task)
+        {
+            push(new TaskNode<typename std::decay<T>::type>(std::forward<T>(task)));
+        }
+
+        // True if called from a task of this queue.
+        bool runningInThisThread() const;
+
+    private:
+        struct Node
+        {
+            Node() = default;
+            virtual ~Node() = default;
+
+            virtual void run() {}
+
+            std::atomic<Node*> next{nullptr};
+        };
+
+        template <class T>
+        struct TaskNode : public Node
+        {
+            explicit TaskNode(T&& task) : task(std::move(task)) {}
+            explicit TaskNode(const T& task) : task(task) {}
+
+            void run() override { task(); }
+
+            T task;
+        };
+
+        SerialQueue(const SerialQueue&) = delete;
+        SerialQueue& operator=(const SerialQueue&) = delete;
+
+        // Enqueues 'node' and schedules drain() if it's not scheduled yet.
+        void push(Node* node);
+
+        void enqueue(Node* node);
+
+        // Consumer side, called from drain() only.
+        Node* pop();
+
+        void schedule();
+
+        void drain();
+
+        boost::asio::io_service& ioService_;
+        StrandPtr strand_;
+
+        // Producers push at head_, consumer pops at tail_, stub_ keeps the list non-empty.
+        std::atomic<Node*> head_;
+        Node* tail_;
+        Node stub_;
+
+        std::atomic<bool> scheduled_{false};
+    };
+
+    using SerialQueuePtr = std::shared_ptr<SerialQueue>;
+
+    inline bool isStrandThread(const SerialQueuePtr& queue)
+    {
+        return queue->runningInThisThread();
+    }
+} }
+
+#endif
@@ -2,17 +2,25 @@
 #define _VMS_CORE_TIMEDTASK_H_
 
 #include "Vms/Core/Strand.h"
+#include "Vms/Core/TimerWheel.h"
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/bind_executor.hpp>
+#include <boost/asio/dispatch.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <memory>
+#include <mutex>
+#include <type_traits>
 
 namespace Vms { namespace Core
 {
+    // If a TimerWheel is installed on 'ioService' the task is scheduled on the wheel,
+    // which is much cheaper with lots of timers but only has tick resolution. Pass
+    // 'useTimerWheel' = false for timers that need to be precise.
     class TimedTask : public std::enable_shared_from_this<TimedTask>
     {
     public:
-        explicit TimedTask(boost::asio::io_service& ioService, const StrandPtr& strand = StrandPtr())
-        : timer_(ioService), strand_(strand)
+        explicit TimedTask(boost::asio::io_service& ioService, const StrandPtr& strand = StrandPtr(), bool useTimerWheel = true)
+        : timer_(ioService), strand_(strand), wheel_(useTimerWheel ? TimerWheel::get(ioService) : nullptr), wheelEntry_(*this)
         {
         }
 
@@ -23,6 +31,11 @@ namespace Vms { namespace Core
         template <class T>
         inline void schedule(T&& task, std::chrono::steady_clock::duration timeout)
         {
+            if (wheel_) {
+                scheduleOnWheel(std::forward<T>(task), timeout);
+                return;
+            }
+
             timer_.expires_from_now(timeout);
             auto that = shared_from_this();
             std::uint32_t c = ++cancelCounter_;
@@ -53,11 +66,105 @@ namespace Vms { namespace Core
             // need to use a flag to prevent such cases...
             ++cancelCounter_;
 
+            if (wheel_) {
+                // Released outside of the lock, the task may hold the last references to its
+                // captures and the wheel's reference may be the last one to us.
+                std::unique_ptr<WheelTask> task;
+                std::shared_ptr<void> owner;
+                {
+                    std::lock_guard<std::mutex> lock(wheelMtx_);
+                    // Unless a schedule() got in after the increment above.
+                    if (wheelCounter_ != cancelCounter_) {
+                        owner = wheel_->cancel(wheelEntry_);
+                        task = std::move(wheelTask_);
+                    }
+                }
+                return;
+            }
+
             boost::system::error_code e;
             timer_.cancel(e);
         }
 
     private:
+        // Type erased task scheduled on the wheel, move-only tasks are fine.
+        struct WheelTask
+        {
+            virtual ~WheelTask() = default;
+            virtual void run() = 0;
+        };
+
+        template <class T>
+        struct WheelTaskT : public WheelTask
+        {
+            explicit WheelTaskT(T&& task) : task(std::move(task)) {}
+            explicit WheelTaskT(const T& task) : task(task) {}
+            void run() override { task(); }
+            T task;
+        };
+
+        // Embedded node linking the task into the wheel, rescheduling relinks it in place.
+        class WheelEntry : public TimerWheel::Entry
+        {
+        public:
+            explicit WheelEntry(TimedTask& that) : that_(that) {}
+
+        private:
+            void onExpired() override
+            {
+                that_.onWheelExpired();
+            }
+
+            TimedTask& that_;
+        };
+
+        template <class T>
+        void scheduleOnWheel(T&& task, std::chrono::steady_clock::duration timeout)
+        {
+            // Released outside of the lock, it may hold the last references to its captures.
+            std::unique_ptr<WheelTask> prev;
+
+            // Held while linking, so that onWheelExpired() sees the counter, the task and
+            // the entry in the wheel all from the same schedule.
+            std::lock_guard<std::mutex> lock(wheelMtx_);
+            wheelCounter_ = ++cancelCounter_;
+            prev = std::move(wheelTask_);
+            wheelTask_ = std::make_unique<WheelTaskT<std::decay_t<T>>>(std::forward<T>(task));
+
+            // The wheel already holds a reference to us if the entry is still scheduled.
+            if (!wheel_->reschedule(wheelEntry_, timeout)) {
+                wheel_->schedule(wheelEntry_, shared_from_this(), timeout);
+            }
+        }
+
+        // The wheel keeps a reference to us until this returns.
+        void onWheelExpired()
+        {
+            std::unique_ptr<WheelTask> task;
+            std::uint32_t c;
+            {
+                std::lock_guard<std::mutex> lock(wheelMtx_);
+                c = wheelCounter_;
+                // Canceled, already run by an expiry racing with this one, or rescheduled
+                // after the wheel took the entry out, i.e. this expiry is stale.
+                if ((cancelCounter_ != c) || !wheelTask_ || wheel_->scheduled(wheelEntry_)) {
+                    return;
+                }
+                task = std::move(wheelTask_);
+            }
+
+            if (strand_) {
+                boost::asio::dispatch(*strand_, [that = shared_from_this(), task = std::move(task), c]() {
+                    // Might have been canceled while we were getting onto the strand.
+                    if (that->cancelCounter_ == c) {
+                        task->run();
+                    }
+                });
+            } else {
+                task->run();
+            }
+        }
+
         template <class T>
         struct MoveHelper
         {
@@ -90,6 +197,12 @@ namespace Vms { namespace Core
         boost::asio::steady_timer timer_;
         StrandPtr strand_;
         std::atomic<std::uint32_t> cancelCounter_{0};
+        TimerWheel* wheel_;
+        WheelEntry wheelEntry_;
+        std::mutex wheelMtx_;
+        // The task scheduled on the wheel and the cancelCounter_ value it was scheduled with.
+        std::unique_ptr<WheelTask> wheelTask_;
+        std::uint32_t wheelCounter_ = 0;
     };
 
     using TimedTaskPtr = std::shared_ptr<TimedTask>;
@@ -0,0 +1,135 @@
+#ifndef _VMS_CORE_TIMERWHEEL_H_
+#define _VMS_CORE_TIMERWHEEL_H_
+
+#include "Vms/Core/Types.h"
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace Vms { namespace Core
+{
+    // Hierarchical timing wheel for lots of coarse timers (idle timeouts, heartbeats, connect
+    // timeouts) on a single io_service. Level 0 has a slot per tick, every level above has slots
+    // 64 times longer, so 4 levels cover 2^24 ticks (~46 hours with 10 ms ticks), longer timers
+    // wait in the top level and are put back when it comes around. An entry moves down a level
+    // when its slot comes due, i.e. at most 3 times, schedule and cancel are O(1).
+    // All the timers share a single steady_timer armed for the next tick that has an entry to
+    // expire or move down, empty ticks cost nothing.
+    // Timers fire on a tick boundary, i.e. up to one tick late.
+    // It's an io_service service, install() it once and every TimedTask created on that
+    // io_service afterwards uses it instead of its own steady_timer. Thread-safe.
+    class TimerWheel : public boost::asio::execution_context::service
+    {
+    public:
+        static const std::size_t numLevels = 4;
+        static const std::size_t levelBits = 6;
+        static const std::size_t numSlots = std::size_t(1) << levelBits;
+
+        // Intrusive list node, embedded into the object being scheduled. An entry is kept
+        // alive by 'owner' while it's in the wheel.
+        class Entry
+        {
+        public:
+            Entry() = default;
+            virtual ~Entry() = default;
+
+        protected:
+            // Called on one of the io_service threads when the entry expires, the entry
+            // isn't in the wheel anymore at that point.
+            virtual void onExpired() = 0;
+
+        private:
+            friend class TimerWheel;
+
+            Entry(const Entry&) = delete;
+            Entry& operator=(const Entry&) = delete;
+
+            Entry* prev_ = nullptr;
+            Entry* next_ = nullptr;
+            std::uint64_t expiryTick_ = 0;
+            std::uint8_t level_ = 0;
+            std::uint8_t slot_ = 0;
+            std::shared_ptr<void> owner_;
+        };
+
+        static boost::asio::execution_context::id id;
+
+        explicit TimerWheel(boost::asio::execution_context& context);
+        ~TimerWheel();
+
+        // Adds a wheel with 'tick' resolution to 'ioService', returns the existing wheel if it's already there.
+        static TimerWheel& install(boost::asio::io_service& ioService,
+            std::chrono::steady_clock::duration tick = std::chrono::milliseconds(10));
+
+        // Returns nullptr if no wheel is installed on 'ioService'.
+        static TimerWheel* get(boost::asio::io_service& ioService);
+
+        inline std::chrono::steady_clock::duration tick() const { return tick_; }
+
+        // Schedules 'entry' to expire in 'timeout', reschedules if it's already scheduled.
+        // 'owner' keeps the entry alive until it expires or gets canceled.
+        void schedule(Entry& entry, std::shared_ptr<void> owner, std::chrono::steady_clock::duration timeout);
+
+        // Moves 'entry' to expire in 'timeout' keeping its owner, returns false if it isn't scheduled.
+        bool reschedule(Entry& entry, std::chrono::steady_clock::duration timeout);
+
+        // False once 'entry' has expired or got canceled.
+        bool scheduled(const Entry& entry);
+
+        // Returns the owner 'entry' was scheduled with, release it outside of any lock its
+        // destruction may take. Null if 'entry' isn't scheduled, i.e. it has already expired
+        // (onExpired() may be running or about to run) or was never scheduled.
+        std::shared_ptr<void> cancel(Entry& entry);
+
+    private:
+        void shutdown() override;
+
+        inline std::uint64_t tickOf(std::chrono::steady_clock::time_point t) const
+        {
+            return static_cast<std::uint64_t>((t - epoch_) / tick_);
+        }
+
+        // All called with 'mtx_' held.
+
+        // Links 'entry' to expire in 'timeout'.
+        void link(Entry& entry, std::chrono::steady_clock::duration timeout);
+
+        // Puts 'entry' into the slot for its expiryTick_ relative to currentTick_.
+        void insert(Entry& entry);
+
+        void unlink(Entry& entry);
+
+        // The next tick at which an entry expires or moves down a level, only valid if
+        // the wheel isn't empty.
+        std::uint64_t nextEventTick() const;
+
+        // Moves currentTick_ up to 'tick' (or just before the next event tick), so that new
+        // entries are placed relative to the clock rather than to the last tick processed.
+        void advance(std::uint64_t tick);
+
+        void arm();
+
+        // Runs without 'mtx_' held, takes it itself.
+        void onTimer(const boost::system::error_code& ec);
+
+        boost::asio::io_service& ioService_;
+        std::chrono::steady_clock::duration tick_;
+        const std::chrono::steady_clock::time_point epoch_;
+
+        std::mutex mtx_;
+        boost::asio::steady_timer timer_;
+        // Set while the timer waits for 'armedTick_'.
+        bool armed_ = false;
+        std::uint64_t armedTick_ = 0;
+        // The last tick processed, every entry expires after it.
+        std::uint64_t currentTick_;
+        std::size_t numEntries_ = 0;
+        Entry* slots_[numLevels][numSlots] = {};
+        // Bit i set if slots_[level][i] isn't empty.
+        std::uint64_t occupied_[numLevels] = {};
+    };
+} }
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef _VMS_CORE_WORKSTEALINGPOOL_H_
+#define _VMS_CORE_WORKSTEALINGPOOL_H_
+
+#include "Vms/Core/Types.h"
+#include "Vms/Core/Affinity.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Vms { namespace Core
+{
+    // Thread pool for CPU-bound tasks. Unlike boost::asio::thread_pool there's no single
+    // shared queue, every worker owns a deque:
+    //  - tasks posted from a worker go to its own deque and are popped LIFO by that worker,
+    //  - tasks posted from outside are spread round-robin over the workers' deques,
+    //  - an idle worker steals FIFO from the other deques starting at a random victim.
+    class WorkStealingPool
+    {
+    public:
+        using Task = std::function<void ()>;
+
+        // If 'cpus' is not empty all threads are pinned to that set of CPUs and prefer
+        // allocating memory on its NUMA node.
+        explicit WorkStealingPool(std::size_t numThreads, const CpuSet& cpus = CpuSet());
+        ~WorkStealingPool();
+
+        inline std::size_t numThreads() const { return workers_.size(); }
+
+        // Once stop() has joined the workers the task runs on the calling thread instead, so
+        // that whoever waits for it isn't left hanging.
+        void post(Task task);
+
+        // Batched submission, every deque involved is locked only once.
+        void post(std::vector<Task> tasks);
+
+        // Same semantics as Executor::stop(), i.e. 'force' waits only for the tasks running
+        // and drops the queued ones, force = false waits until ALL tasks are done. Tasks
+        // posted while the workers exit are run by stop() itself unless 'force'.
+        void stop(bool force = true);
+
+    private:
+        struct Worker
+        {
+            std::mutex mtx;
+            std::deque<Task> tasks;
+            std::thread thread;
+            // Set by stop() once the workers are joined, nothing gets queued anymore.
+            bool closed = false;
+        };
+
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+        void run(std::size_t index, const CpuSet& cpus);
+
+        bool popLocal(std::size_t index, Task& task);
+
+        bool steal(std::size_t index, Task& task);
+
+        // Wakes up sleeping workers after 'numTasks' were counted in 'pending_' and queued.
+        void notify(std::size_t numTasks);
+
+        std::vector<std::unique_ptr<Worker>> workers_;
+
+        std::atomic<std::size_t> nextWorker_{0};
+        std::atomic<std::size_t> pending_{0};
+        std::atomic<std::size_t> numSleeping_{0};
+
+        std::mutex sleepMtx_;
+        std::condition_variable sleepCond_;
+        std::atomic<bool> stopped_{false};
+        bool draining_ = false;
+    };
+} }
+
+#endif
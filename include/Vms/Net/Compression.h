@@ -0,0 +1,63 @@
+#ifndef _VMS_NET_COMPRESSION_H_
+#define _VMS_NET_COMPRESSION_H_
+
+#include "Vms/Core/Types.h"
+#include "Vms/Net/OutboundBuffer.h"
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct z_stream_s;
+
+namespace Vms { namespace Net
+{
+    // False if vmsnet was built without zlib, Deflater and Inflater then always fail.
+    bool compressionSupported();
+
+    // Sending side of FeatureCompress: a single raw deflate stream for the whole connection,
+    // so every chunk is compressed with the history of the ones before it.
+    // No preset dictionary: what repeats in the stream is the keys, which a built-in one can't
+    // know, and after the first chunk the 32 KB window of the stream plays that role anyway.
+    // Not thread-safe, but calls may come from different threads as long as they don't overlap.
+    class Deflater
+    {
+    public:
+        // 'level' is zlib's, 1 (fastest) - 9 (best).
+        explicit Deflater(int level = 6);
+        ~Deflater();
+
+        // Appends a FrameCompressed carrying 'buffers' compressed up to a sync flush point,
+        // i.e. the peer can decode all of it without waiting for the next one. False on error.
+        bool compressFrame(const OutboundBuffer::ConstBuffers& buffers, std::string& out);
+
+    private:
+        Deflater(const Deflater&) = delete;
+        Deflater& operator=(const Deflater&) = delete;
+
+        std::unique_ptr<z_stream_s> stream_;
+        bool ok_ = false;
+
+        // Compressed bytes of the chunk being compressed.
+        std::string payload_;
+    };
+
+    // Receiving side of FeatureCompress. Not thread-safe.
+    class Inflater
+    {
+    public:
+        Inflater();
+        ~Inflater();
+
+        // Appends the bytes carried by a FrameCompressed payload to 'out'. False on corrupt data.
+        bool inflate(std::string_view payload, std::string& out);
+
+    private:
+        Inflater(const Inflater&) = delete;
+        Inflater& operator=(const Inflater&) = delete;
+
+        std::unique_ptr<z_stream_s> stream_;
+        bool ok_ = false;
+    };
+} }
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _VMS_NET_LINESCANNER_H_
+#define _VMS_NET_LINESCANNER_H_
+
+#include "Vms/Core/Types.h"
+
+namespace Vms { namespace Net
+{
+    // A complete line found by scanLines(), offsets are relative to the data scanned.
+    struct LineBounds
+    {
+        // Offset of the newline ending the line.
+        std::uint32_t end;
+
+        // Offset of the first space of the line, 'end' if there's none.
+        std::uint32_t space;
+    };
+
+    // Finds up to 'maxLines' complete "...\n" lines in 'data' and the first space of each.
+    // The first line starts at 0, any other right after the previous one's 'end'. Returns the
+    // number of lines found.
+    // Uses a single AVX2 or SSE2 pass, 32 or 16 bytes at a time, if the CPU has them, memchr()
+    // otherwise, picked once at startup. 'size' must fit in 32 bits.
+    std::size_t scanLines(const char* data, std::size_t size, LineBounds* lines, std::size_t maxLines);
+
+    using ScanLinesFn = std::size_t (*)(const char*, std::size_t, LineBounds*, std::size_t);
+
+    // Name of the implementation scanLines() uses: "avx2", "sse2" or "memchr".
+    const char* lineScannerName();
+
+    // The implementation called 'name', i.e. for benchmarks. Null if the build or the CPU
+    // doesn't support it.
+    ScanLinesFn lineScanner(const char* name);
+} }
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef _VMS_NET_OUTBOUNDBUFFER_H_
+#define _VMS_NET_OUTBOUNDBUFFER_H_
+
+#include "Vms/Core/Types.h"
+#include <boost/asio/buffer.hpp>
+#include <array>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace Vms { namespace Net
+{
+    // Outbound bytes of a connection: a contiguous ring that queued messages are appended to,
+    // so a writer can send everything queued so far with a single gather write (at most two
+    // buffers, the ring may wrap) instead of one write per message.
+    // The ring grows as needed. Memory handed out by data() stays valid until the next
+    // consume() even if append() grows the ring in the meantime, so appending while a write
+    // is in flight is fine. Shrinks back once drained.
+    // Not thread-safe.
+    class OutboundBuffer
+    {
+    public:
+        using ConstBuffers = std::array<boost::asio::const_buffer, 2>;
+
+        explicit OutboundBuffer(std::size_t initialCapacity = 16384);
+        ~OutboundBuffer() = default;
+
+        inline std::size_t size() const { return size_; }
+        inline bool empty() const { return size_ == 0; }
+        inline std::size_t capacity() const { return capacity_; }
+
+        // Bytes queued above which the peer is considered slow, 0 = off.
+        inline void setHighWatermark(std::size_t value) { highWatermark_ = value; }
+        inline std::size_t highWatermark() const { return highWatermark_; }
+        inline bool aboveHighWatermark() const { return (highWatermark_ > 0) && (size_ > highWatermark_); }
+
+        void append(std::string_view data);
+
+        // Up to 'maxBytes' of the oldest queued bytes.
+        ConstBuffers data(std::size_t maxBytes) const;
+
+        // Drops 'n' bytes sent.
+        void consume(std::size_t n);
+
+        // Copies up to 'n' queued bytes from offset 'pos' to 'out', returns the number copied.
+        std::size_t peek(std::size_t pos, char* out, std::size_t n) const;
+
+        // Offset of the first 'c' queued at or after offset 'pos', size() if there's none.
+        std::size_t find(char c, std::size_t pos) const;
+
+        // Drops all but the oldest 'n' queued bytes, i.e. the ones not sent yet. The memory
+        // data() handed out for the bytes kept stays valid.
+        void truncate(std::size_t n);
+
+    private:
+        OutboundBuffer(const OutboundBuffer&) = delete;
+        OutboundBuffer& operator=(const OutboundBuffer&) = delete;
+
+        void grow(std::size_t minCapacity);
+
+        const std::size_t initialCapacity_;
+        std::unique_ptr<char[]> data_;
+        std::size_t capacity_;
+        std::size_t head_ = 0;
+        std::size_t size_ = 0;
+        std::size_t highWatermark_ = 0;
+
+        // Blocks replaced by grow() while data() might still be in use.
+        std::vector<std::unique_ptr<char[]>> retired_;
+    };
+} }
+
+#endif
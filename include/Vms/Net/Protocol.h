@@ -0,0 +1,127 @@
+#ifndef _VMS_NET_PROTOCOL_H_
+#define _VMS_NET_PROTOCOL_H_
+
+#include "Vms/Core/Types.h"
+#include <string>
+#include <string_view>
+
+namespace Vms { namespace Net
+{
+    // Wire format of vmsserver and vmsclient.
+    //
+    // Text, the default: the client sends "key value\n" lines, the server sends "key hash\n"
+    // lines with the hash in decimal and free-form text lines, i.e. errors.
+    //
+    // Binary: the client starts with a hello instead of a line, the server answers with a
+    // hello carrying the features it accepted. From then on each side sends frames:
+    //     varint length of the rest | type byte | payload
+    // Varints are LEB128, the hash is 4 bytes little-endian. A zero length is an empty frame,
+    // no type, nothing. A hello is an empty frame, i.e. a '\0', and a FrameHello. Text the
+    // server sent before its hello is stale, the server sends a snapshot of the whole map
+    // after it. Keys may contain '\0', so a client looks for the whole hello in that text.
+    //
+    // With FeatureKeyIds the server numbers the keys of a connection 0, 1, ... in the order it
+    // first sends them: a key's first hash goes out as a FrameKeyHash defining its id, later
+    // ones as a FrameIdHash. With FeatureDelta as well, a hash is sent XORed with the last one
+    // sent for the key (0 for a new key), without its high zero bytes, i.e. an unchanged hash
+    // takes no bytes at all. A FrameKeyReset drops the ids and last hashes, the server sends
+    // one when it drops queued frames, before a snapshot.
+    //
+    // With FeatureCompress the server may, at any frame boundary, start sending its frames as
+    // FrameCompressed chunks of a raw deflate stream (see Vms/Net/Compression.h). Every chunk
+    // ends at a sync flush point and holds whole frames.
+    const std::size_t helloSize = 8;
+
+    const std::uint8_t protocolVersion = 1;
+
+    enum ProtocolFeature : std::uint8_t
+    {
+        FeatureBinary = 0x01,
+        FeatureKeyIds = 0x02,
+        // Requires FeatureKeyIds.
+        FeatureDelta = 0x04,
+        // Accepted only if vmsnet has zlib.
+        FeatureCompress = 0x08
+    };
+
+    enum FrameType : std::uint8_t
+    {
+        // A zero length frame.
+        FrameEmpty = 0,
+        // Client to server: varint key length | key | value.
+        FrameUpdate = 1,
+        // Server to client: varint key length | key | hash.
+        FrameHash = 2,
+        // Server to client: text, i.e. an error.
+        FrameMessage = 3,
+        // Both ways: "VMS" | version | feature bitmask.
+        FrameHello = 4,
+        // Server to client, FeatureKeyIds: varint key id | varint key length | key | hash.
+        FrameKeyHash = 5,
+        // Server to client, FeatureKeyIds: varint key id | hash.
+        FrameIdHash = 6,
+        // Server to client, FeatureKeyIds: nothing.
+        FrameKeyReset = 7,
+        // Server to client, FeatureCompress: deflated frames.
+        FrameCompressed = 8
+    };
+
+    enum class ParseResult
+    {
+        Ok,
+        NeedMore,
+        Invalid
+    };
+
+    // A frame parsed by parseFrame(), 'payload' points into the data parsed.
+    struct Frame
+    {
+        FrameType type;
+        std::string_view payload;
+
+        // Bytes taken by the whole frame.
+        std::size_t size;
+    };
+
+    void appendVarint(std::string& out, std::uint64_t value);
+
+    // 'used' receives the number of bytes taken. Invalid if longer than 10 bytes.
+    ParseResult parseVarint(const char* data, std::size_t size, std::uint64_t& value, std::size_t& used);
+
+    void appendHello(std::string& out, std::uint8_t features);
+
+    // Invalid if 'data' doesn't start with a hello of a known version.
+    ParseResult parseHello(const char* data, std::size_t size, std::uint8_t& features);
+
+    // Invalid if the frame would take more than 'maxSize' bytes.
+    ParseResult parseFrame(const char* data, std::size_t size, std::size_t maxSize, Frame& frame);
+
+    void appendUpdateFrame(std::string& out, std::string_view key, std::string_view value);
+
+    bool parseUpdate(std::string_view payload, std::string_view& key, std::string_view& value);
+
+    void appendHashFrame(std::string& out, std::string_view key, std::uint32_t hash);
+
+    bool parseHash(std::string_view payload, std::string_view& key, std::uint32_t& hash);
+
+    void appendMessageFrame(std::string& out, std::string_view text);
+
+    // 'hash' is what goes on the wire, i.e. the XOR with the last hash of the key with
+    // FeatureDelta, then 'trim' drops its high zero bytes.
+    void appendKeyHashFrame(std::string& out, std::uint32_t id, std::string_view key, std::uint32_t hash, bool trim);
+
+    bool parseKeyHash(std::string_view payload, std::uint32_t& id, std::string_view& key, std::uint32_t& hash);
+
+    void appendIdHashFrame(std::string& out, std::uint32_t id, std::uint32_t hash, bool trim);
+
+    bool parseIdHash(std::string_view payload, std::uint32_t& id, std::uint32_t& hash);
+
+    void appendKeyResetFrame(std::string& out);
+
+    void appendCompressedFrame(std::string& out, std::string_view payload);
+
+    // Text protocol "key hash\n".
+    void appendHashLine(std::string& out, std::string_view key, std::uint32_t hash);
+} }
+
+#endif
@@ -2,8 +2,15 @@
 #define _VMS_NET_TCPACCEPTOR_H_
 
 #include "Vms/Core/Strand.h"
+#include "Vms/Core/Awaitable.h"
+#include "Vms/Core/HandlerAllocator.h"
+#include "Vms/Net/Uring.h"
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <algorithm>
+#include <deque>
+#include <vector>
 
 namespace Vms { namespace Net
 {
@@ -13,28 +20,100 @@ namespace Vms { namespace Net
         using AcceptFn = std::function<void (boost::asio::ip::tcp::socket)>;
 
         TcpAcceptor(boost::asio::io_service& ioService, const boost::asio::ip::tcp& protocol);
-        ~TcpAcceptor() = default;
+        ~TcpAcceptor();
 
         inline boost::asio::io_service& ioService() { return ioService_; }
         inline const boost::asio::io_service& ioService() const { return ioService_; }
 
-        std::error_code bind(const boost::asio::ip::tcp::endpoint& endpoint, boost::asio::ip::tcp::endpoint& boundEndpoint);
+        inline const Core::StrandPtr& strand() const { return strand_; }
+
+        // 'reusePort' sets SO_REUSEPORT, i.e. several acceptors (typically one per Executor) may
+        // bind to the same endpoint and the kernel will spread incoming connections across them.
+        std::error_code bind(const boost::asio::ip::tcp::endpoint& endpoint, boost::asio::ip::tcp::endpoint& boundEndpoint,
+            bool reusePort = false);
+
+        // Sets SO_BUSY_POLL on every accepted socket, i.e. the kernel busy polls the device
+        // queue for that long on blocking reads/polls. Zero (default) leaves the system default.
+        // Must be called before listen().
+        inline void setBusyPoll(std::chrono::microseconds busyPoll) { busyPoll_ = busyPoll; }
+
+        // Number of async_accepts kept in flight (default 1). Every completed one is re-armed
+        // before the accepted connection is handed out, and the connections still waiting in
+        // the backlog are then taken with non-blocking accepts, up to maxDrain per wakeup.
+        // A slow accept callback/loop doesn't leave the backlog unattended this way.
+        // Must be called before listen(). Not used with a Uring, its multishot accept
+        // takes them all.
+        inline void setOutstandingAccepts(std::uint32_t num) { numAccepts_ = std::max<std::uint32_t>(num, 1); }
+
+        // Max. number of connections taken from the backlog per wakeup.
+        static const std::uint32_t maxDrain = 256;
 
         // Callbacks from a single TcpAcceptor are never called concurrently.
         std::error_code listen(std::uint32_t backlog, AcceptFn cb);
 
+        // Listens without starting the callback driven accept loop, connections are
+        // taken with accept() instead.
+        std::error_code listen(std::uint32_t backlog);
+
+        // Accepts a single connection into 'socket', i.e.
+        //   for (;;) { tcp::socket s(ioService); auto ec = co_await acceptor->accept(s); ... }
+        // Returns operation_aborted once the acceptor is stopped. Must not be called
+        // concurrently or together with the callback driven listen(). The accepting
+        // coroutine must run on strand(), connections are accepted in the background
+        // and queued there.
+        // If a Uring is installed on the io_service the connections come from a single
+        // multishot accept.
+        Core::Awaitable<std::error_code> accept(boost::asio::ip::tcp::socket& socket);
+
         void stop();
 
     private:
         TcpAcceptor(const TcpAcceptor&) = delete;
         TcpAcceptor& operator=(const TcpAcceptor&) = delete;
 
-        void onAccept(const std::error_code& err, boost::asio::ip::tcp::socket socket, AcceptFn cb);
+        // Arms the accepts that aren't in flight, on the strand.
+        void armAccepts();
+
+        void doAccept(std::size_t slot);
+
+        // Applies socket options to an accepted socket.
+        void setupSocket(boost::asio::ip::tcp::socket& socket);
+
+        void onAccept(std::size_t slot, const std::error_code& err, boost::asio::ip::tcp::socket socket);
+
+        // Non-blocking accepts of whatever else is in the backlog.
+        void drainBacklog();
+
+        // Hands the queued connections to the callback or wakes up accept().
+        void deliver();
+
+        class MultishotAccept;
+
+        // Called on the strand for every completion of the multishot accept.
+        void onMultishotAccept(int res, bool more);
 
         boost::asio::io_service& ioService_;
 
         Core::StrandPtr strand_;
+        const boost::asio::ip::tcp protocol_;
         boost::asio::ip::tcp::acceptor acceptor_;
+
+        std::chrono::microseconds busyPoll_{0};
+        std::uint32_t numAccepts_ = 1;
+
+        // Set once by listen(), only accessed on the strand afterwards.
+        AcceptFn cb_;
+
+        // Accessed on the strand only.
+        std::unique_ptr<Core::HandlerMemory[]> acceptMemory_;
+        std::vector<bool> armed_;
+        std::deque<boost::asio::ip::tcp::socket> accepted_;
+        std::error_code acceptError_;
+        boost::asio::steady_timer acceptSignal_;
+
+        // Multishot accept state, accessed on the strand only.
+        Uring* uring_;
+        Uring::Operation* multishotOp_ = nullptr;
     };
 } }
 
@@ -2,6 +2,7 @@
 #define _VMS_NET_TCPCONNECTOR_H_
 
 #include "Vms/Core/Strand.h"
+#include "Vms/Core/Awaitable.h"
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
 
@@ -23,6 +24,10 @@ namespace Vms { namespace Net
         // Callbacks from a single TcpConnector are never called concurrently.
         void connect(ConnectFn cb);
 
+        // Connects 'socket', i.e. "auto ec = co_await connector.connect(s);", returns
+        // timed_out if not connected within the timeout.
+        Core::Awaitable<std::error_code> connect(boost::asio::ip::tcp::socket& socket);
+
     private:
         TcpConnector(const TcpConnector&) = delete;
         TcpConnector& operator=(const TcpConnector&) = delete;
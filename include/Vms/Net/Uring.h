@@ -0,0 +1,264 @@
+#ifndef _VMS_NET_URING_H_
+#define _VMS_NET_URING_H_
+
+#include "Vms/Core/Types.h"
+#include "Vms/Core/HandlerAllocator.h"
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <memory>
+#include <mutex>
+
+namespace Vms { namespace Net
+{
+    // io_uring backend for socket I/O on Linux, an io_service service like Core::TimerWheel.
+    // Operations are queued into the submission ring and all the operations queued by the time
+    // the io_service gets to it are submitted by a single io_uring_enter(), so the per-client
+    // sends a broadcast produces cost one syscall instead of one per client. Small sends are
+    // copied into registered buffers. Completions are reaped on the io_service via an eventfd
+    // and dispatched to the handlers' executors.
+    // It's install()-ed per io_service, UringStream and TcpAcceptor pick it up automatically.
+    // Sends copied into registered buffers are writes, which can't pass MSG_NOSIGNAL, so they
+    // raise SIGPIPE on a socket whose peer is gone. Ignore it when using Uring.
+    // Thread-safe.
+    class Uring : public boost::asio::execution_context::service
+    {
+    public:
+        // An in-flight operation, its address is the SQE's user_data.
+        class Operation
+        {
+        public:
+            Operation() = default;
+
+            // Called on an io_service thread with CQE's 'res' and 'flags'. Unless 'flags' has
+            // IORING_CQE_F_MORE (multishot) the operation is done and must free itself.
+            virtual void complete(int res, std::uint32_t flags) = 0;
+
+            // Frees an operation that's still in flight when the service shuts down.
+            virtual void destroy() = 0;
+
+        protected:
+            ~Operation() = default;
+
+        private:
+            friend class Uring;
+
+            Operation(const Operation&) = delete;
+            Operation& operator=(const Operation&) = delete;
+
+            Operation* prev_ = nullptr;
+            Operation* next_ = nullptr;
+            int fixedBuffer_ = -1;
+        };
+
+        struct Stats
+        {
+            // Number of SQEs submitted.
+            std::uint64_t numSubmitted = 0;
+            // Number of io_uring_enter() calls made to submit them.
+            std::uint64_t numEnters = 0;
+            // Number of sends done from registered buffers.
+            std::uint64_t numFixedSends = 0;
+        };
+
+        static boost::asio::execution_context::id id;
+
+        explicit Uring(boost::asio::execution_context& context);
+        ~Uring();
+
+        // Sets up a ring with 'entries' SQEs and 'numFixedBuffers' registered send buffers of
+        // 'fixedBufferSize' bytes on 'ioService'. Fails with operation_not_supported if the
+        // system has no io_uring.
+        static std::error_code install(boost::asio::io_service& ioService,
+            std::uint32_t entries = 1024,
+            std::uint32_t numFixedBuffers = 256,
+            std::size_t fixedBufferSize = 16384);
+
+        // Returns nullptr if no ring is installed on 'ioService'.
+        static Uring* get(boost::asio::io_service& ioService);
+
+        inline boost::asio::io_service& ioService() { return ioService_; }
+
+        Stats stats() const;
+
+        void recv(int fd, void* data, std::size_t size, Operation* op);
+
+        void send(int fd, const void* data, std::size_t size, Operation* op);
+
+        // Multishot accept, 'op' completes with a new fd for every accepted connection until
+        // a completion without IORING_CQE_F_MORE.
+        void acceptMultishot(int fd, Operation* op);
+
+        // Asynchronously cancels in-flight 'op', it still completes (with -ECANCELED).
+        void cancel(Operation* op);
+
+        // Drops the SQEs using 'fd' that haven't been submitted yet, their operations complete
+        // with -ECANCELED. Call it right before closing 'fd', the next fd opened (e.g. accepted)
+        // may get the same number and these would hit it once submitted.
+        void cancelQueued(int fd);
+
+        // True if a completion with 'flags' isn't the last one of a multishot operation.
+        static bool hasMore(std::uint32_t flags);
+
+    private:
+        struct Ring;
+
+        void shutdown() override;
+
+        boost::asio::io_service& ioService_;
+        std::unique_ptr<Ring> ring_;
+    };
+
+    // A view of a connected socket doing its I/O through Uring. Meets asio's AsyncReadStream
+    // and AsyncWriteStream, so it can be used with async_read_until(), async_write() etc.
+    // 'socket' still owns the fd, shut it down and cancelQueued() before closing it so that
+    // the in-flight operations complete. Operations started once it's closed fail with bad_descriptor.
+    // Like the socket it allows one read and one write in flight at a time.
+    class UringStream
+    {
+    public:
+        using executor_type = boost::asio::io_context::executor_type;
+
+        UringStream(Uring& uring, boost::asio::ip::tcp::socket& socket)
+        : uring_(uring), socket_(socket)
+        {
+        }
+
+        ~UringStream() = default;
+
+        inline executor_type get_executor() noexcept { return uring_.ioService().get_executor(); }
+
+        // See Uring::cancelQueued().
+        inline void cancelQueued() { uring_.cancelQueued(socket_.native_handle()); }
+
+        template <class MutableBufferSequence, class ReadHandler>
+        auto async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler)
+        {
+            return boost::asio::async_initiate<ReadHandler, void (boost::system::error_code, std::size_t)>(
+                [this](auto&& handler, const MutableBufferSequence& buffers) {
+                    auto b = firstBuffer(boost::asio::buffer_sequence_begin(buffers), boost::asio::buffer_sequence_end(buffers));
+                    if (!socket_.is_open()) {
+                        completeNow(std::move(handler), boost::asio::error::bad_descriptor);
+                        return;
+                    }
+                    if (b.size() == 0) {
+                        completeNow(std::move(handler), boost::system::error_code());
+                        return;
+                    }
+                    auto* op = makeOp(std::move(handler), readMemory_, true, b.size());
+                    uring_.recv(socket_.native_handle(), b.data(), b.size(), op);
+                }, handler, buffers);
+        }
+
+        template <class ConstBufferSequence, class WriteHandler>
+        auto async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+        {
+            return boost::asio::async_initiate<WriteHandler, void (boost::system::error_code, std::size_t)>(
+                [this](auto&& handler, const ConstBufferSequence& buffers) {
+                    auto b = firstBuffer(boost::asio::buffer_sequence_begin(buffers), boost::asio::buffer_sequence_end(buffers));
+                    if (!socket_.is_open()) {
+                        completeNow(std::move(handler), boost::asio::error::bad_descriptor);
+                        return;
+                    }
+                    if (b.size() == 0) {
+                        completeNow(std::move(handler), boost::system::error_code());
+                        return;
+                    }
+                    auto* op = makeOp(std::move(handler), writeMemory_, false, b.size());
+                    uring_.send(socket_.native_handle(), b.data(), b.size(), op);
+                }, handler, buffers);
+        }
+
+    private:
+        template <class Handler>
+        class IoOp final : public Uring::Operation
+        {
+        public:
+            IoOp(Handler&& handler, executor_type ioExecutor, Core::HandlerMemory& memory, bool isRead, std::size_t size)
+            : handler_(std::move(handler)), ioExecutor_(ioExecutor), memory_(memory), isRead_(isRead), size_(size)
+            {
+            }
+
+            void complete(int res, std::uint32_t /*flags*/) override
+            {
+                boost::system::error_code ec;
+                std::size_t n = 0;
+                if (res < 0) {
+                    ec.assign(-res, boost::system::system_category());
+                } else if ((res == 0) && isRead_ && (size_ > 0)) {
+                    ec = boost::asio::error::eof;
+                } else {
+                    n = static_cast<std::size_t>(res);
+                }
+
+                auto executor = boost::asio::get_associated_executor(handler_, ioExecutor_);
+                Handler handler(std::move(handler_));
+                destroy();
+
+                boost::asio::dispatch(executor, [handler = std::move(handler), ec, n]() mutable {
+                    handler(ec, n);
+                });
+            }
+
+            void destroy() override
+            {
+                auto& memory = memory_;
+                this->~IoOp();
+                memory.deallocate(this);
+            }
+
+        private:
+            Handler handler_;
+            executor_type ioExecutor_;
+            Core::HandlerMemory& memory_;
+            const bool isRead_;
+            const std::size_t size_;
+        };
+
+        // Only the first non-empty buffer is transferred, same as a short read or write.
+        template <class Iterator>
+        static auto firstBuffer(Iterator begin, Iterator end) -> typename std::iterator_traits<Iterator>::value_type
+        {
+            for (auto it = begin; it != end; ++it) {
+                if (boost::asio::buffer_size(*it) > 0) {
+                    return *it;
+                }
+            }
+            return typename std::iterator_traits<Iterator>::value_type();
+        }
+
+        // For transfers that don't get to the kernel, e.g. zero-sized ones, the kernel would
+        // wait for readiness instead.
+        template <class Handler>
+        void completeNow(Handler&& handler, const boost::system::error_code& ec)
+        {
+            auto executor = boost::asio::get_associated_executor(handler, get_executor());
+            boost::asio::post(executor, [handler = std::move(handler), ec]() mutable {
+                handler(ec, 0);
+            });
+        }
+
+        template <class Handler>
+        Uring::Operation* makeOp(Handler&& handler, Core::HandlerMemory& memory, bool isRead, std::size_t size)
+        {
+            using Op = IoOp<typename std::decay<Handler>::type>;
+            void* p = memory.allocate(sizeof(Op));
+            return new (p) Op(std::forward<Handler>(handler), get_executor(), memory, isRead, size);
+        }
+
+        UringStream(const UringStream&) = delete;
+        UringStream& operator=(const UringStream&) = delete;
+
+        Uring& uring_;
+        boost::asio::ip::tcp::socket& socket_;
+
+        Core::HandlerMemory readMemory_;
+        Core::HandlerMemory writeMemory_;
+    };
+} }
+
+#endif
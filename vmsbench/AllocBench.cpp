@@ -0,0 +1,200 @@
+#include "Benchmarks.h"
+#include "Vms/Core/HandlerAllocator.h"
+#include "Vms/Core/Strand.h"
+#include "Vms/Core/Awaitable.h"
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+    enum class Mode
+    {
+        Default,
+        Recycle,
+        Coroutine
+    };
+
+    const char* modeName(Mode mode)
+    {
+        switch (mode) {
+        case Mode::Default: return "default";
+        case Mode::Recycle: return "HandlerMemory";
+        case Mode::Coroutine: return "coroutine";
+        }
+        return "";
+    }
+
+    // Ping-pong of "key value\n" lines over loopback, the same read/write chains
+    // vmsserver's Connection runs, with and without recycled handler memory.
+    class PingPong : public std::enable_shared_from_this<PingPong>
+    {
+    public:
+        PingPong(boost::asio::io_service& ioService, boost::asio::ip::tcp::socket writer,
+            boost::asio::ip::tcp::socket reader, bool recycle, std::uint64_t iterations)
+        : strand_(Vms::Core::makeStrand(ioService)),
+          writer_(std::move(writer)),
+          reader_(std::move(reader)),
+          recycle_(recycle),
+          iterations_(iterations)
+        {
+        }
+
+        void start()
+        {
+            write();
+            read();
+        }
+
+    private:
+        template <class Handler>
+        void asyncWrite(Handler&& h)
+        {
+            if (recycle_) {
+                boost::asio::async_write(writer_, boost::asio::buffer(line_), boost::asio::bind_executor(*strand_,
+                    Vms::Core::makeAllocHandler(writeMemory_, std::forward<Handler>(h))));
+            } else {
+                boost::asio::async_write(writer_, boost::asio::buffer(line_), boost::asio::bind_executor(*strand_,
+                    std::forward<Handler>(h)));
+            }
+        }
+
+        template <class Handler>
+        void asyncRead(Handler&& h)
+        {
+            if (recycle_) {
+                boost::asio::async_read_until(reader_, b_, "\n", boost::asio::bind_executor(*strand_,
+                    Vms::Core::makeAllocHandler(readMemory_, std::forward<Handler>(h))));
+            } else {
+                boost::asio::async_read_until(reader_, b_, "\n", boost::asio::bind_executor(*strand_,
+                    std::forward<Handler>(h)));
+            }
+        }
+
+        void write()
+        {
+            auto self = shared_from_this();
+            asyncWrite([self](const boost::system::error_code& ec, std::size_t) {
+                if (ec) {
+                    std::cerr << "write failed: " << ec.message() << std::endl;
+                }
+            });
+        }
+
+        void read()
+        {
+            auto self = shared_from_this();
+            asyncRead([self](const boost::system::error_code& ec, std::size_t sz) {
+                if (ec) {
+                    std::cerr << "read failed: " << ec.message() << std::endl;
+                    return;
+                }
+                self->b_.consume(sz);
+                if (++self->count_ < self->iterations_) {
+                    self->write();
+                    self->read();
+                }
+            });
+        }
+
+        const std::string line_ = "some_key some_value\n";
+
+        Vms::Core::StrandPtr strand_;
+        boost::asio::ip::tcp::socket writer_;
+        boost::asio::ip::tcp::socket reader_;
+        boost::asio::streambuf b_;
+        const bool recycle_;
+        const std::uint64_t iterations_;
+        std::uint64_t count_ = 0;
+
+        Vms::Core::HandlerMemory readMemory_;
+        Vms::Core::HandlerMemory writeMemory_;
+    };
+
+    // The same ping-pong as a coroutine on a strand, the way vmsserver's Connection loops run.
+    Vms::Core::Awaitable<void> coPingPong(boost::asio::ip::tcp::socket writer,
+        boost::asio::ip::tcp::socket reader, std::uint64_t iterations)
+    {
+        const std::string line = "some_key some_value\n";
+        boost::asio::streambuf b;
+
+        try {
+            for (std::uint64_t i = 0; i < iterations; ++i) {
+                co_await boost::asio::async_write(writer, boost::asio::buffer(line), Vms::Core::useAwaitable);
+                auto sz = co_await boost::asio::async_read_until(reader, b, "\n", Vms::Core::useAwaitable);
+                b.consume(sz);
+            }
+        } catch (const boost::system::system_error& e) {
+            std::cerr << "ping-pong failed: " << e.what() << std::endl;
+        }
+    }
+
+    bool runPingPong(Mode mode, std::uint64_t iterations)
+    {
+        boost::asio::io_service ioService(1);
+
+        boost::asio::ip::tcp::acceptor acceptor(ioService,
+            boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        boost::asio::ip::tcp::socket writer(ioService);
+        boost::asio::ip::tcp::socket reader(ioService);
+        boost::system::error_code ec;
+        writer.connect(acceptor.local_endpoint(), ec);
+        if (!ec) {
+            acceptor.accept(reader, ec);
+        }
+        if (ec) {
+            std::cerr << "alloc: cannot connect: " << ec.message() << std::endl;
+            return false;
+        }
+
+        // Warm up, i.e. let streambuf and asio's internals reach their steady state.
+        const std::uint64_t warmup = 1000;
+        if (mode == Mode::Coroutine) {
+            boost::asio::co_spawn(*Vms::Core::makeStrand(ioService),
+                coPingPong(std::move(writer), std::move(reader), warmup + iterations), boost::asio::detached);
+        } else {
+            auto pp = std::make_shared<PingPong>(ioService, std::move(writer), std::move(reader),
+                mode == Mode::Recycle, warmup + iterations);
+            pp->start();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::uint64_t allocations = 0;
+        for (std::uint64_t i = 0; (i < 2 * warmup) && (ioService.run_one() > 0); ++i) {
+        }
+        allocations = allocationCount();
+        start = std::chrono::steady_clock::now();
+        ioService.run();
+        allocations = allocationCount() - allocations;
+        auto sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << std::left << std::setw(18) << modeName(mode)
+            << std::right << std::setw(10) << iterations << " msgs"
+            << std::setw(12) << allocations << " allocs"
+            << std::setw(10) << std::fixed << std::setprecision(2) << (static_cast<double>(allocations) / iterations) << " allocs/msg"
+            << std::setw(10) << std::setprecision(3) << sec << " s" << std::endl;
+
+        return true;
+    }
+}
+
+int runAllocBench(const BenchOptions& opts)
+{
+    const std::uint64_t iterations = (opts.iterations > 0) ? opts.iterations : 200000;
+
+    std::cout << "alloc: heap allocations per read+write on a strand" << std::endl;
+
+    if (!runPingPong(Mode::Default, iterations) || !runPingPong(Mode::Recycle, iterations) ||
+        !runPingPong(Mode::Coroutine, iterations)) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include "Benchmarks.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replaces global operator new/delete of vmsbench to count heap allocations.
+
+namespace
+{
+    std::atomic<std::uint64_t> numAllocations{0};
+}
+
+std::uint64_t allocationCount()
+{
+    return numAllocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t sz)
+{
+    numAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(sz ? sz : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t sz)
+{
+    return ::operator new(sz);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
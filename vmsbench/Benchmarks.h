@@ -0,0 +1,39 @@
+#ifndef _BENCHMARKS_H_
+#define _BENCHMARKS_H_
+
+#include "Vms/Core/Types.h"
+
+struct BenchOptions
+{
+    std::uint32_t threads = 0;
+    std::uint32_t producers = 0;
+    std::uint64_t iterations = 0;
+};
+
+// Number of heap allocations (global operator new) made by the process so far.
+std::uint64_t allocationCount();
+
+// Each benchmark prints its results to stdout and returns process exit code.
+
+// WorkStealingPool vs boost::asio::thread_pool on many small hash tasks.
+int runHashPoolBench(const BenchOptions& opts);
+
+// Heap allocations per read/write with and without Core::HandlerMemory.
+int runAllocBench(const BenchOptions& opts);
+
+// Core::TimedTask rearm/fire cost with its own steady_timer vs Core::TimerWheel.
+int runTimerBench(const BenchOptions& opts);
+
+// epoll vs Net::Uring on a broadcast to many clients and on a line ping-pong.
+int runUringBench(const BenchOptions& opts);
+
+// Core::Logger synchronous vs async mode, many threads logging at once.
+int runLogBench(const BenchOptions& opts);
+
+// Per-message writes vs gather writes of Net::OutboundBuffer on bursts of broadcasts.
+int runFanoutBench(const BenchOptions& opts);
+
+// Net::scanLines() memchr vs SSE2 vs AVX2 on pipelined updates.
+int runLineScanBench(const BenchOptions& opts);
+
+#endif
@@ -0,0 +1,193 @@
+#include "Benchmarks.h"
+#include "Vms/Core/Awaitable.h"
+#include "Vms/Net/OutboundBuffer.h"
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    const std::uint32_t numClients = 100;
+    const std::string message = "some_key 1234567890\n";
+
+    // Counts write_some()s, i.e. send syscalls.
+    struct CountingSocket
+    {
+        using executor_type = boost::asio::ip::tcp::socket::executor_type;
+
+        executor_type get_executor() { return socket.get_executor(); }
+
+        template <class ConstBufferSequence, class WriteHandler>
+        auto async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+        {
+            ++numWrites;
+            return socket.async_write_some(buffers, std::forward<WriteHandler>(handler));
+        }
+
+        boost::asio::ip::tcp::socket& socket;
+        std::uint64_t& numWrites;
+    };
+
+    // The server side of a client: a write loop like vmsserver's Connection, either one
+    // write per queued message or gather writes of the outbound ring.
+    struct Client
+    {
+        Client(boost::asio::io_service& ioService)
+        : server(ioService), client(ioService), signal(ioService, boost::asio::steady_timer::time_point::max())
+        {
+        }
+
+        void send(const std::string& msg, bool gather)
+        {
+            if (gather ? outbound.empty() : queue.empty()) {
+                signal.cancel();
+            }
+            if (gather) {
+                outbound.append(msg);
+            } else {
+                queue.push_back(msg);
+            }
+        }
+
+        boost::asio::ip::tcp::socket server;
+        boost::asio::ip::tcp::socket client;
+        boost::asio::steady_timer signal;
+        std::deque<std::string> queue;
+        Vms::Net::OutboundBuffer outbound;
+        std::uint64_t numWrites = 0;
+        bool done = false;
+    };
+
+    Vms::Core::Awaitable<void> writeLoop(Client& c, bool gather)
+    {
+        CountingSocket socket{ c.server, c.numWrites };
+        boost::system::error_code ec;
+        while (!c.done) {
+            if (gather ? c.outbound.empty() : c.queue.empty()) {
+                co_await c.signal.async_wait(boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+                continue;
+            }
+            if (gather) {
+                auto sz = co_await boost::asio::async_write(socket, c.outbound.data(256 * 1024),
+                    boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+                c.outbound.consume(sz);
+            } else {
+                co_await boost::asio::async_write(socket, boost::asio::buffer(c.queue.front()),
+                    boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+                c.queue.pop_front();
+            }
+            if (ec) {
+                std::cerr << "fanout: write failed: " << ec.message() << std::endl;
+                co_return;
+            }
+        }
+    }
+
+    Vms::Core::Awaitable<void> readLoop(Client& c, std::uint64_t expected, std::uint32_t& numDone)
+    {
+        std::vector<char> buf(65536);
+        std::uint64_t received = 0;
+        boost::system::error_code ec;
+        while (received < expected) {
+            received += co_await c.client.async_read_some(boost::asio::buffer(buf),
+                boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+            if (ec) {
+                std::cerr << "fanout: read failed: " << ec.message() << std::endl;
+                break;
+            }
+        }
+        c.done = true;
+        c.signal.cancel();
+        ++numDone;
+    }
+
+    bool run(bool gather, std::uint32_t bursts, std::uint32_t burstSize)
+    {
+        boost::asio::io_service ioService(1);
+        auto strand = Vms::Core::makeStrand(ioService);
+
+        boost::asio::ip::tcp::acceptor acceptor(ioService,
+            boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        std::vector<std::unique_ptr<Client>> clients;
+        for (std::uint32_t i = 0; i < numClients; ++i) {
+            std::unique_ptr<Client> c(new Client(ioService));
+            boost::system::error_code ec;
+            c->client.connect(acceptor.local_endpoint(), ec);
+            if (!ec) {
+                acceptor.accept(c->server, ec);
+            }
+            if (ec) {
+                std::cerr << "fanout: cannot connect: " << ec.message() << std::endl;
+                return false;
+            }
+            c->server.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+            clients.push_back(std::move(c));
+        }
+
+        const std::uint64_t expected = static_cast<std::uint64_t>(bursts) * burstSize * message.size();
+        std::uint32_t numDone = 0;
+        for (auto& c : clients) {
+            boost::asio::co_spawn(*strand, writeLoop(*c, gather), boost::asio::detached);
+            boost::asio::co_spawn(*strand, readLoop(*c, expected, numDone), boost::asio::detached);
+        }
+
+        // Bursts of broadcasts, each one a single handler queueing 'burstSize' messages
+        // to every client, like a hash pool worker finishing a batch of updates.
+        auto start = std::chrono::steady_clock::now();
+        for (std::uint32_t b = 0; b < bursts; ++b) {
+            boost::asio::post(*strand, [&clients, gather, burstSize]() {
+                for (std::uint32_t m = 0; m < burstSize; ++m) {
+                    for (auto& c : clients) {
+                        c->send(message, gather);
+                    }
+                }
+            });
+        }
+        while (numDone < numClients) {
+            ioService.run_one();
+        }
+        auto sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::uint64_t numWrites = 0;
+        for (auto& c : clients) {
+            numWrites += c->numWrites;
+        }
+        const double numUpdates = static_cast<double>(bursts) * burstSize;
+
+        std::cout << "  " << std::left << std::setw(16) << (gather ? "gather (ring)" : "per message") << std::right
+            << std::setw(8) << std::fixed << std::setprecision(1) << (sec * 1e3) << " ms"
+            << std::setw(10) << std::setprecision(3) << (numWrites / numUpdates) << " writes/update"
+            << std::setw(10) << std::setprecision(4) << (numWrites / (numUpdates * numClients)) << " writes/message"
+            << std::endl;
+
+        // Let the loops finish so that nothing refers to 'clients' any more.
+        for (auto& c : clients) {
+            c->signal.cancel();
+        }
+        ioService.poll();
+        return true;
+    }
+}
+
+int runFanoutBench(const BenchOptions& opts)
+{
+    const std::uint32_t bursts = (opts.iterations > 0) ? static_cast<std::uint32_t>(opts.iterations) : 20;
+    const std::uint32_t burstSize = 1000;
+
+    std::cout << "fanout: " << bursts << " bursts of " << burstSize << " broadcasts to " << numClients << " clients" << std::endl;
+
+    if (!run(false, bursts, burstSize) || !run(true, bursts, burstSize)) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include "Benchmarks.h"
+#include "Vms/Core/WorkStealingPool.h"
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/crc.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+    // Small tasks, comparable to hashing a short value in vmsserver.
+    const char value[] = "some value of a typical length";
+
+    std::atomic<std::uint32_t> sink{0};
+
+    class Counter
+    {
+    public:
+        explicit Counter(std::uint64_t total) : total_(total) {}
+
+        inline void done()
+        {
+            if (count_.fetch_add(1, std::memory_order_acq_rel) + 1 == total_) {
+                p_.set_value();
+            }
+        }
+
+        inline void wait() { p_.get_future().wait(); }
+
+    private:
+        const std::uint64_t total_;
+        std::atomic<std::uint64_t> count_{0};
+        std::promise<void> p_;
+    };
+
+    inline void hashTask(Counter& counter)
+    {
+        boost::crc_32_type crc32;
+        crc32.process_bytes(value, sizeof(value) - 1);
+        sink.fetch_add(crc32.checksum(), std::memory_order_relaxed);
+        counter.done();
+    }
+
+    template <class PostFn>
+    double runProducers(std::uint32_t producers, std::uint64_t tasks, Counter& counter, PostFn postFn)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (std::uint32_t i = 0; i < producers; ++i) {
+            threads.emplace_back([&, i]() {
+                std::uint64_t n = tasks / producers + ((i < tasks % producers) ? 1 : 0);
+                postFn(n, counter);
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        counter.wait();
+
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void report(const char* pool, const char* scenario, std::uint64_t tasks, double seconds)
+    {
+        std::cout << std::left << std::setw(18) << pool << std::setw(10) << scenario
+            << std::right << std::setw(12) << tasks << std::setw(10) << std::fixed << std::setprecision(3) << seconds << " s"
+            << std::setw(10) << std::setprecision(2) << (tasks / seconds / 1e6) << " Mtasks/s" << std::endl;
+    }
+}
+
+int runHashPoolBench(const BenchOptions& opts)
+{
+    const std::uint64_t tasks = (opts.iterations > 0) ? opts.iterations : 2000000;
+    const std::uint64_t batchSize = 64;
+    // Clamped so that the nested scenarios post at least one task with few iterations.
+    const std::uint64_t fanOut = std::min<std::uint64_t>(64, tasks);
+
+    std::cout << "hashpool: " << opts.threads << " worker(s), " << opts.producers << " producer(s)" << std::endl;
+
+    // Every producer posts tasks one by one.
+    {
+        boost::asio::thread_pool pool(opts.threads);
+        Counter counter(tasks);
+        auto sec = runProducers(opts.producers, tasks, counter, [&pool](std::uint64_t n, Counter& c) {
+            for (std::uint64_t i = 0; i < n; ++i) {
+                boost::asio::post(pool, [&c]() { hashTask(c); });
+            }
+        });
+        report("asio::thread_pool", "single", tasks, sec);
+        pool.join();
+    }
+    {
+        Vms::Core::WorkStealingPool pool(opts.threads);
+        Counter counter(tasks);
+        auto sec = runProducers(opts.producers, tasks, counter, [&pool](std::uint64_t n, Counter& c) {
+            for (std::uint64_t i = 0; i < n; ++i) {
+                pool.post([&c]() { hashTask(c); });
+            }
+        });
+        report("WorkStealingPool", "single", tasks, sec);
+        pool.stop(false);
+    }
+
+    // Every producer posts tasks in batches, asio's pool has no batch API so it's one by one.
+    {
+        Vms::Core::WorkStealingPool pool(opts.threads);
+        Counter counter(tasks);
+        auto sec = runProducers(opts.producers, tasks, counter, [&pool, batchSize](std::uint64_t n, Counter& c) {
+            std::vector<Vms::Core::WorkStealingPool::Task> batch;
+            for (std::uint64_t i = 0; i < n; ++i) {
+                batch.emplace_back([&c]() { hashTask(c); });
+                if ((batch.size() == batchSize) || (i + 1 == n)) {
+                    pool.post(std::move(batch));
+                    batch.clear();
+                }
+            }
+        });
+        report("WorkStealingPool", "batched", tasks, sec);
+        pool.stop(false);
+    }
+
+    // Tasks posted from within workers, i.e. a batch split into chunks by a worker.
+    {
+        boost::asio::thread_pool pool(opts.threads);
+        Counter counter(tasks / fanOut * fanOut);
+        auto sec = runProducers(opts.producers, tasks / fanOut, counter, [&pool, fanOut](std::uint64_t n, Counter& c) {
+            for (std::uint64_t i = 0; i < n; ++i) {
+                boost::asio::post(pool, [&pool, &c, fanOut]() {
+                    for (std::uint64_t j = 0; j < fanOut; ++j) {
+                        boost::asio::post(pool, [&c]() { hashTask(c); });
+                    }
+                });
+            }
+        });
+        report("asio::thread_pool", "nested", tasks / fanOut * fanOut, sec);
+        pool.join();
+    }
+    {
+        Vms::Core::WorkStealingPool pool(opts.threads);
+        Counter counter(tasks / fanOut * fanOut);
+        auto sec = runProducers(opts.producers, tasks / fanOut, counter, [&pool, fanOut](std::uint64_t n, Counter& c) {
+            for (std::uint64_t i = 0; i < n; ++i) {
+                pool.post([&pool, &c, fanOut]() {
+                    for (std::uint64_t j = 0; j < fanOut; ++j) {
+                        pool.post([&c]() { hashTask(c); });
+                    }
+                });
+            }
+        });
+        report("WorkStealingPool", "nested", tasks / fanOut * fanOut, sec);
+        pool.stop(false);
+    }
+
+    return 0;
+}
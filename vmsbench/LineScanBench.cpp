@@ -0,0 +1,121 @@
+#include "Benchmarks.h"
+#include "Vms/Net/LineScanner.h"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+
+namespace
+{
+    // vmsserver's read buffer.
+    const std::size_t readSize = 64 * 1024;
+
+    // Pipelined "key value\n" updates: keys of 4-24 characters, values mostly short numbers,
+    // some of them up to a few hundred bytes.
+    std::string makeInput(std::size_t size, std::size_t& numLines)
+    {
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<int> keyLen(4, 24);
+        std::uniform_int_distribution<int> kind(0, 99);
+        std::uniform_int_distribution<int> shortLen(1, 10);
+        std::uniform_int_distribution<int> mediumLen(11, 64);
+        std::uniform_int_distribution<int> longLen(65, 512);
+        std::uniform_int_distribution<int> alnum(0, 35);
+
+        auto put = [&](std::string& out, int n) {
+            for (int i = 0; i < n; ++i) {
+                auto c = alnum(rng);
+                out.push_back(static_cast<char>((c < 10) ? ('0' + c) : ('a' + c - 10)));
+            }
+        };
+
+        std::string data;
+        data.reserve(size + 1024);
+        numLines = 0;
+        while (data.size() < size) {
+            put(data, keyLen(rng));
+            data.push_back(' ');
+            auto k = kind(rng);
+            put(data, (k < 70) ? shortLen(rng) : (k < 95) ? mediumLen(rng) : longLen(rng));
+            data.push_back('\n');
+            ++numLines;
+        }
+        return data;
+    }
+
+    // Splits 'data' like vmsserver's Connection::parseLines(), one read buffer at a time.
+    // Returns a checksum of the line and space positions.
+    std::uint64_t parse(Vms::Net::ScanLinesFn scan, const std::string& data)
+    {
+        std::uint64_t sum = 0;
+        Vms::Net::LineBounds lines[64];
+        std::size_t pos = 0;
+        while (pos < data.size()) {
+            auto size = std::min(readSize, data.size() - pos);
+            auto numLines = scan(data.data() + pos, size, lines, std::size(lines));
+            if (numLines == 0) {
+                break;
+            }
+            for (std::size_t i = 0; i < numLines; ++i) {
+                sum += lines[i].end * 31 + lines[i].space;
+            }
+            pos += lines[numLines - 1].end + 1;
+        }
+        return sum;
+    }
+}
+
+int runLineScanBench(const BenchOptions& opts)
+{
+    const std::uint64_t rounds = (opts.iterations > 0) ? opts.iterations : 2000;
+
+    // Small enough to stay in cache like a just received buffer, with a bigger one this
+    // measures memory bandwidth.
+    std::size_t numLines = 0;
+    auto data = makeInput(256 * 1024, numLines);
+
+    std::cout << "linescan: splitting " << (data.size() >> 10) << " KiB of pipelined updates (" << numLines
+        << " lines, avg " << (data.size() / numLines) << " bytes) into lines and keys, "
+        << rounds << " rounds, scanLines() uses " << Vms::Net::lineScannerName() << std::endl;
+
+    struct Impl
+    {
+        const char* name;
+        Vms::Net::ScanLinesFn fn;
+    };
+    const Impl impls[] = {
+        { "memchr", Vms::Net::lineScanner("memchr") },
+        { "sse2", Vms::Net::lineScanner("sse2") },
+        { "avx2", Vms::Net::lineScanner("avx2") }
+    };
+
+    auto expected = parse(Vms::Net::lineScanner("memchr"), data);
+
+    for (const auto& impl : impls) {
+        if (!impl.fn) {
+            std::cout << "  " << std::left << std::setw(8) << impl.name << std::right << "not supported" << std::endl;
+            continue;
+        }
+
+        if (parse(impl.fn, data) != expected) {
+            std::cout << "  " << impl.name << ": wrong result" << std::endl;
+            return 1;
+        }
+
+        std::uint64_t sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (std::uint64_t i = 0; i < rounds; ++i) {
+            sum += parse(impl.fn, data);
+        }
+        auto sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "  " << std::left << std::setw(8) << impl.name << std::right
+            << std::setw(8) << std::fixed << std::setprecision(2) << (sec * 1e9 / (numLines * rounds)) << " ns/line"
+            << std::setw(8) << std::setprecision(2) << (data.size() * rounds / sec / 1e9) << " GB/s"
+            << ((sum == expected * rounds) ? "" : " (mismatch)") << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "Benchmarks.h"
+#include "Vms/Core/Logger.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#define _FN "Bench"
+
+namespace
+{
+    const char* nullPath = "/dev/null";
+
+    // vmsserver's per-update INFO message logged from 'producers' threads at once.
+    // Returns the time the producers took.
+    double logFromThreads(std::uint32_t producers, std::uint64_t perThread)
+    {
+        std::atomic<bool> go{ false };
+        std::vector<std::thread> threads;
+        for (std::uint32_t t = 0; t < producers; ++t) {
+            threads.emplace_back([&go, perThread]() {
+                while (!go.load(std::memory_order_acquire)) {
+                }
+                const std::string message = "some_key 1234567890";
+                for (std::uint64_t i = 0; i < perThread; ++i) {
+                    VMS_LOG_INFO(_FN, "Client's message \"" << message << "\" processing completed");
+                }
+            });
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void printResult(const char* name, double sec, std::uint64_t allocs, std::uint64_t total)
+    {
+        std::cout << "  " << std::left << std::setw(6) << name << std::right
+            << std::setw(8) << std::fixed << std::setprecision(1) << (sec * 1e9 / total) << " ns/message"
+            << std::setw(12) << std::setprecision(0) << (total / sec) << " messages/s"
+            << std::setw(6) << std::setprecision(2) << (static_cast<double>(allocs) / total) << " allocs/message";
+    }
+}
+
+int runLogBench(const BenchOptions& opts)
+{
+    const std::uint64_t perThread = (opts.iterations > 0) ? opts.iterations : 200000;
+    const std::uint64_t total = perThread * opts.producers;
+
+    auto savedLevel = Vms::Core::logger.level();
+    Vms::Core::logger.setLevel(Vms::Core::LogLevelINFO);
+
+    std::cout << "log: INFO message from " << opts.producers << " threads, written to " << nullPath << std::endl;
+
+    // Synchronous: std::cerr is redirected, so it's still a write() per message.
+    {
+        std::ofstream devNull(nullPath);
+        auto* saved = std::cerr.rdbuf(devNull.rdbuf());
+        auto allocsBefore = allocationCount();
+        auto sec = logFromThreads(opts.producers, perThread);
+        auto allocs = allocationCount() - allocsBefore;
+        std::cerr.rdbuf(saved);
+
+        printResult("sync", sec, allocs, total);
+        std::cout << std::endl;
+    }
+
+    {
+        Vms::Core::AsyncLogOptions options;
+        options.path = nullPath;
+        auto ec = Vms::Core::logger.startAsync(options);
+        if (ec) {
+            std::cerr << "log: cannot start async logging: " << ec.message() << std::endl;
+            return 1;
+        }
+
+        auto droppedBefore = Vms::Core::logger.numDropped();
+        auto allocsBefore = allocationCount();
+        auto sec = logFromThreads(opts.producers, perThread);
+        auto allocs = allocationCount() - allocsBefore;
+        auto drainStart = std::chrono::steady_clock::now();
+        Vms::Core::logger.stopAsync();
+        auto drainSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - drainStart).count();
+        auto dropped = Vms::Core::logger.numDropped() - droppedBefore;
+
+        printResult("async", sec, allocs, total);
+        std::cout << ", " << dropped << " dropped, " << std::setprecision(1) << (drainSec * 1e3)
+            << " ms to drain on stop" << std::endl;
+    }
+
+    // What a VMS_LOG_DEBUG() costs when it's off, with DEBUG on for another facility.
+    {
+        Vms::Core::logger.setFacilityLevel("BenchDebug", Vms::Core::LogLevelDEBUG);
+        const std::uint64_t calls = 100000000;
+        auto start = std::chrono::steady_clock::now();
+        for (std::uint64_t i = 0; i < calls; ++i) {
+            VMS_LOG_DEBUG(_FN, "Disabled " << i);
+        }
+        auto sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Vms::Core::logger.resetFacilityLevel("BenchDebug");
+
+        std::cout << "  disabled DEBUG: " << std::setprecision(2) << (sec * 1e9 / calls) << " ns/call" << std::endl;
+    }
+
+    Vms::Core::logger.setLevel(savedLevel);
+
+    return 0;
+}
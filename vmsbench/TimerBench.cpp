@@ -0,0 +1,91 @@
+#include "Benchmarks.h"
+#include "Vms/Core/Executor.h"
+#include "Vms/Core/TimedTask.h"
+#include "Vms/Core/TimerWheel.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+
+namespace
+{
+    // Idle timeout pattern: every "connection" has a timer that's rearmed on every
+    // message and almost never fires. Rearms all the timers 'rearms' times and then
+    // lets them all fire.
+    void run(std::uint64_t numTimers, std::uint32_t rearms, bool useWheel)
+    {
+        Vms::Core::Executor executor(1);
+        auto& ioService = executor.ioService();
+        if (useWheel) {
+            Vms::Core::TimerWheel::install(ioService, std::chrono::milliseconds(10));
+        }
+
+        std::vector<Vms::Core::TimedTaskPtr> tasks;
+        tasks.reserve(numTimers);
+        for (std::uint64_t i = 0; i < numTimers; ++i) {
+            tasks.push_back(std::make_shared<Vms::Core::TimedTask>(ioService));
+        }
+
+        std::mutex mtx;
+        std::condition_variable cond;
+        std::atomic<std::uint64_t> numFired{0};
+
+        auto onFired = [&]() {
+            if (++numFired == numTimers) {
+                std::lock_guard<std::mutex> lock(mtx);
+                cond.notify_one();
+            }
+        };
+
+        auto allocsBefore = allocationCount();
+        auto started = std::chrono::steady_clock::now();
+
+        for (std::uint32_t r = 0; r < rearms; ++r) {
+            for (auto& task : tasks) {
+                auto fire = onFired;
+                task->schedule(std::move(fire), std::chrono::seconds(60));
+            }
+        }
+        for (auto& task : tasks) {
+            auto fire = onFired;
+            task->schedule(std::move(fire), std::chrono::milliseconds(50));
+        }
+
+        auto scheduled = std::chrono::steady_clock::now();
+        auto allocs = allocationCount() - allocsBefore;
+
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cond.wait(lock, [&]() { return numFired == numTimers; });
+        }
+
+        auto finished = std::chrono::steady_clock::now();
+
+        executor.stop();
+
+        auto numSchedules = numTimers * (rearms + 1);
+        auto scheduleNs = std::chrono::duration_cast<std::chrono::nanoseconds>(scheduled - started).count();
+        auto fireMs = std::chrono::duration_cast<std::chrono::milliseconds>(finished - scheduled).count();
+
+        std::cout << "  " << std::left << std::setw(14) << (useWheel ? "TimerWheel" : "steady_timer")
+            << std::right << std::setw(10) << (scheduleNs / numSchedules) << " ns/schedule"
+            << std::setw(8) << std::fixed << std::setprecision(2)
+            << (static_cast<double>(allocs) / numSchedules) << " allocs/schedule"
+            << std::setw(8) << fireMs << " ms to fire all" << std::endl;
+    }
+}
+
+int runTimerBench(const BenchOptions& opts)
+{
+    auto numTimers = (opts.iterations > 0) ? opts.iterations : 100000;
+    const std::uint32_t rearms = 10;
+
+    std::cout << "timer: " << numTimers << " timers, each rearmed " << rearms << " times" << std::endl;
+
+    run(numTimers, rearms, false);
+    run(numTimers, rearms, true);
+
+    return 0;
+}
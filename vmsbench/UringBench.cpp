@@ -0,0 +1,205 @@
+#include "Benchmarks.h"
+#include "Vms/Core/Awaitable.h"
+#include "Vms/Net/Uring.h"
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <chrono>
+#include <csignal>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    const std::uint32_t numClients = 200;
+    const std::string message = "some_key 1234567890\n";
+
+    struct Pair
+    {
+        explicit Pair(boost::asio::io_service& ioService) : server(ioService), client(ioService) {}
+
+        boost::asio::ip::tcp::socket server;
+        boost::asio::ip::tcp::socket client;
+        std::unique_ptr<Vms::Net::UringStream> uringStream;
+    };
+
+    bool connectPairs(boost::asio::io_service& ioService, std::vector<std::unique_ptr<Pair>>& pairs, std::uint32_t num)
+    {
+        boost::asio::ip::tcp::acceptor acceptor(ioService,
+            boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        auto* uring = Vms::Net::Uring::get(ioService);
+        for (std::uint32_t i = 0; i < num; ++i) {
+            std::unique_ptr<Pair> pair(new Pair(ioService));
+            boost::system::error_code ec;
+            pair->client.connect(acceptor.local_endpoint(), ec);
+            if (!ec) {
+                acceptor.accept(pair->server, ec);
+            }
+            if (!ec) {
+                pair->server.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+                pair->client.non_blocking(true, ec);
+            }
+            if (ec) {
+                std::cerr << "uring: cannot connect: " << ec.message() << std::endl;
+                return false;
+            }
+            if (uring) {
+                pair->uringStream.reset(new Vms::Net::UringStream(*uring, pair->server));
+            }
+            pairs.push_back(std::move(pair));
+        }
+        return true;
+    }
+
+    // Reads everything the clients have got so far, same cost for both backends.
+    void drainClients(std::vector<std::unique_ptr<Pair>>& pairs)
+    {
+        char buf[4096];
+        for (auto& pair : pairs) {
+            boost::system::error_code ec;
+            while (pair->client.read_some(boost::asio::buffer(buf), ec) > 0) {
+            }
+        }
+    }
+
+    // The vmsserver broadcast: the same message written to every client, all the writes
+    // started from a single handler.
+    template <class WriteFn>
+    double runBroadcast(boost::asio::io_service& ioService, std::vector<std::unique_ptr<Pair>>& pairs,
+        std::uint64_t rounds, WriteFn writeFn)
+    {
+        std::uint64_t pending = 0;
+        auto onWritten = [&pending](const boost::system::error_code& ec, std::size_t) {
+            if (ec) {
+                std::cerr << "write failed: " << ec.message() << std::endl;
+            }
+            --pending;
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        for (std::uint64_t r = 0; r < rounds; ++r) {
+            pending = pairs.size();
+            for (auto& pair : pairs) {
+                writeFn(*pair, onWritten);
+            }
+            while (pending > 0) {
+                ioService.run_one();
+            }
+            drainClients(pairs);
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // A line echoed back and forth, i.e. latency of a single read and write.
+    template <class Stream>
+    Vms::Core::Awaitable<void> pingPong(Stream& stream, boost::asio::ip::tcp::socket& peer,
+        std::uint64_t rounds, bool& done)
+    {
+        boost::asio::streambuf sb;
+        boost::asio::streambuf peerSb;
+        try {
+            for (std::uint64_t i = 0; i < rounds; ++i) {
+                co_await boost::asio::async_write(peer, boost::asio::buffer(message), Vms::Core::useAwaitable);
+                auto sz = co_await boost::asio::async_read_until(stream, sb, '\n', Vms::Core::useAwaitable);
+                sb.consume(sz);
+                co_await boost::asio::async_write(stream, boost::asio::buffer(message), Vms::Core::useAwaitable);
+                sz = co_await boost::asio::async_read_until(peer, peerSb, '\n', Vms::Core::useAwaitable);
+                peerSb.consume(sz);
+            }
+        } catch (const boost::system::system_error& e) {
+            std::cerr << "ping-pong failed: " << e.what() << std::endl;
+        }
+        done = true;
+    }
+
+    bool run(bool useUring, std::uint64_t rounds)
+    {
+        boost::asio::io_service ioService(1);
+        // run_one() is called in loops, the io_service must never run out of work.
+        auto work = boost::asio::make_work_guard(ioService);
+        if (useUring) {
+            auto ec = Vms::Net::Uring::install(ioService);
+            if (ec) {
+                std::cout << "  io_uring: not available: " << ec.message() << std::endl;
+                return true;
+            }
+        }
+
+        std::vector<std::unique_ptr<Pair>> pairs;
+        if (!connectPairs(ioService, pairs, numClients)) {
+            return false;
+        }
+
+        double sec;
+        if (useUring) {
+            sec = runBroadcast(ioService, pairs, rounds, [](Pair& pair, auto& h) {
+                boost::asio::async_write(*pair.uringStream, boost::asio::buffer(message), h);
+            });
+        } else {
+            sec = runBroadcast(ioService, pairs, rounds, [](Pair& pair, auto& h) {
+                boost::asio::async_write(pair.server, boost::asio::buffer(message), h);
+            });
+        }
+
+        std::cout << "  " << std::left << std::setw(10) << (useUring ? "io_uring" : "epoll") << std::right
+            << " broadcast: " << std::setw(8) << std::fixed << std::setprecision(1)
+            << (sec * 1e6 / rounds) << " us/round";
+        if (auto* uring = Vms::Net::Uring::get(ioService)) {
+            auto stats = uring->stats();
+            std::cout << std::setw(8) << std::setprecision(1)
+                << (static_cast<double>(stats.numSubmitted) / std::max<std::uint64_t>(stats.numEnters, 1)) << " sends/syscall, "
+                << stats.numFixedSends << " from registered buffers";
+        } else {
+            std::cout << std::setw(8) << 1.0 << " sends/syscall";
+        }
+        std::cout << std::endl;
+
+        // Clients are non-blocking for draining, the ping-pong peer must be a normal socket again.
+        auto& pair = *pairs.front();
+        boost::system::error_code ec;
+        pair.client.non_blocking(false, ec);
+
+        const std::uint64_t pingPongs = rounds * 10;
+        bool done = false;
+        auto strand = Vms::Core::makeStrand(ioService);
+        auto start = std::chrono::steady_clock::now();
+        if (useUring) {
+            boost::asio::co_spawn(*strand, pingPong(*pair.uringStream, pair.client, pingPongs, done), boost::asio::detached);
+        } else {
+            boost::asio::co_spawn(*strand, pingPong(pair.server, pair.client, pingPongs, done), boost::asio::detached);
+        }
+        while (!done) {
+            ioService.run_one();
+        }
+        sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "  " << std::left << std::setw(10) << (useUring ? "io_uring" : "epoll") << std::right
+            << " ping-pong: " << std::setw(8) << std::fixed << std::setprecision(1)
+            << (sec * 1e6 / pingPongs) << " us/round trip" << std::endl;
+
+        return true;
+    }
+}
+
+int runUringBench(const BenchOptions& opts)
+{
+    const std::uint64_t rounds = (opts.iterations > 0) ? opts.iterations : 2000;
+
+#if defined(SIGPIPE)
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+    std::cout << "uring: epoll vs io_uring, broadcast of a line to " << numClients << " clients and line ping-pong" << std::endl;
+
+    if (!run(false, rounds) || !run(true, rounds)) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "Benchmarks.h"
+#include "Vms/Core/Affinity.h"
+#include "Vms/Core/Logger.h"
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <map>
+
+#define _FN "Bench"
+
+int main(int argc, char* argv[])
+{
+    boost::program_options::variables_map vm;
+    std::string benchName = "all";
+    BenchOptions opts;
+
+    const std::map<std::string, int (*)(const BenchOptions&)> benches = {
+        { "hashpool", &runHashPoolBench },
+        { "alloc", &runAllocBench },
+        { "timer", &runTimerBench },
+        { "uring", &runUringBench },
+        { "log", &runLogBench },
+        { "fanout", &runFanoutBench },
+        { "linescan", &runLineScanBench }
+    };
+
+    try {
+        boost::program_options::options_description desc("Options");
+
+        desc.add_options()
+            ("help", "Print this help message")
+            ("bench", boost::program_options::value(&benchName), "Benchmark to run (hashpool, alloc, timer, uring, log, fanout, linescan, all), default = all")
+            ("threads", boost::program_options::value(&opts.threads), "Number of worker threads, default = number of CPUs")
+            ("producers", boost::program_options::value(&opts.producers), "Number of producer threads, default = 4")
+            ("iterations", boost::program_options::value(&opts.iterations), "Number of iterations, default = benchmark specific");
+
+        boost::program_options::store(
+            boost::program_options::command_line_parser(
+                argc, argv).options(desc).run(), vm);
+
+        boost::program_options::notify(vm);
+
+        if (vm.count("help") > 0) {
+            std::cout << desc << std::endl;
+            return 1;
+        }
+    } catch (const boost::program_options::error& e) {
+        VMS_LOG_ERROR(_FN, "Invalid command line arguments: " << e.what());
+        return 1;
+    } catch (const std::exception& e) {
+        VMS_LOG_ERROR(_FN, "Error: " << e.what());
+        return 1;
+    }
+
+    Vms::Core::logger.setLevel(Vms::Core::LogLevelWARN);
+
+    if (opts.threads == 0) {
+        opts.threads = Vms::Core::numCpus();
+    }
+    if (opts.producers == 0) {
+        opts.producers = 4;
+    }
+
+    if (benchName == "all") {
+        for (const auto& bench : benches) {
+            int res = bench.second(opts);
+            if (res != 0) {
+                return res;
+            }
+        }
+        return 0;
+    }
+
+    auto it = benches.find(benchName);
+    if (it == benches.end()) {
+        VMS_LOG_ERROR(_FN, "Unknown benchmark " << benchName);
+        return 1;
+    }
+
+    return it->second(opts);
+}
@@ -1,71 +1,263 @@
 #include "Connection.h"
 #include "Vms/Core/Logger.h"
 #include "Vms/Core/Assert.h"
+#include "Vms/Net/Compression.h"
+#include "Vms/Net/Protocol.h"
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_future.hpp>
 #include <boost/asio/write.hpp>
-#include <future>
 #include <iostream>
 
 #define _FN "Connection"
 
-Connection::Connection(boost::asio::ip::tcp::socket s)
-: s_(std::move(s))
+namespace
+{
+    // Max. size of a frame received, anything bigger is a protocol error.
+    const std::size_t maxFrameSize = 1024 * 1024;
+}
+
+Connection::Connection(boost::asio::io_service& ioService, boost::asio::ip::tcp::socket s, std::uint8_t features)
+: strand_(Vms::Core::makeStrand(ioService)),
+  s_(std::move(s)),
+  features_(features),
+  binary_(features != 0)
 {
 }
 
 void Connection::start(DoneFn doneCb)
 {
     doneCb_ = std::move(doneCb);
-    onRead({}, 0);
+    boost::asio::co_spawn(*strand_, readLoop(shared_from_this()), boost::asio::detached);
+}
+
+bool Connection::sendHello()
+{
+    std::string hello;
+    Vms::Net::appendHello(hello, features_ | Vms::Net::FeatureBinary);
+    return writeSync(hello);
+}
+
+std::string Connection::encode(const std::string& line) const
+{
+    if (!binary_) {
+        return line + '\n';
+    }
+
+    // The server answers a line without a space with an error, like in text.
+    std::string frame;
+    auto spacePos = line.find(' ');
+    if (spacePos == std::string::npos) {
+        Vms::Net::appendUpdateFrame(frame, line, std::string_view());
+    } else {
+        Vms::Net::appendUpdateFrame(frame, std::string_view(line).substr(0, spacePos),
+            std::string_view(line).substr(spacePos + 1));
+    }
+    return frame;
 }
 
 bool Connection::writeSync(const std::string& str)
 {
-    std::promise<bool> p;
-    auto f = p.get_future();
+    // We want this to be executed on the strand, i.e. serialized with read code.
+    auto f = boost::asio::co_spawn(*strand_, write(str), boost::asio::use_future);
+
+    return !f.get();
+}
+
+Vms::Core::Awaitable<std::error_code> Connection::write(const std::string& str)
+{
+    strand_assert(strand_);
+
+    if (!doneCb_) {
+        co_return boost::system::error_code(boost::asio::error::not_connected);
+    }
+
+    boost::system::error_code ec;
+    auto sz = co_await boost::asio::async_write(s_, boost::asio::buffer(str),
+        boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+
+    if (!doneCb_) {
+        co_return boost::system::error_code(boost::asio::error::not_connected);
+    }
+
+    if (ec) {
+        VMS_LOG_DEBUG(_FN, "onWrite(): " << ec.message());
+        done(ec);
+        co_return ec;
+    }
+
+    VMS_LOG_DEBUG(_FN, "onWrite(" << sz << ")");
+
+    co_return std::error_code{};
+}
+
+Vms::Core::Awaitable<void> Connection::readLoop(std::shared_ptr<Connection> self)
+{
+    while (doneCb_) {
+        boost::system::error_code ec;
+        auto sz = co_await s_.async_read_some(boost::asio::buffer(readBuff_),
+            boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
 
-    // We want this to be executed on ioService, i.e. serialized with read code.
-    boost::asio::async_write(s_, boost::asio::buffer(str), [this, &p](const std::error_code& ec, std::size_t sz) {
         if (!doneCb_) {
-            p.set_value(false);
-            return;
+            co_return;
         }
 
         if (ec) {
-            VMS_LOG_DEBUG(_FN, "onWrite(): " << ec.message());
+            VMS_LOG_DEBUG(_FN, "onRead(): " << ec.message());
             done(ec);
-            p.set_value(false);
-            return;
+            co_return;
         }
 
-        VMS_LOG_DEBUG(_FN, "onWrite(" << sz << ")");
+        VMS_LOG_DEBUG(_FN, "onRead(" << sz << ")");
 
-        p.set_value(true);
-    });
+        if (sz == 0) {
+            continue;
+        }
+
+        if (!binary_) {
+            std::cout.write(readBuff_.data(), sz);
+            std::cout.flush();
+            continue;
+        }
 
-    return f.get();
+        pending_.append(readBuff_.data(), sz);
+        if (!printFrames()) {
+            VMS_LOG_ERROR(_FN, "Protocol error");
+            done(boost::system::error_code(boost::asio::error::invalid_argument));
+            co_return;
+        }
+    }
 }
 
-void Connection::onRead(const std::error_code& ec, std::size_t sz)
+bool Connection::printFrames()
 {
-    if (!doneCb_) {
-        return;
+    std::size_t pos = 0;
+
+    if (!helloReceived_) {
+        // Text sent before the server's hello is stale, a snapshot follows the hello. Keys
+        // may contain '\0' too, so it takes the whole hello prefix to find it.
+        std::uint8_t features;
+        for (;; ++pos) {
+            pos = pending_.find('\0', pos);
+            if (pos == std::string::npos) {
+                pending_.clear();
+                return true;
+            }
+
+            auto res = Vms::Net::parseHello(pending_.data() + pos, pending_.size() - pos, features);
+            if (res == Vms::Net::ParseResult::NeedMore) {
+                pending_.erase(0, pos);
+                return true;
+            }
+            if (res == Vms::Net::ParseResult::Ok) {
+                break;
+            }
+        }
+        if ((features & Vms::Net::FeatureBinary) == 0) {
+            return false;
+        }
+
+        pos += Vms::Net::helloSize;
+        helloReceived_ = true;
+        keyIds_ = (features & Vms::Net::FeatureKeyIds) != 0;
+        delta_ = (features & Vms::Net::FeatureDelta) != 0;
+        if ((features & Vms::Net::FeatureCompress) != 0) {
+            inflater_ = std::make_unique<Vms::Net::Inflater>();
+        }
+        VMS_LOG_DEBUG(_FN, "Binary protocol accepted, features " << static_cast<int>(features));
     }
 
-    if (ec) {
-        VMS_LOG_DEBUG(_FN, "onRead(): " << ec.message());
-        done(ec);
-        return;
+    std::string out;
+    for (;;) {
+        Vms::Net::Frame frame;
+        auto res = Vms::Net::parseFrame(pending_.data() + pos, pending_.size() - pos, maxFrameSize, frame);
+        if (res == Vms::Net::ParseResult::NeedMore) {
+            break;
+        }
+        if (res == Vms::Net::ParseResult::Invalid) {
+            return false;
+        }
+        pos += frame.size;
+
+        if (frame.type != Vms::Net::FrameCompressed) {
+            if (!printFrame(frame, out)) {
+                return false;
+            }
+            continue;
+        }
+
+        // Every chunk holds whole frames.
+        inflated_.clear();
+        if (!inflater_ || !inflater_->inflate(frame.payload, inflated_)) {
+            return false;
+        }
+        for (std::size_t inner = 0; inner < inflated_.size(); ) {
+            Vms::Net::Frame innerFrame;
+            if ((Vms::Net::parseFrame(inflated_.data() + inner, inflated_.size() - inner, maxFrameSize, innerFrame) != Vms::Net::ParseResult::Ok) ||
+                (innerFrame.type == Vms::Net::FrameCompressed) || !printFrame(innerFrame, out)) {
+                return false;
+            }
+            inner += innerFrame.size;
+        }
     }
 
-    VMS_LOG_DEBUG(_FN, "onRead(" << sz << ")");
+    pending_.erase(0, pos);
 
-    if (sz > 0) {
-        std::cout.write(readBuff_.data(), sz);
+    if (!out.empty()) {
+        std::cout.write(out.data(), out.size());
         std::cout.flush();
     }
+    return true;
+}
 
-    s_.async_read_some(boost::asio::buffer(readBuff_),
-        std::bind(&Connection::onRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+bool Connection::printFrame(const Vms::Net::Frame& frame, std::string& out)
+{
+    switch (frame.type) {
+    case Vms::Net::FrameHash: {
+        std::string_view key;
+        std::uint32_t hash;
+        if (!Vms::Net::parseHash(frame.payload, key, hash)) {
+            return false;
+        }
+        Vms::Net::appendHashLine(out, key, hash);
+        break;
+    }
+    case Vms::Net::FrameKeyHash: {
+        std::uint32_t id;
+        std::string_view key;
+        std::uint32_t hash;
+        if (!keyIds_ || !Vms::Net::parseKeyHash(frame.payload, id, key, hash) || (id != keys_.size())) {
+            return false;
+        }
+        keys_.emplace_back(key);
+        lastHashes_.push_back(hash);
+        Vms::Net::appendHashLine(out, key, hash);
+        break;
+    }
+    case Vms::Net::FrameIdHash: {
+        std::uint32_t id;
+        std::uint32_t hash;
+        if (!keyIds_ || !Vms::Net::parseIdHash(frame.payload, id, hash) || (id >= keys_.size())) {
+            return false;
+        }
+        if (delta_) {
+            hash ^= lastHashes_[id];
+        }
+        lastHashes_[id] = hash;
+        Vms::Net::appendHashLine(out, keys_[id], hash);
+        break;
+    }
+    case Vms::Net::FrameKeyReset:
+        keys_.clear();
+        lastHashes_.clear();
+        break;
+    case Vms::Net::FrameMessage:
+        out.append(frame.payload).push_back('\n');
+        break;
+    default:
+        break;
+    }
+    return true;
 }
 
 void Connection::done(const std::error_code& ec)
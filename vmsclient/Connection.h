@@ -2,32 +2,77 @@
 #define _CONNECTION_H_
 
 #include "Vms/Core/Types.h"
+#include "Vms/Core/Strand.h"
+#include "Vms/Core/Awaitable.h"
+#include "Vms/Net/Compression.h"
+#include "Vms/Net/Protocol.h"
 #include <boost/asio/ip/tcp.hpp>
+#include <string>
+#include <vector>
 
 class Connection : public std::enable_shared_from_this<Connection>
 {
 public:
     using DoneFn = std::function<void (const std::error_code&)>;
 
-    explicit Connection(boost::asio::ip::tcp::socket s);
+    // 'features' = Vms::Net::ProtocolFeature bits to ask for, 0 = text protocol. Otherwise
+    // sendHello() must be called right after start().
+    Connection(boost::asio::io_service& ioService, boost::asio::ip::tcp::socket s, std::uint8_t features = 0);
     ~Connection() = default;
 
     void start(DoneFn doneCb);
 
+    // Writes the binary protocol hello, must be called before anything else is written.
+    bool sendHello();
+
+    // What's written for a "key value" line typed by the user, in the connection's protocol.
+    std::string encode(const std::string& line) const;
+
     bool writeSync(const std::string& str);
 
+    // Must be awaited on the connection's strand, with no other write in progress.
+    Vms::Core::Awaitable<std::error_code> write(const std::string& str);
+
 private:
     Connection(const Connection&) = delete;
     Connection& operator=(const Connection&) = delete;
 
-    void onRead(const std::error_code& ec, std::size_t sz);
+    Vms::Core::Awaitable<void> readLoop(std::shared_ptr<Connection> self);
+
+    // Prints every complete frame in 'pending_'. False on a protocol error.
+    bool printFrames();
+
+    // Appends what 'frame' says to 'out', if anything. False on a protocol error.
+    bool printFrame(const Vms::Net::Frame& frame, std::string& out);
 
     void done(const std::error_code& ec);
 
+    Vms::Core::StrandPtr strand_;
     boost::asio::ip::tcp::socket s_;
     DoneFn doneCb_;
 
     std::array<char, 4096> readBuff_;
+
+    const std::uint8_t features_;
+    const bool binary_;
+
+    // Binary protocol only: set once the server's hello is received.
+    bool helloReceived_ = false;
+
+    // Binary protocol only: received bytes not parsed yet.
+    std::string pending_;
+
+    // Features the server accepted.
+    bool keyIds_ = false;
+    bool delta_ = false;
+
+    // Key ids only: key and last hash of every id.
+    std::vector<std::string> keys_;
+    std::vector<std::uint32_t> lastHashes_;
+
+    // Compression only: inflates the server's chunks, 'inflated_' receives one at a time.
+    std::unique_ptr<Vms::Net::Inflater> inflater_;
+    std::string inflated_;
 };
 
 using ConnectionPtr = std::shared_ptr<Connection>;
@@ -1,8 +1,11 @@
 #include "Connection.h"
+#include "Vms/Net/Protocol.h"
 #include "Vms/Net/TcpConnector.h"
 #include "Vms/Core/Executor.h"
 #include "Vms/Core/Logger.h"
 #include <boost/program_options.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/use_future.hpp>
 #include <future>
 #include <iostream>
 
@@ -15,6 +18,7 @@ int main(int argc, char* argv[])
     std::string ipAddressStr = "127.0.0.1";
     std::uint16_t ipPort = 8081;
     std::uint32_t connectTimeoutMs = 5000;
+    std::uint32_t ioThreads = 1;
 
     try {
         boost::program_options::options_description desc("Options");
@@ -25,7 +29,12 @@ int main(int argc, char* argv[])
             ("verbose", "Use verbose logging, default = off")
             ("ip-address", boost::program_options::value(&ipAddressStr), "IP address (numeric), default = 127.0.0.1")
             ("port", boost::program_options::value(&ipPort), "IP port (numeric), default = 8081")
-            ("connect-timeout-ms", boost::program_options::value(&connectTimeoutMs), "Connect timeout (ms), default = 5000");
+            ("connect-timeout-ms", boost::program_options::value(&connectTimeoutMs), "Connect timeout (ms), default = 5000")
+            ("io-threads", boost::program_options::value(&ioThreads), "Number of I/O threads, default = 1")
+            ("binary", "Use the binary protocol, default = off (text)")
+            ("key-ids", "Binary protocol, receive keys as ids after their first update, default = off")
+            ("delta", "Binary protocol with key ids, receive hashes XORed with the last one of the key, default = off")
+            ("compress", "Binary protocol, let the server compress what it sends, default = off");
 
         boost::program_options::store(
             boost::program_options::command_line_parser(
@@ -60,39 +69,62 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    Vms::Core::Executor executor;
+    if (ioThreads == 0) {
+        VMS_LOG_ERROR(_FN, "Bad io-threads " << ioThreads);
+        return 1;
+    }
+
+    Vms::Core::Executor executor(ioThreads);
 
     Vms::Net::TcpConnector connector(executor.ioService(),
         boost::asio::ip::tcp::endpoint(ipAddress, ipPort), std::chrono::milliseconds(connectTimeoutMs));
 
     VMS_LOG_INFO(_FN, "Started");
 
-    std::promise<ConnectionPtr> connP;
     std::promise<void> doneP;
-    auto connF = connP.get_future();
     auto doneF = doneP.get_future();
 
-    connector.connect([&connP, &doneP](boost::asio::ip::tcp::socket s, const std::error_code& ec) {
+    std::uint8_t features = 0;
+    if (vm.count("binary") > 0) {
+        features |= Vms::Net::FeatureBinary;
+    }
+    if (vm.count("key-ids") > 0) {
+        features |= Vms::Net::FeatureBinary | Vms::Net::FeatureKeyIds;
+    }
+    if (vm.count("delta") > 0) {
+        features |= Vms::Net::FeatureBinary | Vms::Net::FeatureKeyIds | Vms::Net::FeatureDelta;
+    }
+    if (vm.count("compress") > 0) {
+        features |= Vms::Net::FeatureBinary | Vms::Net::FeatureCompress;
+    }
+
+    auto connF = boost::asio::co_spawn(*Vms::Core::makeStrand(executor.ioService()), [&executor, &connector, &doneP, features]() -> Vms::Core::Awaitable<ConnectionPtr> {
+        boost::asio::ip::tcp::socket s(executor.ioService());
+        auto ec = co_await connector.connect(s);
         if (ec) {
             VMS_LOG_ERROR(_FN, "Failed to connect: " << ec.message());
-            connP.set_value({});
             doneP.set_value();
-            return;
+            co_return ConnectionPtr{};
         }
 
         VMS_LOG_INFO(_FN, "Connected!");
 
-        auto conn = std::make_shared<Connection>(std::move(s));
+        auto conn = std::make_shared<Connection>(executor.ioService(), std::move(s), features);
         conn->start([&doneP](const std::error_code& ec) {
             VMS_LOG_INFO(_FN, "Connection done: " << ec.message());
             doneP.set_value();
         });
 
-        connP.set_value(conn);
-    });
+        co_return conn;
+    }, boost::asio::use_future);
 
     auto conn = connF.get();
 
+    if (conn && (features != 0) && !conn->sendHello()) {
+        VMS_LOG_ERROR(_FN, "Failed to send hello");
+        conn.reset();
+    }
+
     if (conn) {
         VMS_LOG_INFO(_FN, "Type \"exit\" to disconnect");
 
@@ -103,8 +135,7 @@ int main(int argc, char* argv[])
             if (line == "exit") {
                 break;
             }
-            line += '\n';
-            if (!conn->writeSync(line)) {
+            if (!conn->writeSync(conn->encode(line))) {
                 break;
             }
         }
@@ -0,0 +1,211 @@
+#include "Vms/Core/Affinity.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+namespace Vms { namespace Core
+{
+    namespace
+    {
+        const char* nodeSysPath = "/sys/devices/system/node/";
+
+        // Ids at or above are rejected, they can't be pinned to anyway.
+#if defined(_WIN32)
+        const std::uint32_t maxCpus = sizeof(DWORD_PTR) * 8;
+#elif defined(__linux__)
+        const std::uint32_t maxCpus = CPU_SETSIZE;
+#else
+        const std::uint32_t maxCpus = 1024;
+#endif
+
+        bool isDigit(char c)
+        {
+            return std::isdigit(static_cast<unsigned char>(c)) != 0;
+        }
+
+        bool isSpace(char c)
+        {
+            return std::isspace(static_cast<unsigned char>(c)) != 0;
+        }
+
+        bool parseUInt(const std::string& str, std::uint32_t& value)
+        {
+            if (str.empty() || (str.size() > 9) || !std::all_of(str.begin(), str.end(), isDigit)) {
+                return false;
+            }
+            value = static_cast<std::uint32_t>(std::stoul(str));
+            return true;
+        }
+
+        std::error_code readList(const std::string& path, CpuSet& ids);
+
+        std::error_code parseList(const std::string& str, CpuSet& ids, bool allowNodes)
+        {
+            std::istringstream is(str);
+            std::string item;
+            while (std::getline(is, item, ',')) {
+                item.erase(std::remove_if(item.begin(), item.end(), isSpace), item.end());
+                if (item.empty()) {
+                    continue;
+                }
+
+                std::uint32_t first, last;
+                if (allowNodes && (item.compare(0, 4, "node") == 0)) {
+                    if (!parseUInt(item.substr(4), first)) {
+                        return std::make_error_code(std::errc::invalid_argument);
+                    }
+                    auto err = readList(nodeSysPath + ("node" + std::to_string(first)) + "/cpulist", ids);
+                    if (err) {
+                        return err;
+                    }
+                    continue;
+                }
+
+                auto dashPos = item.find('-');
+                if (dashPos == std::string::npos) {
+                    if (!parseUInt(item, first)) {
+                        return std::make_error_code(std::errc::invalid_argument);
+                    }
+                    last = first;
+                } else if (!parseUInt(item.substr(0, dashPos), first) ||
+                    !parseUInt(item.substr(dashPos + 1), last) || (last < first)) {
+                    return std::make_error_code(std::errc::invalid_argument);
+                }
+                if (last >= maxCpus) {
+                    return std::make_error_code(std::errc::invalid_argument);
+                }
+
+                for (auto id = first; id <= last; ++id) {
+                    ids.push_back(id);
+                }
+            }
+
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+            return std::error_code{};
+        }
+
+        std::error_code readList(const std::string& path, CpuSet& ids)
+        {
+            std::ifstream is(path);
+            if (!is) {
+                return std::make_error_code(std::errc::no_such_file_or_directory);
+            }
+            std::string str;
+            std::getline(is, str);
+            return parseList(str, ids, false);
+        }
+    }
+
+    std::uint32_t numCpus()
+    {
+        auto n = std::thread::hardware_concurrency();
+        return (n > 0) ? n : 1;
+    }
+
+    std::error_code parseCpuSet(const std::string& str, CpuSet& cpus)
+    {
+        CpuSet res;
+        auto err = parseList(str, res, true);
+        if (err) {
+            return err;
+        }
+        if (res.empty()) {
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+        cpus = std::move(res);
+        return std::error_code{};
+    }
+
+    std::error_code pinThisThread(const CpuSet& cpus)
+    {
+        if (cpus.empty()) {
+            return std::error_code{};
+        }
+
+#if defined(_WIN32)
+        DWORD_PTR mask = 0;
+        for (auto cpu : cpus) {
+            if (cpu >= sizeof(mask) * 8) {
+                return std::make_error_code(std::errc::invalid_argument);
+            }
+            mask |= (static_cast<DWORD_PTR>(1) << cpu);
+        }
+        if (::SetThreadAffinityMask(::GetCurrentThread(), mask) == 0) {
+            return std::error_code(static_cast<int>(::GetLastError()), std::system_category());
+        }
+        return std::error_code{};
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu : cpus) {
+            if (cpu >= CPU_SETSIZE) {
+                return std::make_error_code(std::errc::invalid_argument);
+            }
+            CPU_SET(cpu, &set);
+        }
+        int res = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+        if (res != 0) {
+            return std::error_code(res, std::system_category());
+        }
+        return std::error_code{};
+#else
+        return std::make_error_code(std::errc::operation_not_supported);
+#endif
+    }
+
+    std::error_code preferLocalMemory(const CpuSet& cpus)
+    {
+        if (cpus.empty()) {
+            return std::error_code{};
+        }
+
+#if defined(__linux__)
+        CpuSet nodes;
+        if (readList(std::string(nodeSysPath) + "online", nodes) || (nodes.size() < 2)) {
+            // Not a NUMA system.
+            return std::error_code{};
+        }
+
+        std::uint32_t homeNode = 0;
+        std::size_t numHomeNodes = 0;
+        for (auto node : nodes) {
+            CpuSet nodeCpus;
+            if (readList(nodeSysPath + ("node" + std::to_string(node)) + "/cpulist", nodeCpus)) {
+                continue;
+            }
+            auto it = std::find_first_of(cpus.begin(), cpus.end(), nodeCpus.begin(), nodeCpus.end());
+            if (it != cpus.end()) {
+                homeNode = node;
+                ++numHomeNodes;
+            }
+        }
+
+        if ((numHomeNodes != 1) || (homeNode >= sizeof(unsigned long) * 8)) {
+            return std::error_code{};
+        }
+
+        unsigned long nodeMask = 1UL << homeNode;
+        if (::syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8) != 0) {
+            return std::error_code(errno, std::system_category());
+        }
+        return std::error_code{};
+#else
+        return std::error_code{};
+#endif
+    }
+} }
@@ -1,4 +1,5 @@
 #include "Vms/Core/Executor.h"
+#include "Vms/Core/TimedTask.h"
 #include "Vms/Core/Logger.h"
 #include "Vms/Core/Assert.h"
 
@@ -6,36 +7,189 @@
 
 namespace Vms { namespace Core
 {
-    Executor::Executor()
-    : work_(new boost::asio::io_service::work(ioService_)),
-      thread_([this]() {
-          boost::system::error_code ec;
-          ioService().run(ec);
-          if (ec) {
-              VMS_LOG_ERROR(_FN, "Executor: " << ec.message());
-          }
-      })
+    Executor::Executor(std::size_t numThreads, const CpuSet& cpus, std::chrono::microseconds busyPoll)
+    : ioService_(static_cast<int>(numThreads > 0 ? numThreads : 1)),
+      work_(new boost::asio::io_service::work(ioService_)),
+      busyPoll_(busyPoll)
     {
+        if (numThreads == 0) {
+            numThreads = 1;
+        }
+
+        registerHandlerCounters(&static_cast<boost::asio::execution_context&>(ioService_), &handlerCounters_);
+
+        threads_.reserve(numThreads);
+        for (std::size_t i = 0; i < numThreads; ++i) {
+            threads_.emplace_back(&Executor::run, this, cpus);
+        }
     }
 
     Executor::~Executor()
     {
         stop(true);
+        unregisterHandlerCounters(&static_cast<boost::asio::execution_context&>(ioService_));
+    }
+
+    void Executor::startLagProbe(std::chrono::steady_clock::duration interval)
+    {
+        if (lagProbing_.exchange(true)) {
+            return;
+        }
+
+        lagProbe_ = std::make_shared<TimedTask>(ioService_, makeStrand(ioService_), false);
+        lagProbeInterval_ = interval;
+
+        boost::asio::dispatch(*lagProbe_->strand(), [this]() {
+            scheduleLagProbe();
+        });
+    }
+
+    Executor::Stats Executor::stats() const
+    {
+        Stats res;
+
+#if defined(BOOST_ASIO_CUSTOM_HANDLER_TRACKING)
+        res.handlerTracking = true;
+#endif
+        res.queuedHandlers = handlerCounters_.queued.load(std::memory_order_relaxed);
+        res.handlersRun = handlerCounters_.numRun.load(std::memory_order_relaxed);
+        res.totalRunTime = std::chrono::nanoseconds(handlerCounters_.totalRunTimeNs.load(std::memory_order_relaxed));
+        res.maxRunTime = std::chrono::nanoseconds(handlerCounters_.maxRunTimeNs.load(std::memory_order_relaxed));
+        for (std::size_t i = 0; i < res.runTimeHistogram.size(); ++i) {
+            res.runTimeHistogram[i] = handlerCounters_.runTimeHistogram[i].load(std::memory_order_relaxed);
+        }
+        res.loopLag = std::chrono::nanoseconds(loopLagNs_.load(std::memory_order_relaxed));
+        res.maxLoopLag = std::chrono::nanoseconds(maxLoopLagNs_.load(std::memory_order_relaxed));
+
+        return res;
     }
 
     void Executor::stop(bool force)
     {
-        if (!thread_.joinable()) {
+        if (threads_.empty()) {
             return;
         }
 
+        // The probe keeps rescheduling itself, stop it or stop(false) never returns.
+        if (lagProbing_.exchange(false)) {
+            auto lagProbe = lagProbe_;
+            boost::asio::dispatch(*lagProbe->strand(), [lagProbe]() {
+                lagProbe->cancel();
+            });
+        }
+
         if (force) {
             ioService().stop();
         } else {
             work_.reset();
         }
 
-        runtime_assert((std::this_thread::get_id() != thread_.get_id()) && "Executor: self join detected!");
-        thread_.join();
+        for (auto& t : threads_) {
+            runtime_assert((std::this_thread::get_id() != t.get_id()) && "Executor: self join detected!");
+        }
+
+        for (auto& t : threads_) {
+            t.join();
+        }
+        threads_.clear();
+    }
+
+    void Executor::run(const CpuSet& cpus)
+    {
+        auto err = pinThisThread(cpus);
+        if (err) {
+            VMS_LOG_WARN(_FN, "Executor: cannot set thread affinity: " << err.message());
+        }
+
+        err = preferLocalMemory(cpus);
+        if (err) {
+            VMS_LOG_WARN(_FN, "Executor: cannot set memory policy: " << err.message());
+        }
+
+        boost::system::error_code ec;
+        if (busyPoll_.count() > 0) {
+            runBusyPoll(ec);
+        } else {
+            ioService().run(ec);
+        }
+        if (ec) {
+            VMS_LOG_ERROR(_FN, "Executor: " << ec.message());
+        }
+    }
+
+    void Executor::runBusyPoll(boost::system::error_code& ec)
+    {
+        while (!ioService().stopped()) {
+            // Spin until there's been nothing to do for 'busyPoll_'...
+            auto deadline = std::chrono::steady_clock::now() + busyPoll_;
+            do {
+                if (ioService().poll(ec) > 0) {
+                    deadline = std::chrono::steady_clock::now() + busyPoll_;
+                }
+                if (ec) {
+                    return;
+                }
+            } while (!ioService().stopped() && (std::chrono::steady_clock::now() < deadline));
+
+            // ...then block until the next handler.
+            ioService().run_one(ec);
+            if (ec) {
+                return;
+            }
+        }
+    }
+
+    void Executor::scheduleLagProbe()
+    {
+        strand_assert(lagProbe_->strand());
+
+        if (!lagProbing_) {
+            return;
+        }
+
+        lagProbeDue_ = std::chrono::steady_clock::now() + lagProbeInterval_;
+        lagProbe_->schedule([this]() {
+            std::int64_t lagNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - lagProbeDue_).count();
+            if (lagNs < 0) {
+                lagNs = 0;
+            }
+            loopLagNs_.store(lagNs, std::memory_order_relaxed);
+            if (lagNs > maxLoopLagNs_.load(std::memory_order_relaxed)) {
+                maxLoopLagNs_.store(lagNs, std::memory_order_relaxed);
+            }
+
+            scheduleLagProbe();
+        }, lagProbeInterval_);
+    }
+
+    std::ostream& operator<<(std::ostream& os, const Executor::Stats& stats)
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+
+        os << "loop lag " << duration_cast<microseconds>(stats.loopLag).count() << "us"
+           << " (max " << duration_cast<microseconds>(stats.maxLoopLag).count() << "us)";
+
+        if (!stats.handlerTracking) {
+            return os << ", handler stats need a VMS_HANDLER_TRACKING build";
+        }
+
+        os << ", pending " << stats.queuedHandlers
+           << ", run " << stats.handlersRun
+           << ", avg " << ((stats.handlersRun > 0) ? (duration_cast<microseconds>(stats.totalRunTime).count() / stats.handlersRun) : 0) << "us"
+           << ", max " << duration_cast<microseconds>(stats.maxRunTime).count() << "us"
+           << ", histogram(us)";
+
+        // Skip trailing empty buckets.
+        std::size_t n = stats.runTimeHistogram.size();
+        while ((n > 1) && (stats.runTimeHistogram[n - 1] == 0)) {
+            --n;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            os << " <" << (1ULL << i) << ":" << stats.runTimeHistogram[i];
+        }
+
+        return os;
     }
 } }
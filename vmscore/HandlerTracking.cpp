@@ -0,0 +1,146 @@
+#include "Vms/Core/HandlerCounters.h"
+#include <boost/asio/execution_context.hpp>
+#include <boost/asio/detail/handler_tracking.hpp>
+#include <algorithm>
+#include <chrono>
+
+namespace Vms { namespace Core
+{
+    namespace
+    {
+        // There're just a handful of Executors per process, so a small array that's
+        // scanned on handler creation is good enough and lock free.
+        const std::size_t maxRegistrations = 32;
+
+        struct Registration
+        {
+            std::atomic<const void*> context{nullptr};
+            std::atomic<HandlerCounters*> counters{nullptr};
+        };
+
+        Registration registrations[maxRegistrations];
+        std::atomic<std::size_t> numRegistrations{0};
+
+#if defined(BOOST_ASIO_CUSTOM_HANDLER_TRACKING)
+        // Strands and such run handlers from within handlers, only the outermost one is timed.
+        thread_local std::uint32_t invocationDepth = 0;
+#endif
+
+        inline HandlerCounters* findCounters(const void* context)
+        {
+            auto n = numRegistrations.load(std::memory_order_acquire);
+            for (std::size_t i = 0; i < n; ++i) {
+                if (registrations[i].context.load(std::memory_order_acquire) == context) {
+                    return registrations[i].counters.load(std::memory_order_acquire);
+                }
+            }
+            return nullptr;
+        }
+    }
+
+    void registerHandlerCounters(const void* context, HandlerCounters* counters)
+    {
+#if defined(BOOST_ASIO_CUSTOM_HANDLER_TRACKING)
+        // Reuse a free slot if any, registration is rare, so keep it simple.
+        auto n = numRegistrations.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < n; ++i) {
+            const void* expected = nullptr;
+            if (registrations[i].context.compare_exchange_strong(expected, context)) {
+                registrations[i].counters.store(counters, std::memory_order_release);
+                return;
+            }
+        }
+
+        auto i = numRegistrations.fetch_add(1);
+        if (i >= maxRegistrations) {
+            numRegistrations.fetch_sub(1);
+            return;
+        }
+        registrations[i].counters.store(counters, std::memory_order_release);
+        registrations[i].context.store(context, std::memory_order_release);
+#else
+        (void)context;
+        (void)counters;
+#endif
+    }
+
+    void unregisterHandlerCounters(const void* context)
+    {
+#if defined(BOOST_ASIO_CUSTOM_HANDLER_TRACKING)
+        auto n = numRegistrations.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < n; ++i) {
+            if (registrations[i].context.load(std::memory_order_acquire) == context) {
+                registrations[i].counters.store(nullptr, std::memory_order_release);
+                registrations[i].context.store(nullptr, std::memory_order_release);
+                return;
+            }
+        }
+#else
+        (void)context;
+#endif
+    }
+
+#if defined(BOOST_ASIO_CUSTOM_HANDLER_TRACKING)
+    void HandlerTracking::creation(boost::asio::execution_context& context, TrackedHandler& h,
+        const char*, void*, std::uintmax_t, const char*)
+    {
+        h.counters_ = findCounters(&context);
+        if (h.counters_) {
+            h.counters_->queued.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    HandlerTracking::Completion::Completion(const TrackedHandler& h)
+    : counters_(h.counters_)
+    {
+        // Called both when handler is about to be invoked and when it's destroyed
+        // without invocation, either way it's not queued anymore.
+        if (counters_) {
+            counters_->queued.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    HandlerTracking::Completion::~Completion()
+    {
+        // Handler has thrown.
+        if (active_) {
+            --invocationDepth;
+        }
+    }
+
+    void HandlerTracking::Completion::begin()
+    {
+        active_ = true;
+        outermost_ = (invocationDepth++ == 0);
+        if (outermost_ && counters_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    void HandlerTracking::Completion::invocationEnd()
+    {
+        --invocationDepth;
+        active_ = false;
+
+        if (!outermost_ || !counters_) {
+            return;
+        }
+
+        std::uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_).count();
+
+        std::size_t bucket = 0;
+        for (std::uint64_t us = ns / 1000; (us > 0) && (bucket < HandlerCounters::numRunTimeBuckets - 1); us >>= 1) {
+            ++bucket;
+        }
+
+        counters_->numRun.fetch_add(1, std::memory_order_relaxed);
+        counters_->totalRunTimeNs.fetch_add(ns, std::memory_order_relaxed);
+        counters_->runTimeHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+        auto maxNs = counters_->maxRunTimeNs.load(std::memory_order_relaxed);
+        while ((ns > maxNs) && !counters_->maxRunTimeNs.compare_exchange_weak(maxNs, ns, std::memory_order_relaxed)) {
+        }
+    }
+#endif
+} }
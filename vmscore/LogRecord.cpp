@@ -0,0 +1,135 @@
+#include "Vms/Core/LogRecord.h"
+#include <boost/asio/ip/address_v6.hpp>
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+
+namespace Vms { namespace Core
+{
+    void LogRecord::putString(std::string_view value)
+    {
+        if (truncated_) {
+            return;
+        }
+
+        std::uint32_t len = static_cast<std::uint32_t>(value.size());
+        if (size_ + 1 + sizeof(len) > maxSize - 1) {
+            truncate();
+            return;
+        }
+
+        bool cut = false;
+        auto avail = maxSize - 1 - size_ - 1 - sizeof(len);
+        if (len > avail) {
+            len = static_cast<std::uint32_t>(avail);
+            cut = true;
+        }
+
+        data_[size_++] = static_cast<char>(TagString);
+        std::memcpy(&data_[size_], &len, sizeof(len));
+        size_ += sizeof(len);
+        std::memcpy(&data_[size_], value.data(), len);
+        size_ += len;
+
+        if (cut) {
+            truncate();
+        }
+    }
+
+    void LogRecord::truncate()
+    {
+        if (!truncated_) {
+            truncated_ = true;
+            data_[size_++] = static_cast<char>(TagTruncated);
+        }
+    }
+
+    void LogRecord::appendInt(std::int64_t value, std::string& out)
+    {
+        char buf[32];
+        out.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
+    }
+
+    std::size_t LogRecord::formatEndpoint(const char* data, std::string& out)
+    {
+        RawEndpoint raw;
+        std::memcpy(&raw, data, sizeof(raw));
+
+        if (raw.v6) {
+            boost::asio::ip::address_v6::bytes_type bytes;
+            std::memcpy(bytes.data(), raw.address, bytes.size());
+            out.push_back('[');
+            out.append(boost::asio::ip::address_v6(bytes, raw.scopeId).to_string());
+            out.push_back(']');
+        } else {
+            for (int i = 0; i < 4; ++i) {
+                if (i > 0) {
+                    out.push_back('.');
+                }
+                appendInt(raw.address[i], out);
+            }
+        }
+        out.push_back(':');
+        appendInt(raw.port, out);
+        return sizeof(raw);
+    }
+
+    void LogRecord::format(const char* data, std::size_t size, std::string& out)
+    {
+        char buf[32];
+        std::size_t pos = 0;
+        while (pos < size) {
+            auto tag = static_cast<Tag>(data[pos++]);
+            switch (tag) {
+            case TagInt: {
+                std::int64_t value;
+                std::memcpy(&value, &data[pos], sizeof(value));
+                pos += sizeof(value);
+                out.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
+                break;
+            }
+            case TagUInt: {
+                std::uint64_t value;
+                std::memcpy(&value, &data[pos], sizeof(value));
+                pos += sizeof(value);
+                out.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
+                break;
+            }
+            case TagDouble: {
+                double value;
+                std::memcpy(&value, &data[pos], sizeof(value));
+                pos += sizeof(value);
+                // std::ostream's default, "C" locale.
+                int n = std::snprintf(buf, sizeof(buf), "%g", value);
+                out.append(buf, static_cast<std::size_t>(std::max(n, 0)));
+                break;
+            }
+            case TagChar:
+                out.push_back(data[pos++]);
+                break;
+            case TagBool:
+                out.push_back(data[pos++] ? '1' : '0');
+                break;
+            case TagString: {
+                std::uint32_t len;
+                std::memcpy(&len, &data[pos], sizeof(len));
+                pos += sizeof(len);
+                out.append(&data[pos], len);
+                pos += len;
+                break;
+            }
+            case TagRaw: {
+                FormatFn fn;
+                std::memcpy(&fn, &data[pos], sizeof(fn));
+                pos += sizeof(fn);
+                pos += fn(&data[pos], out);
+                break;
+            }
+            case TagTruncated:
+            default:
+                out.append("...");
+                return;
+            }
+        }
+    }
+} }
@@ -1,5 +1,12 @@
 #include "Vms/Core/Logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 namespace Vms { namespace Core
 {
@@ -10,30 +17,544 @@ namespace Vms { namespace Core
         "[ERROR] "
     };
 
+    namespace
+    {
+        // A record in a thread's ring, followed by the LogRecord's data.
+        struct RecordHeader
+        {
+            // Whole record size including the header, multiple of 8.
+            std::uint32_t size;
+            std::uint32_t dataSize;
+            // nullptr = padding up to the end of the ring.
+            const LogSite* site;
+        };
+
+        void formatLine(const LogSite& site, const char* data, std::size_t size, bool verbose, std::string& out)
+        {
+            out.append(logLevelStr[site.level]);
+            if (verbose) {
+                out.append("(").append(site.file).append(":").append(std::to_string(site.line)).append(") ");
+            }
+            out.append(site.facility).append(": ");
+            LogRecord::format(data, size, out);
+        }
+
+        const std::size_t recordAlign = 8;
+
+        // Single producer (the owning thread), single consumer (the sink thread) byte ring.
+        // 'head' and 'tail' only grow, the position in 'data' is pos & mask.
+        class ThreadRing
+        {
+        public:
+            ThreadRing(std::size_t size, std::uint64_t generation)
+            : data_(new char[size]), size_(size), generation_(generation)
+            {
+            }
+
+            inline std::uint64_t generation() const { return generation_; }
+
+            inline bool isAbandoned() const { return abandoned_.load(std::memory_order_acquire); }
+            inline void abandon() { abandoned_.store(true, std::memory_order_release); }
+
+            bool push(const LogSite& site, const LogRecord& record)
+            {
+                const std::size_t need = (sizeof(RecordHeader) + record.size() + recordAlign - 1) & ~(recordAlign - 1);
+                auto tail = tail_.load(std::memory_order_relaxed);
+                auto head = head_.load(std::memory_order_acquire);
+                auto offset = tail & (size_ - 1);
+                auto contiguous = size_ - offset;
+                auto total = (contiguous < need) ? (contiguous + need) : need;
+
+                if (total > size_ - (tail - head)) {
+                    return false;
+                }
+
+                if (contiguous < need) {
+                    // Records never wrap, the rest of the ring is skipped.
+                    if (contiguous >= sizeof(RecordHeader)) {
+                        RecordHeader padding{};
+                        padding.site = nullptr;
+                        std::memcpy(&data_[offset], &padding, sizeof(padding));
+                    }
+                    tail += contiguous;
+                    offset = 0;
+                }
+
+                RecordHeader header;
+                header.size = static_cast<std::uint32_t>(need);
+                header.dataSize = static_cast<std::uint32_t>(record.size());
+                header.site = &site;
+                std::memcpy(&data_[offset], &header, sizeof(header));
+                std::memcpy(&data_[offset + sizeof(header)], record.data(), record.size());
+
+                tail_.store(tail + need, std::memory_order_release);
+                return true;
+            }
+
+            // True if the sink should be woken up early.
+            inline bool isHalfFull() const
+            {
+                return (tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_relaxed)) > (size_ / 2);
+            }
+
+            // Formats all the records available into 'out', returns false if there were none.
+            bool drain(std::string& out, bool verbose)
+            {
+                auto head = head_.load(std::memory_order_relaxed);
+                auto tail = tail_.load(std::memory_order_acquire);
+                if (head == tail) {
+                    return false;
+                }
+
+                while (head != tail) {
+                    auto offset = head & (size_ - 1);
+                    auto contiguous = size_ - offset;
+                    if (contiguous < sizeof(RecordHeader)) {
+                        head += contiguous;
+                        continue;
+                    }
+
+                    RecordHeader header;
+                    std::memcpy(&header, &data_[offset], sizeof(header));
+                    if (!header.site) {
+                        head += contiguous;
+                        continue;
+                    }
+
+                    formatLine(*header.site, &data_[offset + sizeof(header)], header.dataSize, verbose, out);
+                    out.push_back('\n');
+
+                    head += header.size;
+                }
+
+                head_.store(head, std::memory_order_release);
+                return true;
+            }
+
+        private:
+            ThreadRing(const ThreadRing&) = delete;
+            ThreadRing& operator=(const ThreadRing&) = delete;
+
+            std::unique_ptr<char[]> data_;
+            const std::size_t size_;
+            const std::uint64_t generation_;
+            std::atomic<bool> abandoned_{ false };
+
+            alignas(64) std::atomic<std::size_t> head_{ 0 };
+            alignas(64) std::atomic<std::size_t> tail_{ 0 };
+        };
+
+        // Marks the thread's ring abandoned on thread exit, the sink drops it once it's drained.
+        struct ThreadRingHolder
+        {
+            ~ThreadRingHolder()
+            {
+                if (ring) {
+                    ring->abandon();
+                }
+            }
+
+            std::shared_ptr<ThreadRing> ring;
+        };
+
+        thread_local ThreadRingHolder threadRing;
+
+        std::atomic<std::uint64_t> nextGeneration{ 1 };
+
+        std::size_t roundUpPow2(std::size_t value)
+        {
+            std::size_t res = 1;
+            while (res < value) {
+                res <<= 1;
+            }
+            return res;
+        }
+    }
+
+    struct Logger::AsyncSink
+    {
+        AsyncSink(Logger& logger, const AsyncLogOptions& options)
+        : logger(logger), options(options), generation(nextGeneration.fetch_add(1, std::memory_order_relaxed))
+        {
+            this->options.bufferSize = roundUpPow2(std::max<std::size_t>(options.bufferSize, 4096));
+        }
+
+        ~AsyncSink()
+        {
+            closeFile();
+        }
+
+        std::error_code openFile(const char* mode)
+        {
+            if (options.path.empty()) {
+                out = stderr;
+                return std::error_code();
+            }
+
+            out = std::fopen(options.path.c_str(), mode);
+            if (!out) {
+                return std::error_code(errno, std::generic_category());
+            }
+            std::fseek(out, 0, SEEK_END);
+            auto pos = std::ftell(out);
+            fileSize = (pos > 0) ? static_cast<std::uint64_t>(pos) : 0;
+            return std::error_code();
+        }
+
+        void closeFile()
+        {
+            if (out && (out != stderr)) {
+                std::fclose(out);
+            }
+            out = nullptr;
+        }
+
+        // path -> path.1 -> path.2 ... the oldest one is overwritten.
+        void rotate()
+        {
+            closeFile();
+            if (options.maxFiles == 0) {
+                std::remove(options.path.c_str());
+            } else {
+                for (auto i = options.maxFiles - 1; i > 0; --i) {
+                    std::rename((options.path + "." + std::to_string(i)).c_str(),
+                        (options.path + "." + std::to_string(i + 1)).c_str());
+                }
+                std::rename(options.path.c_str(), (options.path + ".1").c_str());
+            }
+            if (openFile("w")) {
+                // Nowhere to write, better than losing the logs.
+                out = stderr;
+            }
+        }
+
+        void write(const std::string& batch)
+        {
+            if ((out != stderr) && (options.maxFileSize > 0) && (fileSize > 0) &&
+                (fileSize + batch.size() > options.maxFileSize)) {
+                rotate();
+            }
+            std::fwrite(batch.data(), 1, batch.size(), out);
+            std::fflush(out);
+            fileSize += batch.size();
+        }
+
+        // Returns false if all the rings were empty.
+        bool drainAll(std::string& batch)
+        {
+            bool any = false;
+            bool verbose = logger.isVerbose();
+
+            std::lock_guard<std::mutex> lock(ringsMtx);
+            for (auto it = rings.begin(); it != rings.end();) {
+                // Checked before draining, so a ring is only dropped if it was empty
+                // after its thread had exited.
+                bool abandoned = (*it)->isAbandoned();
+                if ((*it)->drain(batch, verbose)) {
+                    any = true;
+                } else if (abandoned) {
+                    it = rings.erase(it);
+                    continue;
+                }
+                ++it;
+            }
+
+            auto dropped = logger.numDropped();
+            if (dropped != numDroppedReported) {
+                batch.append(logLevelStr[LogLevelWARN]).append("Logger: ")
+                    .append(std::to_string(dropped - numDroppedReported)).append(" message(s) dropped\n");
+                numDroppedReported = dropped;
+            }
+
+            return any;
+        }
+
+        // Wakes the sink up before 'flushInterval' elapses, called by producers whose
+        // rings are filling up. Once per drain, so a busy producer doesn't hammer 'cv'.
+        void nudge()
+        {
+            if (!nudged.exchange(true, std::memory_order_relaxed)) {
+                cv.notify_one();
+            }
+        }
+
+        void run()
+        {
+            std::string batch;
+            for (;;) {
+                nudged.store(false, std::memory_order_relaxed);
+                batch.clear();
+                bool any = drainAll(batch);
+                if (logger.isReportDue()) {
+                    logger.reportSuppressed(batch, logger.isVerbose(), false);
+                }
+                if (!batch.empty()) {
+                    write(batch);
+                }
+
+                std::unique_lock<std::mutex> lock(mtx);
+                if (stopping) {
+                    break;
+                }
+                if (!any) {
+                    cv.wait_for(lock, options.flushInterval);
+                }
+            }
+
+            // Whatever was logged before stopAsync().
+            batch.clear();
+            drainAll(batch);
+            logger.reportSuppressed(batch, logger.isVerbose(), true);
+            if (!batch.empty()) {
+                write(batch);
+            }
+        }
+
+        void registerRing(const std::shared_ptr<ThreadRing>& ring)
+        {
+            std::lock_guard<std::mutex> lock(ringsMtx);
+            rings.push_back(ring);
+        }
+
+        Logger& logger;
+        AsyncLogOptions options;
+        const std::uint64_t generation;
+
+        std::FILE* out = nullptr;
+        std::uint64_t fileSize = 0;
+        std::uint64_t numDroppedReported = 0;
+
+        std::mutex ringsMtx;
+        std::vector<std::shared_ptr<ThreadRing>> rings;
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool stopping = false;
+        std::atomic<bool> nudged{ false };
+
+        std::thread thread;
+    };
+
     Logger logger;
 
-    void Logger::log(LogLevel logLevel, const char* facility, const std::string& message,
-        const char* file, int line)
+    Logger::Logger()
     {
+        for (auto& level : levels_) {
+            level.store(LogLevelDEBUG, std::memory_order_relaxed);
+        }
+        // Slot 0 is shared by all the facilities that didn't fit.
+        facilityNames_.emplace_back();
+        hasOwnLevel_.push_back(false);
+    }
+
+    Logger::~Logger()
+    {
+        stopAsync();
+    }
+
+    LogLevel Logger::level() const
+    {
+        std::lock_guard<std::mutex> lock(facilitiesMtx_);
+        return level_;
+    }
+
+    void Logger::setLevel(LogLevel logLevel)
+    {
+        std::lock_guard<std::mutex> lock(facilitiesMtx_);
+        level_ = logLevel;
+        for (std::size_t i = 0; i < facilityNames_.size(); ++i) {
+            if (!hasOwnLevel_[i]) {
+                levels_[i].store(logLevel, std::memory_order_relaxed);
+            }
+        }
+        // Slots not taken yet, so a new facility starts with the right level.
+        for (auto i = facilityNames_.size(); i < maxFacilities; ++i) {
+            levels_[i].store(logLevel, std::memory_order_relaxed);
+        }
+    }
+
+    void Logger::setFacilityLevel(const std::string& facility, LogLevel logLevel)
+    {
+        std::lock_guard<std::mutex> lock(facilitiesMtx_);
+        auto id = findOrAddFacility(facility);
+        if (id == 0) {
+            return;
+        }
+        hasOwnLevel_[id] = true;
+        levels_[id].store(logLevel, std::memory_order_relaxed);
+    }
+
+    void Logger::resetFacilityLevel(const std::string& facility)
+    {
+        std::lock_guard<std::mutex> lock(facilitiesMtx_);
+        auto id = findOrAddFacility(facility);
+        if (id == 0) {
+            return;
+        }
+        hasOwnLevel_[id] = false;
+        levels_[id].store(level_, std::memory_order_relaxed);
+    }
+
+    std::error_code Logger::setFacilityLevels(const std::string& spec)
+    {
+        static const char* levelNames[] = { "debug", "info", "warn", "error", "off" };
+
+        std::vector<std::pair<std::string, LogLevel>> levels;
+        std::size_t pos = 0;
+        while (pos < spec.size()) {
+            auto end = spec.find(',', pos);
+            if (end == std::string::npos) {
+                end = spec.size();
+            }
+            auto item = spec.substr(pos, end - pos);
+            pos = end + 1;
+
+            auto eq = item.find('=');
+            if ((eq == std::string::npos) || (eq == 0)) {
+                return std::make_error_code(std::errc::invalid_argument);
+            }
+            auto name = item.substr(eq + 1);
+            auto it = std::find(std::begin(levelNames), std::end(levelNames), name);
+            if (it == std::end(levelNames)) {
+                return std::make_error_code(std::errc::invalid_argument);
+            }
+            levels.emplace_back(item.substr(0, eq), static_cast<LogLevel>(it - std::begin(levelNames)));
+        }
+
+        for (const auto& level : levels) {
+            setFacilityLevel(level.first, level.second);
+        }
+
+        return std::error_code();
+    }
+
+    std::size_t Logger::facilityId(const char* facility)
+    {
+        std::lock_guard<std::mutex> lock(facilitiesMtx_);
+        return findOrAddFacility(facility);
+    }
+
+    std::size_t Logger::findOrAddFacility(const std::string& facility)
+    {
+        for (std::size_t i = 1; i < facilityNames_.size(); ++i) {
+            if (facilityNames_[i] == facility) {
+                return i;
+            }
+        }
+        if (facilityNames_.size() >= maxFacilities) {
+            return 0;
+        }
+        // Its slot already has the default level, see setLevel().
+        facilityNames_.push_back(facility);
+        hasOwnLevel_.push_back(false);
+        return facilityNames_.size() - 1;
+    }
+
+    std::error_code Logger::startAsync(const AsyncLogOptions& options)
+    {
+        stopAsync();
+
+        std::unique_ptr<AsyncSink> sink(new AsyncSink(*this, options));
+        auto ec = sink->openFile("a");
+        if (ec) {
+            return ec;
+        }
+
+        auto* newSink = sink.get();
+        sinks_.push_back(std::move(sink));
+        newSink->numDroppedReported = numDropped();
+        newSink->thread = std::thread([newSink]() { newSink->run(); });
+        sink_.store(newSink, std::memory_order_release);
+        async_.store(true, std::memory_order_release);
+
+        return std::error_code();
+    }
+
+    void Logger::stopAsync()
+    {
+        auto* sink = sink_.load(std::memory_order_relaxed);
+        if (!sink || !sink->thread.joinable()) {
+            return;
+        }
+
+        async_.store(false, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(sink->mtx);
+            sink->stopping = true;
+        }
+        sink->cv.notify_one();
+        sink->thread.join();
+
+        // The sink itself is kept in 'sinks_', a thread that saw async mode just before it
+        // was stopped may still be pushing to its ring.
+        sink->closeFile();
+    }
+
+    void Logger::log(const LogSite& site, const LogRecord& record)
+    {
+        if (async_.load(std::memory_order_acquire)) {
+            logAsync(site, record);
+            return;
+        }
+
+        std::string line;
+        line.reserve(256);
+        if (isReportDue()) {
+            reportSuppressed(line, verbose_, false);
+        }
+        formatLine(site, record.data(), record.size(), verbose_, line);
+
         std::lock_guard<std::mutex> lock(mtx_);
-        switch (logLevel) {
-        case LogLevelDEBUG:
-        case LogLevelINFO:
-        case LogLevelWARN:
-            if (verbose_) {
-                std::cerr << logLevelStr[logLevel] << "(" << file << ":" << line << ") " << facility << ": " << message << std::endl;
-            } else {
-                std::cerr << logLevelStr[logLevel] << facility << ": " << message << std::endl;
+        std::cerr << line << std::endl;
+    }
+
+    void Logger::registerLimiter(LogRateLimiter& limiter)
+    {
+        std::lock_guard<std::mutex> lock(limitersMtx_);
+        limiter.next_ = limiters_;
+        limiters_ = &limiter;
+    }
+
+    bool Logger::isReportDue()
+    {
+        auto second = LogRateLimiter::currentSecond();
+        auto last = lastReport_.load(std::memory_order_relaxed);
+        return (second != last) && lastReport_.compare_exchange_strong(last, second, std::memory_order_relaxed);
+    }
+
+    void Logger::reportSuppressed(std::string& out, bool verbose, bool all)
+    {
+        auto second = LogRateLimiter::currentSecond();
+
+        std::lock_guard<std::mutex> lock(limitersMtx_);
+        for (auto* limiter = limiters_; limiter; limiter = limiter->next_) {
+            auto suppressed = limiter->takeSuppressed(second, all);
+            if (suppressed > 0) {
+                LogRecord record;
+                record << "suppressed " << suppressed << " similar message(s)";
+                formatLine(limiter->site(), record.data(), record.size(), verbose, out);
+                out.push_back('\n');
             }
-            break;
-        case LogLevelERROR:
-        default:
-            if (verbose_) {
-                std::cerr << logLevelStr[logLevel] << "(" << file << ":" << line << ") " << facility << ": " << message << std::endl;
-            } else {
-                std::cerr << logLevelStr[logLevel] << facility << ": " << message << std::endl;
+        }
+    }
+
+    void Logger::logAsync(const LogSite& site, const LogRecord& record)
+    {
+        auto& sink = *sink_.load(std::memory_order_acquire);
+        auto& ring = threadRing.ring;
+        if (!ring || (ring->generation() != sink.generation)) {
+            if (ring) {
+                ring->abandon();
             }
-            break;
+            ring = std::make_shared<ThreadRing>(sink.options.bufferSize, sink.generation);
+            sink.registerRing(ring);
+        }
+
+        if (!ring->push(site, record)) {
+            numDropped_.fetch_add(1, std::memory_order_relaxed);
+            sink.nudge();
+        } else if (ring->isHalfFull()) {
+            sink.nudge();
         }
     }
 } }
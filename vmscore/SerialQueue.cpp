@@ -0,0 +1,134 @@
+#include "Vms/Core/SerialQueue.h"
+#include <boost/asio/post.hpp>
+
+namespace Vms { namespace Core
+{
+    namespace
+    {
+        thread_local const SerialQueue* currentQueue = nullptr;
+    }
+
+    SerialQueue::SerialQueue(boost::asio::io_service& ioService, const StrandPtr& strand)
+    : ioService_(ioService),
+      strand_(strand),
+      head_(&stub_),
+      tail_(&stub_)
+    {
+    }
+
+    SerialQueue::~SerialQueue()
+    {
+        // Nobody can post anymore, so the queue is consistent.
+        while (Node* node = pop()) {
+            delete node;
+        }
+    }
+
+    bool SerialQueue::runningInThisThread() const
+    {
+        return currentQueue == this;
+    }
+
+    void SerialQueue::push(Node* node)
+    {
+        enqueue(node);
+
+        if (!scheduled_.exchange(true)) {
+            schedule();
+        }
+    }
+
+    void SerialQueue::enqueue(Node* node)
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    SerialQueue::Node* SerialQueue::pop()
+    {
+        Node* tail = tail_;
+        Node* next = tail->next.load(std::memory_order_acquire);
+
+        if (tail == &stub_) {
+            if (!next) {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+
+        if (tail != head_.load(std::memory_order_acquire)) {
+            // A producer is in the middle of push(), it'll be visible shortly.
+            return nullptr;
+        }
+
+        // 'tail' is the last node, put stub_ behind it so that it can be taken out.
+        enqueue(&stub_);
+
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+
+        return nullptr;
+    }
+
+    void SerialQueue::schedule()
+    {
+        auto sharedThis = shared_from_this();
+        if (strand_) {
+            boost::asio::post(*strand_, [sharedThis]() {
+                sharedThis->drain();
+            });
+        } else {
+            boost::asio::post(ioService_, [sharedThis]() {
+                sharedThis->drain();
+            });
+        }
+    }
+
+    void SerialQueue::drain()
+    {
+        auto prevQueue = currentQueue;
+        currentQueue = this;
+
+        std::size_t n = 0;
+        for (; n < maxBatch; ++n) {
+            Node* node = pop();
+            if (!node) {
+                break;
+            }
+            node->run();
+            delete node;
+        }
+
+        currentQueue = prevQueue;
+
+        if (n == maxBatch) {
+            // Still scheduled, let others run first.
+            schedule();
+            return;
+        }
+
+        scheduled_.store(false);
+
+        // A push() may have seen scheduled_ == true just before the store above. Whether work
+        // is left is decided from the consumer side: pop() leaves tail_ on a node it couldn't
+        // take yet because of a half-done push(), and a push() behind the stub shows up as
+        // its next or as head_ moved past it.
+        bool more = (tail_ != &stub_) ||
+            (stub_.next.load(std::memory_order_acquire) != nullptr) ||
+            (head_.load(std::memory_order_acquire) != &stub_);
+        if (more && !scheduled_.exchange(true)) {
+            schedule();
+        }
+    }
+} }
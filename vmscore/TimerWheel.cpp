@@ -0,0 +1,290 @@
+#include "Vms/Core/TimerWheel.h"
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+namespace Vms { namespace Core
+{
+    boost::asio::execution_context::id TimerWheel::id;
+
+    TimerWheel::TimerWheel(boost::asio::execution_context& context)
+    : boost::asio::execution_context::service(context),
+      ioService_(static_cast<boost::asio::io_service&>(context)),
+      tick_(std::chrono::milliseconds(10)),
+      epoch_(std::chrono::steady_clock::now()),
+      timer_(ioService_),
+      currentTick_(0)
+    {
+    }
+
+    TimerWheel::~TimerWheel()
+    {
+        shutdown();
+    }
+
+    TimerWheel& TimerWheel::install(boost::asio::io_service& ioService, std::chrono::steady_clock::duration tick)
+    {
+        if (boost::asio::has_service<TimerWheel>(ioService)) {
+            return boost::asio::use_service<TimerWheel>(ioService);
+        }
+
+        auto& wheel = boost::asio::use_service<TimerWheel>(ioService);
+        if (tick > std::chrono::steady_clock::duration::zero()) {
+            std::lock_guard<std::mutex> lock(wheel.mtx_);
+            wheel.tick_ = tick;
+        }
+        return wheel;
+    }
+
+    TimerWheel* TimerWheel::get(boost::asio::io_service& ioService)
+    {
+        if (!boost::asio::has_service<TimerWheel>(ioService)) {
+            return nullptr;
+        }
+        return &boost::asio::use_service<TimerWheel>(ioService);
+    }
+
+    void TimerWheel::schedule(Entry& entry, std::shared_ptr<void> owner, std::chrono::steady_clock::duration timeout)
+    {
+        std::shared_ptr<void> prevOwner;
+
+        std::lock_guard<std::mutex> lock(mtx_);
+
+        if (entry.owner_) {
+            unlink(entry);
+            prevOwner = std::move(entry.owner_);
+        }
+
+        entry.owner_ = std::move(owner);
+        link(entry, timeout);
+    }
+
+    bool TimerWheel::reschedule(Entry& entry, std::chrono::steady_clock::duration timeout)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+
+        if (!entry.owner_) {
+            return false;
+        }
+
+        unlink(entry);
+        link(entry, timeout);
+        return true;
+    }
+
+    bool TimerWheel::scheduled(const Entry& entry)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return static_cast<bool>(entry.owner_);
+    }
+
+    std::shared_ptr<void> TimerWheel::cancel(Entry& entry)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+
+        if (!entry.owner_) {
+            return nullptr;
+        }
+
+        unlink(entry);
+
+        // The timer is left armed, it'll find nothing due and rearm for the next entry, if any.
+        return std::move(entry.owner_);
+    }
+
+    void TimerWheel::shutdown()
+    {
+        // Owners are released outside of the lock, they may be the last references.
+        std::vector<std::shared_ptr<void>> owners;
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+
+            boost::system::error_code ec;
+            timer_.cancel(ec);
+            armed_ = false;
+
+            for (auto& level : slots_) {
+                for (auto& slot : level) {
+                    while (slot) {
+                        Entry& entry = *slot;
+                        unlink(entry);
+                        owners.push_back(std::move(entry.owner_));
+                    }
+                }
+            }
+        }
+    }
+
+    void TimerWheel::link(Entry& entry, std::chrono::steady_clock::duration timeout)
+    {
+        auto now = std::chrono::steady_clock::now();
+        advance(tickOf(now));
+
+        // Round up, so that the entry never expires early.
+        entry.expiryTick_ = tickOf(now + timeout + tick_ - std::chrono::steady_clock::duration(1));
+        if (entry.expiryTick_ <= currentTick_) {
+            entry.expiryTick_ = currentTick_ + 1;
+        }
+        insert(entry);
+
+        arm();
+    }
+
+    void TimerWheel::insert(Entry& entry)
+    {
+        // The lowest level whose slot holds the expiry tick within the current rotation of
+        // the level above, i.e. the slot is still ahead. Longer than the whole wheel is
+        // parked in the top level, it's put back when its slot comes due.
+        auto placed = std::min(entry.expiryTick_, currentTick_ + ((std::uint64_t(1) << (levelBits * numLevels)) - 1));
+        std::size_t level = 0;
+        while ((level + 1 < numLevels) &&
+            ((placed >> (levelBits * (level + 1))) != (currentTick_ >> (levelBits * (level + 1))))) {
+            ++level;
+        }
+        auto slot = static_cast<std::size_t>((placed >> (levelBits * level)) & (numSlots - 1));
+
+        entry.level_ = static_cast<std::uint8_t>(level);
+        entry.slot_ = static_cast<std::uint8_t>(slot);
+
+        Entry*& head = slots_[level][slot];
+        entry.prev_ = nullptr;
+        entry.next_ = head;
+        if (head) {
+            head->prev_ = &entry;
+        }
+        head = &entry;
+        occupied_[level] |= std::uint64_t(1) << slot;
+        ++numEntries_;
+    }
+
+    void TimerWheel::unlink(Entry& entry)
+    {
+        Entry*& head = slots_[entry.level_][entry.slot_];
+        if (entry.prev_) {
+            entry.prev_->next_ = entry.next_;
+        } else {
+            head = entry.next_;
+        }
+        if (entry.next_) {
+            entry.next_->prev_ = entry.prev_;
+        }
+        if (!head) {
+            occupied_[entry.level_] &= ~(std::uint64_t(1) << entry.slot_);
+        }
+        entry.prev_ = nullptr;
+        entry.next_ = nullptr;
+        --numEntries_;
+    }
+
+    std::uint64_t TimerWheel::nextEventTick() const
+    {
+        // Slots ahead of the current one, a lower level's come before any of a higher level.
+        for (std::size_t level = 0; level < numLevels; ++level) {
+            auto shift = levelBits * level;
+            auto current = (currentTick_ >> shift) & (numSlots - 1);
+            // 2 << 63 wraps to 0, i.e. no slot ahead.
+            auto ahead = occupied_[level] & ~((std::uint64_t(2) << current) - 1);
+            if (ahead != 0) {
+                auto rotation = (currentTick_ >> (shift + levelBits)) << (shift + levelBits);
+                return rotation + (static_cast<std::uint64_t>(std::countr_zero(ahead)) << shift);
+            }
+        }
+
+        // Only the top level has slots in its next rotation.
+        auto shift = levelBits * (numLevels - 1);
+        auto rotation = ((currentTick_ >> (shift + levelBits)) + 1) << (shift + levelBits);
+        return rotation + (static_cast<std::uint64_t>(std::countr_zero(occupied_[numLevels - 1])) << shift);
+    }
+
+    void TimerWheel::advance(std::uint64_t tick)
+    {
+        if (tick <= currentTick_) {
+            return;
+        }
+        if (numEntries_ > 0) {
+            // Entries are placed relative to currentTick_, it can't skip a tick with work.
+            tick = std::min(tick, nextEventTick() - 1);
+        }
+        currentTick_ = std::max(currentTick_, tick);
+    }
+
+    void TimerWheel::arm()
+    {
+        if (numEntries_ == 0) {
+            return;
+        }
+
+        auto next = nextEventTick();
+        if (armed_ && (armedTick_ <= next)) {
+            return;
+        }
+
+        // Cancels the wait for a later tick, if any.
+        armed_ = true;
+        armedTick_ = next;
+        timer_.expires_at(epoch_ + tick_ * static_cast<std::int64_t>(next));
+        timer_.async_wait([this](const boost::system::error_code& ec) {
+            onTimer(ec);
+        });
+    }
+
+    void TimerWheel::onTimer(const boost::system::error_code& ec)
+    {
+        // Expired entries and their owners, processed outside of the lock.
+        Entry* expired = nullptr;
+        std::vector<std::shared_ptr<void>> owners;
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+
+            if (ec == boost::asio::error::operation_aborted) {
+                // Rearmed for an earlier tick or shut down, 'armed_' is the newer wait's.
+                return;
+            }
+            armed_ = false;
+
+            auto nowTick = tickOf(std::chrono::steady_clock::now());
+            while (numEntries_ > 0) {
+                auto t = nextEventTick();
+                if (t > nowTick) {
+                    break;
+                }
+                currentTick_ = t;
+
+                // Slots of the levels above starting at 't' move down, top first.
+                for (auto level = numLevels - 1; level > 0; --level) {
+                    auto shift = levelBits * level;
+                    if ((t & ((std::uint64_t(1) << shift) - 1)) != 0) {
+                        continue;
+                    }
+                    auto& slot = slots_[level][(t >> shift) & (numSlots - 1)];
+                    while (slot) {
+                        Entry& entry = *slot;
+                        unlink(entry);
+                        insert(entry);
+                    }
+                }
+
+                auto& slot = slots_[0][t & (numSlots - 1)];
+                while (slot) {
+                    Entry& entry = *slot;
+                    unlink(entry);
+                    owners.push_back(std::move(entry.owner_));
+                    entry.next_ = expired;
+                    expired = &entry;
+                }
+            }
+            advance(nowTick);
+
+            arm();
+        }
+
+        while (expired) {
+            Entry* next = expired->next_;
+            expired->next_ = nullptr;
+            expired->onExpired();
+            expired = next;
+        }
+    }
+} }
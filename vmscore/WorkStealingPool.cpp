@@ -0,0 +1,258 @@
+#include "Vms/Core/WorkStealingPool.h"
+#include "Vms/Core/Logger.h"
+#include "Vms/Core/Assert.h"
+
+#define _FN "Core"
+
+namespace Vms { namespace Core
+{
+    namespace
+    {
+        // Pool and worker index of the calling thread, if it's a pool worker.
+        thread_local const WorkStealingPool* currentPool = nullptr;
+        thread_local std::size_t currentIndex = 0;
+
+        // xorshift, we only need victims to differ between workers.
+        thread_local std::uint32_t randomState = 0;
+
+        inline std::uint32_t nextRandom()
+        {
+            std::uint32_t x = randomState;
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            randomState = x;
+            return x;
+        }
+    }
+
+    WorkStealingPool::WorkStealingPool(std::size_t numThreads, const CpuSet& cpus)
+    {
+        if (numThreads == 0) {
+            numThreads = 1;
+        }
+
+        workers_.reserve(numThreads);
+        for (std::size_t i = 0; i < numThreads; ++i) {
+            workers_.emplace_back(new Worker());
+        }
+
+        for (std::size_t i = 0; i < numThreads; ++i) {
+            workers_[i]->thread = std::thread(&WorkStealingPool::run, this, i, cpus);
+        }
+    }
+
+    WorkStealingPool::~WorkStealingPool()
+    {
+        stop(true);
+    }
+
+    void WorkStealingPool::post(Task task)
+    {
+        // Count it before it becomes visible to workers, so that pending_ never goes below 0.
+        pending_.fetch_add(1);
+
+        std::size_t index = (currentPool == this) ? currentIndex :
+            (nextWorker_.fetch_add(1, std::memory_order_relaxed) % workers_.size());
+
+        bool queued = false;
+        {
+            auto& worker = *workers_[index];
+            std::lock_guard<std::mutex> lock(worker.mtx);
+            if (!worker.closed) {
+                worker.tasks.push_back(std::move(task));
+                queued = true;
+            }
+        }
+
+        if (!queued) {
+            pending_.fetch_sub(1);
+            task();
+            return;
+        }
+
+        notify(1);
+    }
+
+    void WorkStealingPool::post(std::vector<Task> tasks)
+    {
+        if (tasks.empty()) {
+            return;
+        }
+
+        pending_.fetch_add(tasks.size());
+
+        // Those for closed workers, run once the deques are unlocked.
+        std::vector<Task> late;
+
+        if (currentPool == this) {
+            // A worker that's still running isn't closed.
+            auto& worker = *workers_[currentIndex];
+            std::lock_guard<std::mutex> lock(worker.mtx);
+            for (auto& task : tasks) {
+                worker.tasks.push_back(std::move(task));
+            }
+        } else {
+            // Split into contiguous chunks, one per worker, starting at the round-robin position.
+            std::size_t numChunks = std::min(tasks.size(), workers_.size());
+            std::size_t first = nextWorker_.fetch_add(numChunks, std::memory_order_relaxed);
+            std::size_t chunkSize = tasks.size() / numChunks;
+            std::size_t remainder = tasks.size() % numChunks;
+            auto it = tasks.begin();
+            for (std::size_t i = 0; i < numChunks; ++i) {
+                auto end = it + (chunkSize + ((i < remainder) ? 1 : 0));
+                auto& worker = *workers_[(first + i) % workers_.size()];
+                std::lock_guard<std::mutex> lock(worker.mtx);
+                for (; it != end; ++it) {
+                    if (worker.closed) {
+                        late.push_back(std::move(*it));
+                    } else {
+                        worker.tasks.push_back(std::move(*it));
+                    }
+                }
+            }
+        }
+
+        if (!late.empty()) {
+            pending_.fetch_sub(late.size());
+            for (auto& task : late) {
+                task();
+            }
+        }
+
+        notify(tasks.size() - late.size());
+    }
+
+    void WorkStealingPool::stop(bool force)
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMtx_);
+            if (force) {
+                stopped_ = true;
+            } else {
+                draining_ = true;
+            }
+        }
+        sleepCond_.notify_all();
+
+        for (auto& worker : workers_) {
+            runtime_assert((std::this_thread::get_id() != worker->thread.get_id()) && "WorkStealingPool: self join detected!");
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+
+        // From here on posts run on the posting thread. A forced stop drops whatever is still
+        // queued, otherwise it's only what got posted while the workers were exiting, run it here.
+        std::vector<Task> left;
+        for (auto& worker : workers_) {
+            std::lock_guard<std::mutex> lock(worker->mtx);
+            worker->closed = true;
+            for (auto& task : worker->tasks) {
+                left.push_back(std::move(task));
+            }
+            worker->tasks.clear();
+        }
+        pending_.fetch_sub(left.size());
+
+        if (!force) {
+            for (auto& task : left) {
+                task();
+            }
+        }
+    }
+
+    void WorkStealingPool::run(std::size_t index, const CpuSet& cpus)
+    {
+        auto err = pinThisThread(cpus);
+        if (err) {
+            VMS_LOG_WARN(_FN, "WorkStealingPool: cannot set thread affinity: " << err.message());
+        }
+
+        err = preferLocalMemory(cpus);
+        if (err) {
+            VMS_LOG_WARN(_FN, "WorkStealingPool: cannot set memory policy: " << err.message());
+        }
+
+        currentPool = this;
+        currentIndex = index;
+        randomState = static_cast<std::uint32_t>(index) * 2654435761U + 1;
+
+        Task task;
+        for (;;) {
+            // Checked before every task, so a forced stop doesn't run the queued ones.
+            if (stopped_.load(std::memory_order_relaxed)) {
+                break;
+            }
+
+            if (popLocal(index, task) || steal(index, task)) {
+                pending_.fetch_sub(1);
+                task();
+                task = nullptr;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMtx_);
+            if (stopped_) {
+                break;
+            }
+
+            // Pairs with notify(): either we see the new task or the poster sees us sleeping.
+            numSleeping_.fetch_add(1);
+            sleepCond_.wait(lock, [this]() {
+                return stopped_ || draining_ || (pending_.load() > 0);
+            });
+            numSleeping_.fetch_sub(1);
+
+            if (stopped_ || (draining_ && (pending_.load() == 0))) {
+                break;
+            }
+        }
+
+        currentPool = nullptr;
+    }
+
+    bool WorkStealingPool::popLocal(std::size_t index, Task& task)
+    {
+        auto& worker = *workers_[index];
+        std::lock_guard<std::mutex> lock(worker.mtx);
+        if (worker.tasks.empty()) {
+            return false;
+        }
+        task = std::move(worker.tasks.back());
+        worker.tasks.pop_back();
+        return true;
+    }
+
+    bool WorkStealingPool::steal(std::size_t index, Task& task)
+    {
+        std::size_t n = workers_.size();
+        std::size_t start = nextRandom() % n;
+        for (std::size_t i = 0; i < n; ++i) {
+            std::size_t victim = (start + i) % n;
+            if (victim == index) {
+                continue;
+            }
+            auto& worker = *workers_[victim];
+            std::lock_guard<std::mutex> lock(worker.mtx);
+            if (!worker.tasks.empty()) {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkStealingPool::notify(std::size_t numTasks)
+    {
+        if (numSleeping_.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleepMtx_);
+            if (numTasks == 1) {
+                sleepCond_.notify_one();
+            } else {
+                sleepCond_.notify_all();
+            }
+        }
+    }
+} }
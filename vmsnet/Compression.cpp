@@ -0,0 +1,154 @@
+#include "Vms/Net/Compression.h"
+#include "Vms/Net/Protocol.h"
+
+#if defined(VMS_HAS_ZLIB)
+# include <zlib.h>
+#else
+struct z_stream_s {};
+#endif
+
+namespace Vms { namespace Net
+{
+    namespace
+    {
+        // Output space added at a time.
+        const std::size_t chunkSize = 64 * 1024;
+
+#if defined(VMS_HAS_ZLIB)
+        // Raw deflate, no zlib header or checksum, the frames already delimit the stream.
+        const int windowBits = -15;
+
+        // Runs deflate() on 'size' bytes at 'data', growing 'out' as needed.
+        bool deflateBytes(z_stream& z, const char* data, std::size_t size, int flush, std::string& out)
+        {
+            z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            z.avail_in = static_cast<uInt>(size);
+            for (;;) {
+                if (z.avail_out == 0) {
+                    auto used = out.size();
+                    out.resize(used + chunkSize);
+                    z.next_out = reinterpret_cast<Bytef*>(&out[used]);
+                    z.avail_out = static_cast<uInt>(chunkSize);
+                }
+                auto res = ::deflate(&z, flush);
+                if ((res != Z_OK) && (res != Z_BUF_ERROR)) {
+                    return false;
+                }
+                // A sync flush is complete once it leaves output space unused.
+                if ((z.avail_in == 0) && (z.avail_out != 0)) {
+                    return true;
+                }
+            }
+        }
+#endif
+    }
+
+    bool compressionSupported()
+    {
+#if defined(VMS_HAS_ZLIB)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    Deflater::Deflater(int level)
+        : stream_(std::make_unique<z_stream_s>())
+    {
+#if defined(VMS_HAS_ZLIB)
+        ok_ = (::deflateInit2(stream_.get(), level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+#else
+        (void)level;
+#endif
+    }
+
+    Deflater::~Deflater()
+    {
+#if defined(VMS_HAS_ZLIB)
+        if (ok_) {
+            ::deflateEnd(stream_.get());
+        }
+#endif
+    }
+
+    bool Deflater::compressFrame(const OutboundBuffer::ConstBuffers& buffers, std::string& out)
+    {
+#if defined(VMS_HAS_ZLIB)
+        if (!ok_) {
+            return false;
+        }
+
+        auto& z = *stream_;
+        payload_.resize(::deflateBound(&z, static_cast<uLong>(boost::asio::buffer_size(buffers))) + 16);
+        z.next_out = reinterpret_cast<Bytef*>(payload_.data());
+        z.avail_out = static_cast<uInt>(payload_.size());
+
+        for (std::size_t i = 0; i < buffers.size(); ++i) {
+            auto flush = (i + 1 == buffers.size()) ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+            if (!deflateBytes(z, static_cast<const char*>(buffers[i].data()), buffers[i].size(), flush, payload_)) {
+                ok_ = false;
+                ::deflateEnd(&z);
+                return false;
+            }
+        }
+        payload_.erase(payload_.size() - z.avail_out);
+
+        appendCompressedFrame(out, payload_);
+        return true;
+#else
+        (void)buffers;
+        (void)out;
+        return false;
+#endif
+    }
+
+    Inflater::Inflater()
+        : stream_(std::make_unique<z_stream_s>())
+    {
+#if defined(VMS_HAS_ZLIB)
+        ok_ = (::inflateInit2(stream_.get(), windowBits) == Z_OK);
+#endif
+    }
+
+    Inflater::~Inflater()
+    {
+#if defined(VMS_HAS_ZLIB)
+        if (ok_) {
+            ::inflateEnd(stream_.get());
+        }
+#endif
+    }
+
+    bool Inflater::inflate(std::string_view payload, std::string& out)
+    {
+#if defined(VMS_HAS_ZLIB)
+        if (!ok_) {
+            return false;
+        }
+
+        auto& z = *stream_;
+        z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.data()));
+        z.avail_in = static_cast<uInt>(payload.size());
+        for (;;) {
+            auto used = out.size();
+            out.resize(used + chunkSize);
+            z.next_out = reinterpret_cast<Bytef*>(&out[used]);
+            z.avail_out = static_cast<uInt>(chunkSize);
+
+            auto res = ::inflate(&z, Z_SYNC_FLUSH);
+            out.erase(out.size() - z.avail_out);
+            if ((res != Z_OK) && (res != Z_BUF_ERROR)) {
+                return false;
+            }
+            if (z.avail_out != 0) {
+                // Nothing more to get out of the input.
+                return z.avail_in == 0;
+            }
+        }
+#else
+        (void)payload;
+        (void)out;
+        return false;
+#endif
+    }
+} }
@@ -0,0 +1,210 @@
+#include "Vms/Net/LineScanner.h"
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+# define VMS_SCAN_SSE2
+# include <emmintrin.h>
+#endif
+
+#if defined(VMS_SCAN_SSE2) && defined(__GNUC__)
+# define VMS_SCAN_AVX2
+# include <immintrin.h>
+#endif
+
+namespace Vms { namespace Net
+{
+    namespace
+    {
+#if defined(VMS_SCAN_SSE2)
+        // Where a scan is, carried from block to block.
+        struct ScanState
+        {
+            LineBounds* lines;
+            std::size_t maxLines;
+            std::size_t numLines = 0;
+
+            // First space of the current line, if 'hasSpace'.
+            std::uint32_t space = 0;
+            bool hasSpace = false;
+        };
+
+        // Scans byte by byte from 'pos', false once 'maxLines' are found.
+        inline bool scanBytes(const char* data, std::size_t pos, std::size_t size, ScanState& st)
+        {
+            for (; pos < size; ++pos) {
+                auto c = data[pos];
+                if (c == '\n') {
+                    auto end = static_cast<std::uint32_t>(pos);
+                    st.lines[st.numLines++] = LineBounds{ end, st.hasSpace ? st.space : end };
+                    st.hasSpace = false;
+                    if (st.numLines == st.maxLines) {
+                        return false;
+                    }
+                } else if ((c == ' ') && !st.hasSpace) {
+                    st.space = static_cast<std::uint32_t>(pos);
+                    st.hasSpace = true;
+                }
+            }
+            return true;
+        }
+
+        // Takes the newline and space bitmasks of a block at 'base', bit i = byte base + i.
+        // False once 'maxLines' are found.
+        inline bool scanMasks(std::uint32_t base, std::uint32_t newlines, std::uint32_t spaces, ScanState& st)
+        {
+            while (newlines != 0) {
+                auto bit = static_cast<std::uint32_t>(std::countr_zero(newlines));
+                if (!st.hasSpace) {
+                    auto before = spaces & ((1u << bit) - 1);
+                    if (before != 0) {
+                        st.space = base + static_cast<std::uint32_t>(std::countr_zero(before));
+                        st.hasSpace = true;
+                    }
+                }
+
+                auto end = base + bit;
+                st.lines[st.numLines++] = LineBounds{ end, st.hasSpace ? st.space : end };
+                st.hasSpace = false;
+                if (st.numLines == st.maxLines) {
+                    return false;
+                }
+
+                // Spaces up to the newline belong to the line just taken, 2u << 31 wraps to 0.
+                spaces &= ~((2u << bit) - 1);
+                newlines &= newlines - 1;
+            }
+
+            if (!st.hasSpace && (spaces != 0)) {
+                st.space = base + static_cast<std::uint32_t>(std::countr_zero(spaces));
+                st.hasSpace = true;
+            }
+            return true;
+        }
+#endif
+
+        // memchr() is vectorized by the C library on every platform, the space is searched
+        // for only within the line, i.e. usually just the key.
+        std::size_t scanLinesMemchr(const char* data, std::size_t size, LineBounds* lines, std::size_t maxLines)
+        {
+            std::size_t numLines = 0;
+            std::size_t begin = 0;
+            while ((numLines < maxLines) && (begin < size)) {
+                auto* newline = static_cast<const char*>(std::memchr(data + begin, '\n', size - begin));
+                if (!newline) {
+                    break;
+                }
+                auto end = static_cast<std::uint32_t>(newline - data);
+                auto* space = static_cast<const char*>(std::memchr(data + begin, ' ', end - begin));
+                lines[numLines++] = LineBounds{ end, space ? static_cast<std::uint32_t>(space - data) : end };
+                begin = end + 1;
+            }
+            return numLines;
+        }
+
+#if defined(VMS_SCAN_SSE2)
+        std::size_t scanLinesSse2(const char* data, std::size_t size, LineBounds* lines, std::size_t maxLines)
+        {
+            ScanState st{ lines, maxLines };
+            if (maxLines == 0) {
+                return 0;
+            }
+
+            const auto newline = _mm_set1_epi8('\n');
+            const auto space = _mm_set1_epi8(' ');
+
+            std::size_t pos = 0;
+            for (; pos + 16 <= size; pos += 16) {
+                auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+                auto newlines = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+                auto spaces = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, space)));
+                if (((newlines | spaces) != 0) && !scanMasks(static_cast<std::uint32_t>(pos), newlines, spaces, st)) {
+                    return st.numLines;
+                }
+            }
+
+            scanBytes(data, pos, size, st);
+            return st.numLines;
+        }
+#endif
+
+#if defined(VMS_SCAN_AVX2)
+        __attribute__((target("avx2")))
+        std::size_t scanLinesAvx2(const char* data, std::size_t size, LineBounds* lines, std::size_t maxLines)
+        {
+            ScanState st{ lines, maxLines };
+            if (maxLines == 0) {
+                return 0;
+            }
+
+            const auto newline = _mm256_set1_epi8('\n');
+            const auto space = _mm256_set1_epi8(' ');
+
+            std::size_t pos = 0;
+            for (; pos + 32 <= size; pos += 32) {
+                auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+                auto newlines = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)));
+                auto spaces = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, space)));
+                if (((newlines | spaces) != 0) && !scanMasks(static_cast<std::uint32_t>(pos), newlines, spaces, st)) {
+                    return st.numLines;
+                }
+            }
+
+            scanBytes(data, pos, size, st);
+            return st.numLines;
+        }
+#endif
+
+        struct Scanner
+        {
+            const char* name;
+            ScanLinesFn fn;
+        };
+
+        Scanner pickScanner()
+        {
+            // Both SIMD scans beat memchr(), SSE2 only barely, see vmsbench --bench linescan.
+#if defined(VMS_SCAN_AVX2)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) {
+                return Scanner{ "avx2", &scanLinesAvx2 };
+            }
+#endif
+#if defined(VMS_SCAN_SSE2)
+            return Scanner{ "sse2", &scanLinesSse2 };
+#else
+            return Scanner{ "memchr", &scanLinesMemchr };
+#endif
+        }
+
+        const Scanner scanner = pickScanner();
+    }
+
+    std::size_t scanLines(const char* data, std::size_t size, LineBounds* lines, std::size_t maxLines)
+    {
+        return scanner.fn(data, size, lines, maxLines);
+    }
+
+    const char* lineScannerName()
+    {
+        return scanner.name;
+    }
+
+    ScanLinesFn lineScanner(const char* name)
+    {
+        if (std::strcmp(name, "memchr") == 0) {
+            return &scanLinesMemchr;
+        }
+#if defined(VMS_SCAN_SSE2)
+        if (std::strcmp(name, "sse2") == 0) {
+            return &scanLinesSse2;
+        }
+#endif
+#if defined(VMS_SCAN_AVX2)
+        if ((std::strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+            return &scanLinesAvx2;
+        }
+#endif
+        return nullptr;
+    }
+} }
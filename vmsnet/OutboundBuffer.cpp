@@ -0,0 +1,104 @@
+#include "Vms/Net/OutboundBuffer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Vms { namespace Net
+{
+    OutboundBuffer::OutboundBuffer(std::size_t initialCapacity)
+    : initialCapacity_(std::max<std::size_t>(initialCapacity, 64)),
+      data_(new char[initialCapacity_]),
+      capacity_(initialCapacity_)
+    {
+    }
+
+    void OutboundBuffer::append(std::string_view data)
+    {
+        if (size_ + data.size() > capacity_) {
+            grow(size_ + data.size());
+        }
+
+        auto tail = (head_ + size_) % capacity_;
+        auto first = std::min(data.size(), capacity_ - tail);
+        std::memcpy(&data_[tail], data.data(), first);
+        std::memcpy(&data_[0], data.data() + first, data.size() - first);
+        size_ += data.size();
+    }
+
+    OutboundBuffer::ConstBuffers OutboundBuffer::data(std::size_t maxBytes) const
+    {
+        auto n = std::min(size_, maxBytes);
+        auto first = std::min(n, capacity_ - head_);
+        return ConstBuffers{
+            boost::asio::const_buffer(&data_[head_], first),
+            boost::asio::const_buffer(&data_[0], n - first)
+        };
+    }
+
+    void OutboundBuffer::consume(std::size_t n)
+    {
+        n = std::min(n, size_);
+        head_ = (head_ + n) % capacity_;
+        size_ -= n;
+
+        retired_.clear();
+
+        if (size_ == 0) {
+            head_ = 0;
+            // Don't hold on to what a burst needed.
+            if (capacity_ > initialCapacity_ * 4) {
+                data_.reset(new char[initialCapacity_]);
+                capacity_ = initialCapacity_;
+            }
+        }
+    }
+
+    std::size_t OutboundBuffer::peek(std::size_t pos, char* out, std::size_t n) const
+    {
+        if (pos >= size_) {
+            return 0;
+        }
+        n = std::min(n, size_ - pos);
+        auto offset = (head_ + pos) % capacity_;
+        auto first = std::min(n, capacity_ - offset);
+        std::memcpy(out, &data_[offset], first);
+        std::memcpy(out + first, &data_[0], n - first);
+        return n;
+    }
+
+    std::size_t OutboundBuffer::find(char c, std::size_t pos) const
+    {
+        while (pos < size_) {
+            auto offset = (head_ + pos) % capacity_;
+            auto n = std::min(size_ - pos, capacity_ - offset);
+            auto* found = static_cast<const char*>(std::memchr(&data_[offset], c, n));
+            if (found) {
+                return pos + static_cast<std::size_t>(found - &data_[offset]);
+            }
+            pos += n;
+        }
+        return size_;
+    }
+
+    void OutboundBuffer::truncate(std::size_t n)
+    {
+        size_ = std::min(size_, n);
+    }
+
+    void OutboundBuffer::grow(std::size_t minCapacity)
+    {
+        auto capacity = capacity_;
+        while (capacity < minCapacity) {
+            capacity *= 2;
+        }
+
+        std::unique_ptr<char[]> data(new char[capacity]);
+        auto first = std::min(size_, capacity_ - head_);
+        std::memcpy(&data[0], &data_[head_], first);
+        std::memcpy(&data[first], &data_[0], size_ - first);
+
+        retired_.push_back(std::move(data_));
+        data_ = std::move(data);
+        capacity_ = capacity;
+        head_ = 0;
+    }
+} }
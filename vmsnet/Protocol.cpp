@@ -0,0 +1,255 @@
+#include "Vms/Net/Protocol.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace Vms { namespace Net
+{
+    namespace
+    {
+        const char helloMagic[] = { 'V', 'M', 'S' };
+
+        // Max. bytes of a 64-bit varint.
+        const std::size_t maxVarintSize = 10;
+
+        std::size_t varintSize(std::uint64_t value)
+        {
+            std::size_t n = 1;
+            while (value >= 0x80) {
+                value >>= 7;
+                ++n;
+            }
+            return n;
+        }
+
+        void appendFrameHeader(std::string& out, FrameType type, std::size_t payloadSize)
+        {
+            appendVarint(out, payloadSize + 1);
+            out.push_back(static_cast<char>(type));
+        }
+
+        // Bytes of 'hash' on the wire.
+        std::size_t hashSize(std::uint32_t hash, bool trim)
+        {
+            std::size_t n = sizeof(hash);
+            if (trim) {
+                while ((n > 0) && ((hash >> (8 * (n - 1))) == 0)) {
+                    --n;
+                }
+            }
+            return n;
+        }
+
+        // Little-endian, the high zero bytes may be missing.
+        void appendHash(std::string& out, std::uint32_t hash, std::size_t size)
+        {
+            for (std::size_t i = 0; i < size; ++i) {
+                out.push_back(static_cast<char>((hash >> (8 * i)) & 0xFF));
+            }
+        }
+
+        bool parseHashBytes(std::string_view data, std::uint32_t& hash)
+        {
+            if (data.size() > sizeof(hash)) {
+                return false;
+            }
+            hash = 0;
+            for (std::size_t i = 0; i < data.size(); ++i) {
+                hash |= static_cast<std::uint32_t>(static_cast<std::uint8_t>(data[i])) << (8 * i);
+            }
+            return true;
+        }
+
+        bool parseId(std::string_view& payload, std::uint32_t& id)
+        {
+            std::uint64_t value;
+            std::size_t used;
+            if ((parseVarint(payload.data(), payload.size(), value, used) != ParseResult::Ok) ||
+                (value > UINT32_MAX)) {
+                return false;
+            }
+            id = static_cast<std::uint32_t>(value);
+            payload.remove_prefix(used);
+            return true;
+        }
+    }
+
+    void appendVarint(std::string& out, std::uint64_t value)
+    {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    ParseResult parseVarint(const char* data, std::size_t size, std::uint64_t& value, std::size_t& used)
+    {
+        value = 0;
+        for (std::size_t i = 0; i < maxVarintSize; ++i) {
+            if (i == size) {
+                return ParseResult::NeedMore;
+            }
+            auto byte = static_cast<std::uint8_t>(data[i]);
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << (7 * i);
+            if ((byte & 0x80) == 0) {
+                used = i + 1;
+                return ParseResult::Ok;
+            }
+        }
+        return ParseResult::Invalid;
+    }
+
+    void appendHello(std::string& out, std::uint8_t features)
+    {
+        out.push_back('\0');
+        appendFrameHeader(out, FrameHello, sizeof(helloMagic) + 2);
+        out.append(helloMagic, sizeof(helloMagic));
+        out.push_back(static_cast<char>(protocolVersion));
+        out.push_back(static_cast<char>(features));
+    }
+
+    ParseResult parseHello(const char* data, std::size_t size, std::uint8_t& features)
+    {
+        std::string expected;
+        appendHello(expected, 0);
+
+        // All but the features byte.
+        auto n = std::min(size, helloSize - 1);
+        if (std::memcmp(data, expected.data(), n) != 0) {
+            return ParseResult::Invalid;
+        }
+        if (size < helloSize) {
+            return ParseResult::NeedMore;
+        }
+        features = static_cast<std::uint8_t>(data[helloSize - 1]);
+        return ParseResult::Ok;
+    }
+
+    ParseResult parseFrame(const char* data, std::size_t size, std::size_t maxSize, Frame& frame)
+    {
+        std::uint64_t length;
+        std::size_t used;
+        auto res = parseVarint(data, size, length, used);
+        if (res != ParseResult::Ok) {
+            return res;
+        }
+        if ((length > maxSize) || (used + length > maxSize)) {
+            return ParseResult::Invalid;
+        }
+        if (used + length > size) {
+            return ParseResult::NeedMore;
+        }
+        if (length == 0) {
+            frame.type = FrameEmpty;
+            frame.payload = std::string_view();
+        } else {
+            frame.type = static_cast<FrameType>(data[used]);
+            frame.payload = std::string_view(data + used + 1, static_cast<std::size_t>(length - 1));
+        }
+        frame.size = used + static_cast<std::size_t>(length);
+        return ParseResult::Ok;
+    }
+
+    void appendUpdateFrame(std::string& out, std::string_view key, std::string_view value)
+    {
+        appendFrameHeader(out, FrameUpdate, varintSize(key.size()) + key.size() + value.size());
+        appendVarint(out, key.size());
+        out.append(key).append(value);
+    }
+
+    bool parseUpdate(std::string_view payload, std::string_view& key, std::string_view& value)
+    {
+        std::uint64_t keyLength;
+        std::size_t used;
+        if ((parseVarint(payload.data(), payload.size(), keyLength, used) != ParseResult::Ok) ||
+            (keyLength > payload.size() - used)) {
+            return false;
+        }
+        key = payload.substr(used, static_cast<std::size_t>(keyLength));
+        value = payload.substr(used + static_cast<std::size_t>(keyLength));
+        return true;
+    }
+
+    void appendHashFrame(std::string& out, std::string_view key, std::uint32_t hash)
+    {
+        appendFrameHeader(out, FrameHash, varintSize(key.size()) + key.size() + sizeof(hash));
+        appendVarint(out, key.size());
+        out.append(key);
+        appendHash(out, hash, sizeof(hash));
+    }
+
+    bool parseHash(std::string_view payload, std::string_view& key, std::uint32_t& hash)
+    {
+        std::uint64_t keyLength;
+        std::size_t used;
+        if ((parseVarint(payload.data(), payload.size(), keyLength, used) != ParseResult::Ok) ||
+            (payload.size() - used < sizeof(hash)) || (keyLength != payload.size() - used - sizeof(hash))) {
+            return false;
+        }
+        key = payload.substr(used, static_cast<std::size_t>(keyLength));
+        return parseHashBytes(payload.substr(used + static_cast<std::size_t>(keyLength)), hash);
+    }
+
+    void appendMessageFrame(std::string& out, std::string_view text)
+    {
+        appendFrameHeader(out, FrameMessage, text.size());
+        out.append(text);
+    }
+
+    void appendKeyHashFrame(std::string& out, std::uint32_t id, std::string_view key, std::uint32_t hash, bool trim)
+    {
+        auto n = hashSize(hash, trim);
+        appendFrameHeader(out, FrameKeyHash, varintSize(id) + varintSize(key.size()) + key.size() + n);
+        appendVarint(out, id);
+        appendVarint(out, key.size());
+        out.append(key);
+        appendHash(out, hash, n);
+    }
+
+    bool parseKeyHash(std::string_view payload, std::uint32_t& id, std::string_view& key, std::uint32_t& hash)
+    {
+        std::uint64_t keyLength;
+        std::size_t used;
+        if (!parseId(payload, id) ||
+            (parseVarint(payload.data(), payload.size(), keyLength, used) != ParseResult::Ok) ||
+            (keyLength > payload.size() - used)) {
+            return false;
+        }
+        key = payload.substr(used, static_cast<std::size_t>(keyLength));
+        return parseHashBytes(payload.substr(used + static_cast<std::size_t>(keyLength)), hash);
+    }
+
+    void appendIdHashFrame(std::string& out, std::uint32_t id, std::uint32_t hash, bool trim)
+    {
+        auto n = hashSize(hash, trim);
+        appendFrameHeader(out, FrameIdHash, varintSize(id) + n);
+        appendVarint(out, id);
+        appendHash(out, hash, n);
+    }
+
+    bool parseIdHash(std::string_view payload, std::uint32_t& id, std::uint32_t& hash)
+    {
+        return parseId(payload, id) && parseHashBytes(payload, hash);
+    }
+
+    void appendKeyResetFrame(std::string& out)
+    {
+        appendFrameHeader(out, FrameKeyReset, 0);
+    }
+
+    void appendCompressedFrame(std::string& out, std::string_view payload)
+    {
+        appendFrameHeader(out, FrameCompressed, payload.size());
+        out.append(payload);
+    }
+
+    void appendHashLine(std::string& out, std::string_view key, std::uint32_t hash)
+    {
+        char buf[16];
+        out.reserve(out.size() + key.size() + sizeof(buf));
+        out.append(key).append(1, ' ');
+        out.append(buf, std::to_chars(buf, buf + sizeof(buf), hash).ptr);
+        out.push_back('\n');
+    }
+} }
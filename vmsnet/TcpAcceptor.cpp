@@ -1,19 +1,69 @@
 #include "Vms/Net/TcpAcceptor.h"
 #include "Vms/Core/Logger.h"
 #include <boost/asio/bind_executor.hpp>
+#include <boost/asio/post.hpp>
+#if defined(__linux__)
+#include <cerrno>
+#include <unistd.h>
+#endif
 
 #define _FN "Net"
 
+namespace
+{
+#if defined(SO_REUSEPORT)
+    using ReusePort = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+#if defined(SO_BUSY_POLL)
+    using BusyPoll = boost::asio::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL>;
+#endif
+}
+
 namespace Vms { namespace Net
 {
+    // Forwards the completions of the multishot accept onto the acceptor's strand.
+    class TcpAcceptor::MultishotAccept final : public Uring::Operation
+    {
+    public:
+        explicit MultishotAccept(std::shared_ptr<TcpAcceptor> acceptor) : acceptor_(std::move(acceptor)) {}
+
+        void complete(int res, std::uint32_t flags) override
+        {
+            bool more = Uring::hasMore(flags);
+            auto acceptor = acceptor_;
+            boost::asio::post(*acceptor->strand_, [acceptor, res, more]() {
+                acceptor->onMultishotAccept(res, more);
+            });
+            if (!more) {
+                destroy();
+            }
+        }
+
+        void destroy() override
+        {
+            delete this;
+        }
+
+    private:
+        ~MultishotAccept() = default;
+
+        std::shared_ptr<TcpAcceptor> acceptor_;
+    };
+
     TcpAcceptor::TcpAcceptor(boost::asio::io_service& ioService, const boost::asio::ip::tcp& protocol)
     : ioService_(ioService),
       strand_(Core::makeStrand(ioService_)),
-      acceptor_(ioService_, protocol)
+      protocol_(protocol),
+      acceptor_(ioService_, protocol),
+      acceptSignal_(ioService_, boost::asio::steady_timer::time_point::max()),
+      uring_(Uring::get(ioService_))
     {
     }
 
-    std::error_code TcpAcceptor::bind(const boost::asio::ip::tcp::endpoint& endpoint, boost::asio::ip::tcp::endpoint& boundEndpoint)
+    TcpAcceptor::~TcpAcceptor() = default;
+
+    std::error_code TcpAcceptor::bind(const boost::asio::ip::tcp::endpoint& endpoint, boost::asio::ip::tcp::endpoint& boundEndpoint,
+        bool reusePort)
     {
         boost::system::error_code ec;
         acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), ec);
@@ -21,6 +71,17 @@ namespace Vms { namespace Net
             return ec;
         }
 
+        if (reusePort) {
+#if defined(SO_REUSEPORT)
+            acceptor_.set_option(ReusePort(true), ec);
+            if (ec) {
+                return ec;
+            }
+#else
+            return std::make_error_code(std::errc::operation_not_supported);
+#endif
+        }
+
         acceptor_.bind(endpoint, ec);
         if (ec) {
             return ec;
@@ -32,6 +93,20 @@ namespace Vms { namespace Net
     }
 
     std::error_code TcpAcceptor::listen(std::uint32_t backlog, AcceptFn cb)
+    {
+        auto ec = listen(backlog);
+        if (ec) {
+            return ec;
+        }
+
+        cb_ = std::move(cb);
+
+        boost::asio::dispatch(*strand_, std::bind(&TcpAcceptor::armAccepts, shared_from_this()));
+
+        return std::error_code{};
+    }
+
+    std::error_code TcpAcceptor::listen(std::uint32_t backlog)
     {
         boost::system::error_code ec;
         acceptor_.set_option(boost::asio::ip::tcp::no_delay(true), ec);
@@ -44,45 +119,225 @@ namespace Vms { namespace Net
             return ec;
         }
 
-        acceptor_.async_accept(boost::asio::bind_executor(*strand_,
-            std::bind(&TcpAcceptor::onAccept, shared_from_this(), std::placeholders::_1, std::placeholders::_2, std::move(cb))));
+        // For drainBacklog(), async_accept() isn't affected.
+        acceptor_.non_blocking(true, ec);
+        if (ec) {
+            return ec;
+        }
+
+        acceptMemory_.reset(new Core::HandlerMemory[numAccepts_]);
+        armed_.assign(numAccepts_, false);
 
         return std::error_code{};
     }
 
+    Core::Awaitable<std::error_code> TcpAcceptor::accept(boost::asio::ip::tcp::socket& socket)
+    {
+        strand_runtime_assert(strand_);
+
+        boost::system::error_code ec;
+
+        for (;;) {
+            if (!acceptor_.is_open()) {
+                co_return boost::system::error_code(boost::asio::error::operation_aborted);
+            }
+
+            if (!accepted_.empty()) {
+                socket = std::move(accepted_.front());
+                accepted_.pop_front();
+                co_return std::error_code{};
+            }
+
+            if (acceptError_) {
+                std::error_code err;
+                std::swap(err, acceptError_);
+                co_return err;
+            }
+
+            armAccepts();
+
+            // Woken up by deliver() or stop().
+            co_await acceptSignal_.async_wait(boost::asio::redirect_error(Core::useAwaitable, ec));
+        }
+    }
+
     void TcpAcceptor::stop()
     {
         auto sharedThis = shared_from_this();
         boost::asio::dispatch(*strand_, [sharedThis]() {
             strand_assert(sharedThis->strand_);
 
+            if (sharedThis->multishotOp_) {
+                sharedThis->uring_->cancel(sharedThis->multishotOp_);
+                sharedThis->uring_->cancelQueued(sharedThis->acceptor_.native_handle());
+            }
+
             boost::system::error_code ec;
             sharedThis->acceptor_.close(ec);
+            sharedThis->accepted_.clear();
+            sharedThis->acceptSignal_.cancel();
         });
     }
 
-    void TcpAcceptor::onAccept(const std::error_code& err, boost::asio::ip::tcp::socket socket, AcceptFn cb)
+    void TcpAcceptor::armAccepts()
     {
         strand_runtime_assert(strand_);
 
-        if (err) {
-            if (err != boost::system::error_code(boost::asio::error::operation_aborted)) {
-                VMS_LOG_ERROR(_FN, "TcpAcceptor: accept failed: " << err.message());
+        if (!acceptor_.is_open()) {
+            return;
+        }
+
+        if (uring_) {
+            if (!multishotOp_) {
+                multishotOp_ = new MultishotAccept(shared_from_this());
+                uring_->acceptMultishot(acceptor_.native_handle(), multishotOp_);
+            }
+            return;
+        }
+
+        for (std::size_t slot = 0; slot < armed_.size(); ++slot) {
+            if (!armed_[slot]) {
+                doAccept(slot);
+            }
+        }
+    }
+
+    void TcpAcceptor::onMultishotAccept(int res, bool more)
+    {
+        strand_runtime_assert(strand_);
+
+        if (!more) {
+            multishotOp_ = nullptr;
+        }
+
+        if (res >= 0) {
+            if (acceptor_.is_open()) {
+                boost::asio::ip::tcp::socket socket(ioService_);
+                boost::system::error_code ec;
+                socket.assign(protocol_, res, ec);
+                if (ec) {
+#if defined(__linux__)
+                    ::close(res);
+#endif
+                    VMS_LOG_ERROR_LIMITED(_FN, 10, "TcpAcceptor: accept failed: " << ec.message());
+                    acceptError_ = ec;
+                } else {
+                    setupSocket(socket);
+                    accepted_.push_back(std::move(socket));
+                }
             } else {
+#if defined(__linux__)
+                ::close(res);
+#endif
+            }
+#if defined(__linux__)
+        } else if (res == -EINVAL) {
+            // Multishot accept needs Linux 5.19+, accept through asio instead.
+            VMS_LOG_WARN(_FN, "TcpAcceptor: multishot accept not supported, falling back to epoll");
+            uring_ = nullptr;
+            armAccepts();
+        } else if (res != -ECANCELED) {
+#else
+        } else {
+#endif
+            acceptError_ = std::error_code(-res, std::system_category());
+            VMS_LOG_ERROR_LIMITED(_FN, 10, "TcpAcceptor: accept failed: " << acceptError_.message());
+        }
+
+        if (!more && uring_ && acceptor_.is_open()) {
+            // The kernel ended the multishot accept, i.e. on an error.
+            armAccepts();
+        }
+
+        deliver();
+    }
+
+    void TcpAcceptor::doAccept(std::size_t slot)
+    {
+        strand_runtime_assert(strand_);
+
+        armed_[slot] = true;
+        acceptor_.async_accept(boost::asio::bind_executor(*strand_, Core::makeAllocHandler(acceptMemory_[slot],
+            std::bind(&TcpAcceptor::onAccept, shared_from_this(), slot, std::placeholders::_1, std::placeholders::_2))));
+    }
+
+    void TcpAcceptor::onAccept(std::size_t slot, const std::error_code& err, boost::asio::ip::tcp::socket socket)
+    {
+        strand_runtime_assert(strand_);
+
+        armed_[slot] = false;
+
+        if (err) {
+            if (err == boost::system::error_code(boost::asio::error::operation_aborted)) {
                 // TcpAcceptor stopped, don't accept again.
                 return;
             }
+            VMS_LOG_ERROR_LIMITED(_FN, 10, "TcpAcceptor: accept failed: " << err.message());
+            acceptError_ = err;
         } else {
+            setupSocket(socket);
+            accepted_.push_back(std::move(socket));
+            drainBacklog();
+        }
+
+        // Re-armed before the connections are handed out.
+        if (acceptor_.is_open()) {
+            doAccept(slot);
+        }
+
+        deliver();
+    }
+
+    void TcpAcceptor::drainBacklog()
+    {
+        for (std::uint32_t i = 0; i < maxDrain; ++i) {
+            boost::asio::ip::tcp::socket socket(ioService_);
             boost::system::error_code ec;
-            socket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+            acceptor_.accept(socket, ec);
             if (ec) {
-                VMS_LOG_WARN(_FN, "TcpAcceptor: cannot set TCP_NODELAY: " << ec.message());
+                // would_block once the backlog is empty, anything else shows up
+                // on the async_accept.
+                break;
             }
+            setupSocket(socket);
+            accepted_.push_back(std::move(socket));
+        }
+    }
 
-            cb(std::move(socket));
+    void TcpAcceptor::deliver()
+    {
+        if (!cb_) {
+            if (!accepted_.empty() || acceptError_) {
+                acceptSignal_.cancel();
+            }
+            return;
         }
 
-        acceptor_.async_accept(boost::asio::bind_executor(*strand_,
-            std::bind(&TcpAcceptor::onAccept, shared_from_this(), std::placeholders::_1, std::placeholders::_2, std::move(cb))));
+        acceptError_ = std::error_code{};
+        while (!accepted_.empty()) {
+            auto socket = std::move(accepted_.front());
+            accepted_.pop_front();
+            cb_(std::move(socket));
+        }
+    }
+
+    void TcpAcceptor::setupSocket(boost::asio::ip::tcp::socket& socket)
+    {
+        boost::system::error_code ec;
+        socket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+        if (ec) {
+            VMS_LOG_WARN(_FN, "TcpAcceptor: cannot set TCP_NODELAY: " << ec.message());
+        }
+
+        if (busyPoll_.count() > 0) {
+#if defined(SO_BUSY_POLL)
+            socket.set_option(BusyPoll(static_cast<int>(busyPoll_.count())), ec);
+#else
+            ec = boost::asio::error::operation_not_supported;
+#endif
+            if (ec) {
+                VMS_LOG_WARN(_FN, "TcpAcceptor: cannot set SO_BUSY_POLL: " << ec.message());
+            }
+        }
     }
 } }
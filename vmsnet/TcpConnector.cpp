@@ -1,6 +1,7 @@
 #include "Vms/Net/TcpConnector.h"
 #include "Vms/Core/TimedTask.h"
 #include <boost/asio/bind_executor.hpp>
+#include <boost/asio/co_spawn.hpp>
 
 namespace Vms { namespace Net
 {
@@ -72,6 +73,43 @@ namespace Vms { namespace Net
             boost::asio::ip::tcp::socket connection_;
             TcpConnector::ConnectFn cb_;
         };
+
+        // Runs on the connector's strand, so the timeout can't race with the connect completion.
+        Core::Awaitable<std::error_code> connectOnStrand(boost::asio::io_service& ioService,
+            Core::StrandPtr strand,
+            boost::asio::ip::tcp::endpoint endpoint,
+            std::chrono::steady_clock::duration timeout,
+            boost::asio::ip::tcp::socket& socket)
+        {
+            auto connection = std::make_shared<boost::asio::ip::tcp::socket>(ioService);
+            auto timedTask = std::make_shared<Core::TimedTask>(ioService, strand);
+            auto timedOut = std::make_shared<bool>(false);
+
+            timedTask->schedule([connection, timedOut]() {
+                *timedOut = true;
+                boost::system::error_code ec;
+                connection->close(ec);
+            }, timeout);
+
+            boost::system::error_code ec;
+            co_await connection->async_connect(endpoint, boost::asio::redirect_error(Core::useAwaitable, ec));
+
+            timedTask->cancel();
+
+            if (*timedOut) {
+                co_return boost::system::error_code(boost::asio::error::timed_out);
+            }
+
+            if (ec) {
+                boost::system::error_code err;
+                connection->close(err);
+                co_return ec;
+            }
+
+            socket = std::move(*connection);
+
+            co_return std::error_code{};
+        }
     }
 
     TcpConnector::TcpConnector(boost::asio::io_service& ioService,
@@ -89,4 +127,10 @@ namespace Vms { namespace Net
         auto op = std::make_shared<ConnectOperation>(ioService_, strand_, std::move(cb));
         op->start(endpoint_, timeout_);
     }
+
+    Core::Awaitable<std::error_code> TcpConnector::connect(boost::asio::ip::tcp::socket& socket)
+    {
+        co_return co_await boost::asio::co_spawn(*strand_,
+            connectOnStrand(ioService_, strand_, endpoint_, timeout_, socket), Core::useAwaitable);
+    }
 } }
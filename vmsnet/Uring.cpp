@@ -0,0 +1,725 @@
+#include "Vms/Net/Uring.h"
+#include "Vms/Core/Logger.h"
+#include <boost/asio/post.hpp>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#if defined(VMS_HAS_IO_URING)
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#endif
+
+#define _FN "Net"
+
+namespace Vms { namespace Net
+{
+    boost::asio::execution_context::id Uring::id;
+
+    namespace
+    {
+        struct DestroyOp
+        {
+            void operator()(Uring::Operation* op) const { op->destroy(); }
+        };
+
+        // For operations that fail before getting to the ring. Posted, so that the handler
+        // never runs inside the initiating function, 'op' is destroyed instead if the
+        // io_service never gets to it.
+        void completeLater(boost::asio::io_service& ioService, Uring::Operation* op, int res)
+        {
+            std::unique_ptr<Uring::Operation, DestroyOp> guard(op);
+            boost::asio::post(ioService, [guard = std::move(guard), res]() mutable {
+                guard.release()->complete(res, 0);
+            });
+        }
+    }
+
+#if defined(VMS_HAS_IO_URING)
+    namespace
+    {
+        inline int sysSetup(unsigned entries, io_uring_params* p)
+        {
+            return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+        }
+
+        inline int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+        {
+            return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+        }
+
+        inline int sysRegister(int fd, unsigned opcode, const void* arg, unsigned numArgs)
+        {
+            return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, numArgs));
+        }
+
+        template <class T>
+        inline T* at(void* base, std::uint32_t offset)
+        {
+            return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+        }
+
+        inline std::error_code lastError()
+        {
+            return std::error_code(errno, std::system_category());
+        }
+    }
+
+    struct Uring::Ring
+    {
+        explicit Ring(boost::asio::io_service& ioService)
+        : eventFd(ioService)
+        {
+        }
+
+        ~Ring()
+        {
+            boost::system::error_code ec;
+            eventFd.close(ec);
+            if (sqes) {
+                ::munmap(sqes, sqesSize);
+            }
+            if (cqPtr && (cqPtr != sqPtr)) {
+                ::munmap(cqPtr, cqSize);
+            }
+            if (sqPtr) {
+                ::munmap(sqPtr, sqSize);
+            }
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            std::free(fixedBuffers);
+        }
+
+        std::error_code setup(std::uint32_t entries, std::uint32_t numFixedBuffers, std::size_t fixedBufferSize)
+        {
+            io_uring_params p;
+            std::memset(&p, 0, sizeof(p));
+            p.flags = IORING_SETUP_CLAMP;
+
+            fd = sysSetup(entries, &p);
+            if (fd < 0) {
+                return (errno == ENOSYS) ? std::make_error_code(std::errc::operation_not_supported) : lastError();
+            }
+
+            if (!(p.features & IORING_FEAT_NODROP)) {
+                return std::make_error_code(std::errc::operation_not_supported);
+            }
+
+            sqSize = p.sq_off.array + p.sq_entries * sizeof(std::uint32_t);
+            cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            bool singleMmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (singleMmap) {
+                sqSize = cqSize = std::max(sqSize, cqSize);
+            }
+
+            sqPtr = ::mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sqPtr == MAP_FAILED) {
+                sqPtr = nullptr;
+                return lastError();
+            }
+            if (singleMmap) {
+                cqPtr = sqPtr;
+            } else {
+                cqPtr = ::mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                if (cqPtr == MAP_FAILED) {
+                    cqPtr = nullptr;
+                    return lastError();
+                }
+            }
+            sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+            void* sqesPtr = ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (sqesPtr == MAP_FAILED) {
+                return lastError();
+            }
+            sqes = static_cast<io_uring_sqe*>(sqesPtr);
+
+            sqHead = at<std::uint32_t>(sqPtr, p.sq_off.head);
+            sqTail = at<std::uint32_t>(sqPtr, p.sq_off.tail);
+            sqMask = *at<std::uint32_t>(sqPtr, p.sq_off.ring_mask);
+            sqEntries = *at<std::uint32_t>(sqPtr, p.sq_off.ring_entries);
+            sqFlags = at<std::uint32_t>(sqPtr, p.sq_off.flags);
+            sqArray = at<std::uint32_t>(sqPtr, p.sq_off.array);
+            cqHead = at<std::uint32_t>(cqPtr, p.cq_off.head);
+            cqTail = at<std::uint32_t>(cqPtr, p.cq_off.tail);
+            cqMask = *at<std::uint32_t>(cqPtr, p.cq_off.ring_mask);
+            cqes = at<io_uring_cqe>(cqPtr, p.cq_off.cqes);
+            sqLocalTail = *sqTail;
+
+            int efd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            if (efd < 0) {
+                return lastError();
+            }
+            boost::system::error_code ec;
+            eventFd.assign(efd, ec);
+            if (ec) {
+                ::close(efd);
+                return ec;
+            }
+            if (sysRegister(fd, IORING_REGISTER_EVENTFD, &efd, 1) < 0) {
+                return lastError();
+            }
+
+            if ((numFixedBuffers > 0) && (fixedBufferSize > 0)) {
+                // Registered buffers are optional, i.e. they may not fit into RLIMIT_MEMLOCK on older kernels.
+                fixedBufferSize = (fixedBufferSize + 4095) & ~std::size_t(4095);
+                fixedBuffers = static_cast<char*>(std::aligned_alloc(4096, numFixedBuffers * fixedBufferSize));
+                std::vector<iovec> iovecs(numFixedBuffers);
+                for (std::uint32_t i = 0; i < numFixedBuffers; ++i) {
+                    iovecs[i].iov_base = fixedBuffers + i * fixedBufferSize;
+                    iovecs[i].iov_len = fixedBufferSize;
+                }
+                if (fixedBuffers && (sysRegister(fd, IORING_REGISTER_BUFFERS, iovecs.data(), numFixedBuffers) == 0)) {
+                    this->fixedBufferSize = fixedBufferSize;
+                    freeFixedBuffers.reserve(numFixedBuffers);
+                    for (std::uint32_t i = numFixedBuffers; i > 0; --i) {
+                        freeFixedBuffers.push_back(static_cast<int>(i - 1));
+                    }
+                } else {
+                    VMS_LOG_WARN(_FN, "Uring: cannot register buffers: " << lastError().message());
+                    std::free(fixedBuffers);
+                    fixedBuffers = nullptr;
+                }
+            }
+
+            return std::error_code{};
+        }
+
+        // Must be called with 'mtx' held, returns nullptr if the ring is full even after submitting.
+        io_uring_sqe* getSqe()
+        {
+            if (sqLocalTail - std::atomic_ref<std::uint32_t>(*sqHead).load(std::memory_order_acquire) >= sqEntries) {
+                submit();
+                if (sqLocalTail - std::atomic_ref<std::uint32_t>(*sqHead).load(std::memory_order_acquire) >= sqEntries) {
+                    return nullptr;
+                }
+            }
+            auto index = sqLocalTail & sqMask;
+            sqArray[index] = index;
+            auto* sqe = &sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            return sqe;
+        }
+
+        // Must be called with 'mtx' held after filling in the SQE returned by getSqe().
+        void publish(Operation* op)
+        {
+            if (op) {
+                track(op);
+            }
+            ++sqLocalTail;
+            std::atomic_ref<std::uint32_t>(*sqTail).store(sqLocalTail, std::memory_order_release);
+            ++toSubmit;
+        }
+
+        // Must be called with 'mtx' held.
+        void submit()
+        {
+            while (toSubmit > 0) {
+                int res = sysEnter(fd, toSubmit, 0, 0);
+                if (res < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    // EAGAIN/EBUSY, i.e. the kernel is short of memory or CQ overflow backlog, retry on next flush.
+                    VMS_LOG_WARN(_FN, "Uring: io_uring_enter failed: " << lastError().message());
+                    return;
+                }
+                ++stats.numEnters;
+                stats.numSubmitted += static_cast<std::uint32_t>(res);
+                toSubmit -= static_cast<std::uint32_t>(res);
+                if (res == 0) {
+                    return;
+                }
+            }
+        }
+
+        // Completes the operations of all the CQEs available, 'batch' is scratch space.
+        // Called by the reaper and right after submitting, i.e. sends to a socket with enough
+        // buffer space are usually done by the time io_uring_enter() returns, there's no
+        // need to wait for the eventfd to get through epoll for them.
+        void reap(std::vector<io_uring_cqe>& batch)
+        {
+            for (;;) {
+                batch.clear();
+                {
+                    // CQEs are copied out first, completions may submit more operations.
+                    std::unique_lock<std::mutex> cqLock(cqMtx, std::try_to_lock);
+                    if (!cqLock) {
+                        // Somebody else is reaping, they'll see the new CQEs too.
+                        return;
+                    }
+                    batch.swap(held);
+                    takeCqes(batch);
+                    if (batch.empty()) {
+                        return;
+                    }
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    for (auto& cqe : batch) {
+                        auto* op = reinterpret_cast<Operation*>(static_cast<std::uintptr_t>(cqe.user_data));
+                        if (op && !(cqe.flags & IORING_CQE_F_MORE)) {
+                            remove(op);
+                            if (op->fixedBuffer_ >= 0) {
+                                freeFixedBuffers.push_back(op->fixedBuffer_);
+                                op->fixedBuffer_ = -1;
+                            }
+                        }
+                    }
+                }
+
+                for (auto& cqe : batch) {
+                    auto* op = reinterpret_cast<Operation*>(static_cast<std::uintptr_t>(cqe.user_data));
+                    if (op) {
+                        op->complete(cqe.res, cqe.flags);
+                    }
+                }
+            }
+        }
+
+        // Appends the CQEs available to 'batch', flushing the ones the kernel held back
+        // because they didn't fit into the CQ. Must be called with 'cqMtx' held.
+        void takeCqes(std::vector<io_uring_cqe>& batch)
+        {
+            for (;;) {
+                auto head = *cqHead;
+                auto tail = std::atomic_ref<std::uint32_t>(*cqTail).load(std::memory_order_acquire);
+                if (head == tail) {
+                    if (std::atomic_ref<std::uint32_t>(*sqFlags).load(std::memory_order_relaxed) & IORING_SQ_CQ_OVERFLOW) {
+                        sysEnter(fd, 0, 0, IORING_ENTER_GETEVENTS);
+                        if (*cqHead != std::atomic_ref<std::uint32_t>(*cqTail).load(std::memory_order_acquire)) {
+                            continue;
+                        }
+                    }
+                    return;
+                }
+                for (; head != tail; ++head) {
+                    batch.push_back(cqes[head & cqMask]);
+                }
+                std::atomic_ref<std::uint32_t>(*cqHead).store(head, std::memory_order_release);
+            }
+        }
+
+        // Moves the CQEs available to 'held', i.e. makes room in the CQ without completing
+        // anything. Returns false if there were none. Must be called without 'mtx' held.
+        bool holdCqes()
+        {
+            std::lock_guard<std::mutex> cqLock(cqMtx);
+            auto n = held.size();
+            takeCqes(held);
+            return held.size() != n;
+        }
+
+        // Completes 'op' with 'res' on the next reap(), for operations the kernel never got.
+        // Must be called with 'mtx' held, 'op' must be tracked.
+        void fail(Operation* op, int res)
+        {
+            io_uring_cqe cqe;
+            std::memset(&cqe, 0, sizeof(cqe));
+            cqe.user_data = reinterpret_cast<std::uintptr_t>(op);
+            cqe.res = res;
+
+            std::lock_guard<std::mutex> cqLock(cqMtx);
+            held.push_back(cqe);
+        }
+
+        // Must be called with 'mtx' held.
+        void track(Operation* op)
+        {
+            op->prev_ = nullptr;
+            op->next_ = inFlight;
+            if (inFlight) {
+                inFlight->prev_ = op;
+            }
+            inFlight = op;
+        }
+
+        // Must be called with 'mtx' held.
+        void remove(Operation* op)
+        {
+            if (op->prev_) {
+                op->prev_->next_ = op->next_;
+            } else {
+                inFlight = op->next_;
+            }
+            if (op->next_) {
+                op->next_->prev_ = op->prev_;
+            }
+            op->prev_ = op->next_ = nullptr;
+        }
+
+        int fd = -1;
+        void* sqPtr = nullptr;
+        std::size_t sqSize = 0;
+        void* cqPtr = nullptr;
+        std::size_t cqSize = 0;
+        io_uring_sqe* sqes = nullptr;
+        std::size_t sqesSize = 0;
+
+        std::uint32_t* sqHead = nullptr;
+        std::uint32_t* sqTail = nullptr;
+        std::uint32_t sqMask = 0;
+        std::uint32_t sqEntries = 0;
+        std::uint32_t* sqFlags = nullptr;
+        std::uint32_t* sqArray = nullptr;
+        std::uint32_t* cqHead = nullptr;
+        std::uint32_t* cqTail = nullptr;
+        std::uint32_t cqMask = 0;
+        io_uring_cqe* cqes = nullptr;
+
+        boost::asio::posix::stream_descriptor eventFd;
+
+        char* fixedBuffers = nullptr;
+        std::size_t fixedBufferSize = 0;
+
+        // Guards the CQ head and 'held', only one reap() at a time. May be locked
+        // with 'mtx' held, not the other way around.
+        std::mutex cqMtx;
+        // CQEs taken off the CQ to make room and CQEs of failed operations, completed by
+        // the next reap().
+        std::vector<io_uring_cqe> held;
+
+        // Guards everything below, the SQ has a single producer.
+        mutable std::mutex mtx;
+        std::uint32_t sqLocalTail = 0;
+        std::uint32_t toSubmit = 0;
+        bool flushPosted = false;
+        Operation* inFlight = nullptr;
+        std::vector<int> freeFixedBuffers;
+        Stats stats;
+        bool stopped = false;
+    };
+#else
+    struct Uring::Ring
+    {
+    };
+#endif
+
+    Uring::Uring(boost::asio::execution_context& context)
+    : boost::asio::execution_context::service(context),
+      ioService_(static_cast<boost::asio::io_service&>(context))
+    {
+    }
+
+    Uring::~Uring()
+    {
+        shutdown();
+    }
+
+    std::error_code Uring::install(boost::asio::io_service& ioService,
+        std::uint32_t entries,
+        std::uint32_t numFixedBuffers,
+        std::size_t fixedBufferSize)
+    {
+#if defined(VMS_HAS_IO_URING)
+        if (boost::asio::has_service<Uring>(ioService)) {
+            return std::error_code{};
+        }
+
+        std::unique_ptr<Ring> ring(new Ring(ioService));
+        auto ec = ring->setup(entries, numFixedBuffers, fixedBufferSize);
+        if (ec) {
+            return ec;
+        }
+
+        auto& uring = boost::asio::use_service<Uring>(ioService);
+        uring.ring_ = std::move(ring);
+
+        // The reaper, waits for the eventfd the kernel signals on every CQE.
+        struct Reaper
+        {
+            void operator()(const boost::system::error_code& ec)
+            {
+                if (ec || !uring->ring_) {
+                    return;
+                }
+
+                Ring& ring = *uring->ring_;
+
+                std::uint64_t value;
+                while (::read(ring.eventFd.native_handle(), &value, sizeof(value)) > 0) {
+                }
+
+                ring.reap(batch);
+
+                ring.eventFd.async_wait(boost::asio::posix::stream_descriptor::wait_read, std::move(*this));
+            }
+
+            Uring* uring;
+            std::vector<io_uring_cqe> batch;
+        };
+
+        uring.ring_->eventFd.async_wait(boost::asio::posix::stream_descriptor::wait_read, Reaper{ &uring, {} });
+
+        return std::error_code{};
+#else
+        (void)ioService;
+        (void)entries;
+        (void)numFixedBuffers;
+        (void)fixedBufferSize;
+        return std::make_error_code(std::errc::operation_not_supported);
+#endif
+    }
+
+    Uring* Uring::get(boost::asio::io_service& ioService)
+    {
+        if (!boost::asio::has_service<Uring>(ioService)) {
+            return nullptr;
+        }
+        auto& uring = boost::asio::use_service<Uring>(ioService);
+        return uring.ring_ ? &uring : nullptr;
+    }
+
+    Uring::Stats Uring::stats() const
+    {
+#if defined(VMS_HAS_IO_URING)
+        std::lock_guard<std::mutex> lock(ring_->mtx);
+        return ring_->stats;
+#else
+        return Stats();
+#endif
+    }
+
+#if defined(VMS_HAS_IO_URING)
+    namespace
+    {
+        // Makes sure the SQEs queued and CQEs held get submitted and completed soon, i.e. by
+        // a flush posted to the io_service, so that everything queued meanwhile goes with it.
+        // Must be called with 'ring.mtx' held.
+        template <class Ring>
+        void postFlush(boost::asio::io_service& ioService, Ring& ring)
+        {
+            if (ring.flushPosted) {
+                return;
+            }
+            ring.flushPosted = true;
+            boost::asio::post(ioService, [&ring]() {
+                {
+                    std::lock_guard<std::mutex> lock(ring.mtx);
+                    ring.flushPosted = false;
+                    ring.submit();
+                }
+                std::vector<io_uring_cqe> batch;
+                ring.reap(batch);
+            });
+        }
+
+        // Queues an SQE filled in by 'fill', see postFlush().
+        template <class Ring, class Fill>
+        void queue(boost::asio::io_service& ioService, Ring& ring, Uring::Operation* op, Fill&& fill)
+        {
+            std::unique_lock<std::mutex> lock(ring.mtx);
+
+            io_uring_sqe* sqe = nullptr;
+            while (!ring.stopped && ((sqe = ring.getSqe()) == nullptr)) {
+                // The kernel didn't take the SQEs. On CQ overflow (EBUSY) it wants the CQEs
+                // reaped first, that can't wait for the reaper, it may need this very thread.
+                lock.unlock();
+                bool madeRoom = ring.holdCqes();
+                lock.lock();
+                if (!madeRoom) {
+                    break;
+                }
+                postFlush(ioService, ring);
+            }
+
+            if (ring.stopped) {
+                lock.unlock();
+                // Nothing gets submitted anymore.
+                if (op) {
+                    completeLater(ioService, op, -ECANCELED);
+                }
+                return;
+            }
+
+            if (!sqe) {
+                // Nothing to make room with, i.e. the kernel is short of memory.
+                VMS_LOG_WARN(_FN, "Uring: submission ring is full, failing operation");
+                if (op) {
+                    ring.track(op);
+                    ring.fail(op, -EAGAIN);
+                }
+                postFlush(ioService, ring);
+                return;
+            }
+
+            sqe->user_data = reinterpret_cast<std::uintptr_t>(op);
+            fill(*sqe);
+            ring.publish(op);
+            postFlush(ioService, ring);
+        }
+    }
+#endif
+
+    void Uring::recv(int fd, void* data, std::size_t size, Operation* op)
+    {
+#if defined(VMS_HAS_IO_URING)
+        queue(ioService_, *ring_, op, [&](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_RECV;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<std::uintptr_t>(data);
+            sqe.len = static_cast<std::uint32_t>(size);
+        });
+#else
+        (void)fd;
+        (void)data;
+        (void)size;
+        completeLater(ioService_, op, -ENOTSUP);
+#endif
+    }
+
+    void Uring::send(int fd, const void* data, std::size_t size, Operation* op)
+    {
+#if defined(VMS_HAS_IO_URING)
+        auto& ring = *ring_;
+        queue(ioService_, ring, op, [&](io_uring_sqe& sqe) {
+            sqe.fd = fd;
+            sqe.len = static_cast<std::uint32_t>(size);
+            if ((size <= ring.fixedBufferSize) && !ring.freeFixedBuffers.empty()) {
+                // The caller's buffer is free to go as soon as the operation completes anyway,
+                // copying it into a registered buffer saves the kernel pinning its pages.
+                int index = ring.freeFixedBuffers.back();
+                ring.freeFixedBuffers.pop_back();
+                op->fixedBuffer_ = index;
+                char* buffer = ring.fixedBuffers + index * ring.fixedBufferSize;
+                std::memcpy(buffer, data, size);
+                sqe.opcode = IORING_OP_WRITE_FIXED;
+                sqe.addr = reinterpret_cast<std::uintptr_t>(buffer);
+                sqe.buf_index = static_cast<std::uint16_t>(index);
+                sqe.off = static_cast<std::uint64_t>(-1);
+                ++ring.stats.numFixedSends;
+            } else {
+                sqe.opcode = IORING_OP_SEND;
+                sqe.addr = reinterpret_cast<std::uintptr_t>(data);
+                sqe.msg_flags = MSG_NOSIGNAL;
+            }
+        });
+#else
+        (void)fd;
+        (void)data;
+        (void)size;
+        completeLater(ioService_, op, -ENOTSUP);
+#endif
+    }
+
+    void Uring::acceptMultishot(int fd, Operation* op)
+    {
+#if defined(VMS_HAS_IO_URING)
+        queue(ioService_, *ring_, op, [&](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_ACCEPT;
+            sqe.fd = fd;
+            sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe.accept_flags = SOCK_CLOEXEC;
+        });
+#else
+        (void)fd;
+        completeLater(ioService_, op, -ENOTSUP);
+#endif
+    }
+
+    void Uring::cancel(Operation* op)
+    {
+#if defined(VMS_HAS_IO_URING)
+        queue(ioService_, *ring_, nullptr, [&](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_ASYNC_CANCEL;
+            sqe.fd = -1;
+            sqe.addr = reinterpret_cast<std::uintptr_t>(op);
+        });
+#else
+        (void)op;
+#endif
+    }
+
+    void Uring::cancelQueued(int fd)
+    {
+#if defined(VMS_HAS_IO_URING)
+        auto& ring = *ring_;
+        std::lock_guard<std::mutex> lock(ring.mtx);
+
+        // Without SQPOLL the kernel reads SQEs only in io_uring_enter(), i.e. with 'mtx'
+        // held, the ones past its head are still ours to change.
+        auto head = std::atomic_ref<std::uint32_t>(*ring.sqHead).load(std::memory_order_acquire);
+        std::vector<std::uintptr_t> canceled;
+        for (auto i = head; i != ring.sqLocalTail; ++i) {
+            auto& sqe = ring.sqes[ring.sqArray[i & ring.sqMask]];
+            if ((sqe.opcode == IORING_OP_NOP) || (sqe.fd != fd)) {
+                continue;
+            }
+            auto* op = reinterpret_cast<Operation*>(static_cast<std::uintptr_t>(sqe.user_data));
+            if (op) {
+                canceled.push_back(sqe.user_data);
+                ring.fail(op, -ECANCELED);
+            }
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_NOP;
+        }
+        if (canceled.empty()) {
+            return;
+        }
+
+        // Cancels of those would look for operations the kernel never got.
+        for (auto i = head; i != ring.sqLocalTail; ++i) {
+            auto& sqe = ring.sqes[ring.sqArray[i & ring.sqMask]];
+            if ((sqe.opcode == IORING_OP_ASYNC_CANCEL) &&
+                (std::find(canceled.begin(), canceled.end(), sqe.addr) != canceled.end())) {
+                std::memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_NOP;
+            }
+        }
+
+        postFlush(ioService_, ring);
+#else
+        (void)fd;
+#endif
+    }
+
+    bool Uring::hasMore(std::uint32_t flags)
+    {
+#if defined(VMS_HAS_IO_URING)
+        return (flags & IORING_CQE_F_MORE) != 0;
+#else
+        (void)flags;
+        return false;
+#endif
+    }
+
+    void Uring::shutdown()
+    {
+#if defined(VMS_HAS_IO_URING)
+        if (!ring_) {
+            return;
+        }
+
+        Operation* inFlight;
+        {
+            std::lock_guard<std::mutex> lock(ring_->mtx);
+            ring_->stopped = true;
+            inFlight = ring_->inFlight;
+            ring_->inFlight = nullptr;
+            boost::system::error_code ec;
+            ring_->eventFd.cancel(ec);
+        }
+
+        // Closing the ring cancels everything still in flight in the kernel.
+        ring_.reset();
+
+        while (inFlight) {
+            auto* next = inFlight->next_;
+            inFlight->destroy();
+            inFlight = next;
+        }
+#endif
+    }
+} }
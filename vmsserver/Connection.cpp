@@ -1,31 +1,153 @@
 #include "Connection.h"
 
+#include <algorithm>
+#include <cstring>
+#include <iterator>
 #include <utility>
 
-#include <boost/asio/read_until.hpp>
+#if defined(__linux__)
+# include <linux/sockios.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+# include <sys/ioctl.h>
+# include <sys/socket.h>
+#endif
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/dispatch.hpp>
 #include <boost/asio/write.hpp>
 
 #include "Vms/Core/Logger.h"
+#include "Vms/Net/LineScanner.h"
+#include "Vms/Net/Protocol.h"
 
 #define _FN "Connection"
 
-Connection::Connection(boost::asio::ip::tcp::socket s, UpdateCallback onUpdate, DisconnectCallback onDisconnect)
-    : s_(std::move(s)),
+const std::string& Update::line() const
+{
+    std::call_once(lineOnce_, [this]() {
+        Vms::Net::appendHashLine(line_, key_, hash_);
+    });
+    return line_;
+}
+
+const std::string& Update::frame() const
+{
+    std::call_once(frameOnce_, [this]() {
+        Vms::Net::appendHashFrame(frame_, key_, hash_);
+    });
+    return frame_;
+}
+
+std::error_code parseSlowConsumerAction(std::string_view str, SlowConsumerAction& action)
+{
+    if (str == "none") {
+        action = SlowConsumerAction::None;
+    } else if (str == "conflate") {
+        action = SlowConsumerAction::Conflate;
+    } else if (str == "resync") {
+        action = SlowConsumerAction::Resync;
+    } else if (str == "disconnect") {
+        action = SlowConsumerAction::Disconnect;
+    } else {
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+    return std::error_code{};
+}
+
+std::error_code parseCompressionMode(std::string_view str, CompressionMode& mode)
+{
+    if (str == "off") {
+        mode = CompressionMode::Off;
+    } else if (str == "lagging") {
+        mode = CompressionMode::Lagging;
+    } else if (str == "always") {
+        mode = CompressionMode::Always;
+    } else {
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+    return std::error_code{};
+}
+
+std::ostream& operator<<(std::ostream& os, ConsumerState state)
+{
+    switch (state) {
+    case ConsumerState::Healthy:
+        return os << "healthy";
+    case ConsumerState::Lagging:
+        return os << "lagging";
+    case ConsumerState::Stalled:
+        return os << "stalled";
+    }
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const ConsumerStats& stats)
+{
+    os << stats.state
+        << ", rtt " << stats.rttUs << " us"
+        << ", cwnd " << stats.sndCwnd
+        << ", unacked " << stats.unacked
+        << ", notsent " << stats.notsentBytes << " B"
+        << ", backlog " << stats.backlogBytes << " B for " << stats.backlogAge.count() << " ms"
+        << ", no progress for " << stats.stalledFor.count() << " ms"
+        << ", conflated " << stats.conflatedKeys << " key(s), " << stats.numConflated << " update(s) skipped"
+        << ", " << stats.numResyncs << " resync(s)";
+    if (stats.compressed) {
+        os << ", compressed " << stats.compressedIn << " B to " << stats.compressedOut << " B";
+    }
+    return os;
+}
+
+Connection::Connection(boost::asio::io_service& ioService, boost::asio::ip::tcp::socket s,
+    UpdateCallback onUpdate, DisconnectCallback onDisconnect)
+    : strand_(Vms::Core::makeStrand(ioService)),
+      sendQueue_(std::make_shared<Vms::Core::SerialQueue>(ioService, strand_)),
+      s_(std::move(s)),
       ep_(s_.remote_endpoint()),
+      readBuffer_(new char[defaultMaxLineLength + 1]),
+      readCapacity_(defaultMaxLineLength + 1),
       onUpdate_(std::move(onUpdate)),
-      onDisconnect_(std::move(onDisconnect))
-{}
+      onDisconnect_(std::move(onDisconnect)),
+      sampleTask_(std::make_shared<Vms::Core::TimedTask>(ioService, strand_)),
+      writeSignal_(ioService, boost::asio::steady_timer::time_point::max()),
+      compressSignal_(ioService, boost::asio::steady_timer::time_point::max())
+{
+    outbound_.setHighWatermark(defaultSendWatermark);
+
+    if (auto* uring = Vms::Net::Uring::get(ioService)) {
+        uringStream_ = std::make_unique<Vms::Net::UringStream>(*uring, s_);
+    }
+}
 
 void Connection::start()
 {
-    onRead({}, 0);
+    boost::asio::co_spawn(*strand_, readLoop(shared_from_this()), boost::asio::detached);
+    boost::asio::co_spawn(*strand_, writeLoop(shared_from_this()), boost::asio::detached);
+
+    boost::asio::dispatch(*strand_, [self = shared_from_this()]() {
+        self->scheduleSample();
+    });
 }
 
-void Connection::close() {
+void Connection::close()
+{
+    boost::asio::dispatch(*strand_, [self = shared_from_this()]() {
+        self->doClose();
+    });
+}
+
+void Connection::doClose()
+{
+    strand_assert(strand_);
+
+    closed_ = true;
+    writeSignal_.cancel();
+    sampleTask_->cancel();
+
     if (s_.is_open()) {
-        boost::system::error_code ec;
-        ec = s_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
-        ec = s_.close(ec);
+        auto ec{ closeSocket() };
         if (ec) {
             VMS_LOG_WARN(_FN, "Failed to close socket: " << ec.message());
         } else {
@@ -34,90 +156,755 @@ void Connection::close() {
     }
 }
 
+boost::system::error_code Connection::closeSocket()
+{
+    strand_assert(strand_);
+
+    boost::system::error_code ec;
+    s_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+    if (uringStream_) {
+        // Recvs and sends still waiting in the submission ring would hit whichever client
+        // gets this fd number next.
+        uringStream_->cancelQueued();
+    }
+    s_.close(ec);
+    return ec;
+}
+
 void Connection::send(const std::string& message)
 {
-    std::lock_guard<std::mutex> lock(writeMutex_);
-    const auto& writeInProgress{ !writeQueue_.empty() };
+    sendQueue_->post([self = shared_from_this(), message]() {
+        strand_assert(self->sendQueue_);
+
+        if (self->closed_) {
+            return;
+        }
+
+        if (self->binary_) {
+            self->enqueueMessage(message);
+        } else {
+            self->enqueue(message);
+        }
+    });
+}
+
+void Connection::sendUpdate(UpdatePtr update)
+{
+    sendQueue_->post([self = shared_from_this(), update = std::move(update)]() mutable {
+        strand_assert(self->sendQueue_);
+
+        self->queueUpdate(std::move(update));
+    });
+}
+
+void Connection::sendUpdates(UpdateListPtr updates)
+{
+    sendQueue_->post([self = shared_from_this(), updates = std::move(updates)]() {
+        strand_assert(self->sendQueue_);
 
-    writeQueue_.push_back(message);
+        for (const auto& update : *updates) {
+            self->queueUpdate(update);
+        }
+    });
+}
+
+void Connection::queueUpdate(UpdatePtr update)
+{
+    strand_assert(strand_);
 
-    if (!writeInProgress) {
-        write();
+    if (closed_ || resyncing_) {
+        return;
+    }
+
+    if (!conflating_ && outbound_.aboveHighWatermark()) {
+        VMS_LOG_WARN_LIMITED(_FN, 10, "Slow client " << ep_ << ", " << outbound_.size()
+            << " bytes queued, conflating updates");
+        conflating_ = true;
     }
+
+    if (conflating_) {
+        conflate(std::move(update));
+        return;
+    }
+
+    enqueueUpdate(*update);
 }
 
-void Connection::write()
+void Connection::setSendWatermark(std::size_t bytes)
 {
-    auto self(shared_from_this());
-    async_write(s_, boost::asio::buffer(writeQueue_.front()),
-        [this](const std::error_code& ec, std::size_t /*length*/) {
-            std::lock_guard<std::mutex> lock(writeMutex_);
+    outbound_.setHighWatermark(bytes);
+}
 
-            if (ec) {
-                VMS_LOG_INFO(_FN, "Send failed: " << ec.message());
-                return;
+void Connection::setMaxLineLength(std::size_t bytes)
+{
+    readCapacity_ = bytes + 1;
+    readBuffer_.reset(new char[readCapacity_]);
+}
+
+void Connection::setSlowConsumerPolicy(const SlowConsumerPolicy& policy)
+{
+    policy_ = policy;
+}
+
+void Connection::setSnapshotCallback(SnapshotCallback onSnapshot)
+{
+    onSnapshot_ = std::move(onSnapshot);
+}
+
+void Connection::setCompression(CompressionMode mode, Vms::Core::WorkStealingPool& pool)
+{
+    compressionMode_ = mode;
+    compressPool_ = &pool;
+}
+
+ConsumerStats Connection::consumerStats() const
+{
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    return stats_;
+}
+
+void Connection::enqueue(std::string_view data)
+{
+    strand_assert(strand_);
+
+    if (outbound_.empty()) {
+        writeSignal_.cancel();
+        backlogSince_ = std::chrono::steady_clock::now();
+    }
+
+    outbound_.append(data);
+}
+
+void Connection::enqueueUpdate(const Update& update)
+{
+    strand_assert(strand_);
+
+    if (!keyIds_) {
+        enqueue(binary_ ? update.frame() : update.line());
+        return;
+    }
+
+    encodeBuffer_.clear();
+    auto it{ keys_.find(update.key()) };
+    if (it == keys_.end()) {
+        auto id{ static_cast<std::uint32_t>(keys_.size()) };
+        keys_.emplace(update.key(), KeyState{ id, update.hash() });
+        Vms::Net::appendKeyHashFrame(encodeBuffer_, id, update.key(), update.hash(), delta_);
+    } else {
+        auto& state{ it->second };
+        Vms::Net::appendIdHashFrame(encodeBuffer_, state.id, delta_ ? (update.hash() ^ state.lastHash) : update.hash(), delta_);
+        state.lastHash = update.hash();
+    }
+    enqueue(encodeBuffer_);
+}
+
+void Connection::enqueueMessage(std::string_view message)
+{
+    strand_assert(strand_);
+
+    if (!binary_) {
+        enqueue(message);
+        return;
+    }
+
+    if (!message.empty() && (message.back() == '\n')) {
+        message.remove_suffix(1);
+    }
+
+    std::string frame;
+    Vms::Net::appendMessageFrame(frame, message);
+    enqueue(frame);
+}
+
+void Connection::scheduleSample()
+{
+    strand_assert(strand_);
+
+    if (closed_ || (policy_.sampleInterval.count() == 0)) {
+        return;
+    }
+
+    sampleTask_->schedule([weak = weak_from_this()]() {
+        if (auto self = weak.lock()) {
+            self->sample();
+        }
+    }, policy_.sampleInterval);
+}
+
+void Connection::sample()
+{
+    strand_assert(strand_);
+
+    if (closed_) {
+        return;
+    }
+
+    ConsumerStats stats;
+
+#if defined(__linux__)
+    if (s_.is_open()) {
+        struct tcp_info info{};
+        socklen_t len = sizeof(info);
+        if (::getsockopt(s_.native_handle(), IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+            stats.rttUs = info.tcpi_rtt;
+            stats.sndCwnd = info.tcpi_snd_cwnd;
+            stats.unacked = info.tcpi_unacked;
+        }
+
+        // glibc's tcp_info predates tcpi_notsent_bytes.
+        int notsent = 0;
+        if (::ioctl(s_.native_handle(), SIOCOUTQNSD, &notsent) == 0) {
+            stats.notsentBytes = static_cast<std::uint32_t>(notsent);
+        }
+    }
+#endif
+
+    auto now{ std::chrono::steady_clock::now() };
+
+    stats.backlogBytes = outbound_.size();
+    if (!outbound_.empty()) {
+        stats.backlogAge = std::chrono::duration_cast<std::chrono::milliseconds>(now - backlogSince_);
+        stats.stalledFor = std::chrono::duration_cast<std::chrono::milliseconds>(
+            now - std::max(backlogSince_, lastProgress_));
+    }
+    stats.conflatedKeys = conflated_.size();
+    stats.numConflated = numConflated_;
+    stats.numResyncs = numResyncs_;
+    stats.compressed = (deflater_ != nullptr);
+    stats.compressedIn = compressedIn_;
+    stats.compressedOut = compressedOut_;
+
+    if ((stats.backlogBytes > 0) && (stats.stalledFor >= policy_.stallAge)) {
+        stats.state = ConsumerState::Stalled;
+    } else if (conflating_ || resyncing_ ||
+        ((stats.backlogBytes > 0) && (stats.backlogAge >= policy_.lagAge)) ||
+        ((outbound_.highWatermark() > 0) && (stats.notsentBytes > outbound_.highWatermark()))) {
+        stats.state = ConsumerState::Lagging;
+    }
+
+    bool entered{ stats.state != state_ };
+    if (entered) {
+        if (stats.state == ConsumerState::Healthy) {
+            VMS_LOG_INFO(_FN, "Client " << ep_ << " caught up");
+        } else {
+            VMS_LOG_WARN_LIMITED(_FN, 10, "Client " << ep_ << " is " << stats);
+        }
+        state_ = stats.state;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        stats_ = stats;
+    }
+
+    if (state_ == ConsumerState::Stalled) {
+        act(policy_.stallAction, entered);
+    } else if (state_ == ConsumerState::Lagging) {
+        act(policy_.lagAction, entered);
+    }
+
+    scheduleSample();
+}
+
+void Connection::act(SlowConsumerAction action, bool entered)
+{
+    strand_assert(strand_);
+
+    switch (action) {
+    case SlowConsumerAction::None:
+        break;
+    case SlowConsumerAction::Resync:
+        if (onSnapshot_) {
+            if (entered && !resyncing_) {
+                resync();
             }
+            break;
+        }
+        [[fallthrough]];
+    case SlowConsumerAction::Conflate:
+        if (!resyncing_) {
+            conflating_ = true;
+        }
+        break;
+    case SlowConsumerAction::Disconnect:
+        VMS_LOG_WARN_LIMITED(_FN, 10, "Disconnecting " << state_ << " client " << ep_);
+        // The read loop fails and reports the disconnect.
+        doClose();
+        break;
+    }
+}
 
-            writeQueue_.pop_front();
+void Connection::resync()
+{
+    strand_assert(strand_);
 
-            if (!writeQueue_.empty()) {
-                write();
+    auto dropped{ dropBacklog() };
+
+    resyncing_ = true;
+    ++numResyncs_;
+    writeSignal_.cancel();
+
+    VMS_LOG_WARN_LIMITED(_FN, 10, "Resyncing client " << ep_ << ", " << dropped << " bytes dropped");
+}
+
+std::size_t Connection::dropBacklog()
+{
+    strand_assert(strand_);
+
+    // What's being written can't be taken back, neither can the rest of a line or frame
+    // it ends in.
+    std::size_t keep{ 0 };
+    if (binary_) {
+        // Nor the hello. Walk the frame headers up to the first boundary at or after the write.
+        keep = handshakeBytes_;
+        while (keep < inFlight_) {
+            keep = nextFrame(keep);
+        }
+    } else if (inFlight_ > 0) {
+        keep = std::min(outbound_.find('\n', inFlight_ - 1) + 1, outbound_.size());
+    }
+    auto dropped{ outbound_.size() - keep };
+    outbound_.truncate(keep);
+
+    // The client may not get key ids defined by what was dropped, nor the last hashes.
+    if ((dropped > 0) && keyIds_ && !keys_.empty()) {
+        keys_.clear();
+        std::string frame;
+        Vms::Net::appendKeyResetFrame(frame);
+        enqueue(frame);
+    }
+
+    conflated_.clear();
+    conflatedIndex_.clear();
+    conflating_ = false;
+
+    return dropped;
+}
+
+std::size_t Connection::nextFrame(std::size_t pos) const
+{
+    strand_assert(strand_);
+
+    char header[10];
+    auto n{ outbound_.peek(pos, header, sizeof(header)) };
+    std::uint64_t length;
+    std::size_t used;
+    if (Vms::Net::parseVarint(header, n, length, used) != Vms::Net::ParseResult::Ok) {
+        return outbound_.size();
+    }
+    return std::min(pos + used + static_cast<std::size_t>(length), outbound_.size());
+}
+
+void Connection::conflate(UpdatePtr update)
+{
+    strand_assert(strand_);
+
+    auto it{ conflatedIndex_.find(update->key()) };
+    if (it != conflatedIndex_.end()) {
+        conflated_[it->second] = std::move(update);
+        ++numConflated_;
+    } else {
+        conflatedIndex_.emplace(update->key(), conflated_.size());
+        conflated_.push_back(std::move(update));
+    }
+}
+
+void Connection::flushConflated()
+{
+    strand_assert(strand_);
+
+    for (const auto& update : conflated_) {
+        enqueueUpdate(*update);
+    }
+
+    VMS_LOG_DEBUG(_FN, "Sending " << conflated_.size() << " conflated key(s) to " << ep_
+        << ", " << numConflated_ << " update(s) skipped so far");
+
+    conflated_.clear();
+    conflatedIndex_.clear();
+    conflating_ = false;
+}
+
+Vms::Core::Awaitable<std::error_code> Connection::fill()
+{
+    strand_assert(strand_);
+
+    // Keep just the partial line at the front, the rest is parsed.
+    if (readBegin_ > 0) {
+        std::memmove(&readBuffer_[0], &readBuffer_[readBegin_], readEnd_ - readBegin_);
+        readEnd_ -= readBegin_;
+        readBegin_ = 0;
+    }
+
+    // Frames longer than the buffer are rejected by parseFrames().
+    if ((readEnd_ == readCapacity_) && !binary_) {
+        if (!discarding_) {
+            VMS_LOG_WARN_LIMITED(_FN, 10, "Line too long received from " << ep_ << ", dropped");
+            send("Error: Line too long\n");
+        }
+        readEnd_ = 0;
+        discarding_ = true;
+    }
+
+    auto buffer{ boost::asio::buffer(&readBuffer_[readEnd_], readCapacity_ - readEnd_) };
+
+    boost::system::error_code ec;
+    std::size_t sz;
+    if (uringStream_) {
+        sz = co_await uringStream_->async_read_some(buffer,
+            boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+    } else {
+        sz = co_await s_.async_read_some(buffer,
+            boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+    }
+
+    readEnd_ += sz;
+
+    co_return ec;
+}
+
+void Connection::parse()
+{
+    strand_assert(strand_);
+
+    if (!helloChecked_) {
+        if (readEnd_ == readBegin_) {
+            return;
+        }
+
+        if (readBuffer_[readBegin_] == '\0') {
+            std::uint8_t features{};
+            auto res{ Vms::Net::parseHello(&readBuffer_[readBegin_], readEnd_ - readBegin_, features) };
+            if (res == Vms::Net::ParseResult::NeedMore) {
+                return;
             }
-        });
+            if (res == Vms::Net::ParseResult::Invalid) {
+                VMS_LOG_WARN_LIMITED(_FN, 10, "Bad hello received from " << ep_);
+                send("Error: Bad hello\n");
+                doClose();
+                return;
+            }
+            readBegin_ += Vms::Net::helloSize;
+            onHello(features);
+        }
+
+        helloChecked_ = true;
+    }
+
+    if (binary_) {
+        parseFrames();
+    } else {
+        parseLines();
+    }
 }
 
-void Connection::onRead(const std::error_code& ec, std::uint32_t sz)
+void Connection::onHello(std::uint8_t features)
 {
-    if (ec) {
-        VMS_LOG_INFO(_FN, "Disconnected " << ep_ << " with ec: " << ec.message());
-        s_.close();
+    strand_assert(strand_);
+
+    // Whatever text is queued is stale, the client gets a snapshot after the hello.
+    dropBacklog();
+
+    std::uint8_t accepted = features & (Vms::Net::FeatureBinary | Vms::Net::FeatureKeyIds | Vms::Net::FeatureDelta);
+    if ((accepted & Vms::Net::FeatureKeyIds) == 0) {
+        accepted &= ~Vms::Net::FeatureDelta;
+    }
+    if ((compressionMode_ != CompressionMode::Off) && compressPool_ && Vms::Net::compressionSupported()) {
+        accepted |= features & Vms::Net::FeatureCompress;
+    }
+    binary_ = true;
+    keyIds_ = (accepted & Vms::Net::FeatureKeyIds) != 0;
+    delta_ = (accepted & Vms::Net::FeatureDelta) != 0;
+    compress_ = (accepted & Vms::Net::FeatureCompress) != 0;
+
+    std::string hello;
+    Vms::Net::appendHello(hello, accepted);
+    enqueue(hello);
+    handshakeBytes_ = outbound_.size();
+
+    if (onSnapshot_) {
+        resyncing_ = true;
+    }
+
+    VMS_LOG_DEBUG(_FN, "Client " << ep_ << " switched to binary protocol, features " << static_cast<int>(accepted));
+}
+
+bool Connection::parseFrames()
+{
+    strand_assert(strand_);
 
-        if (onDisconnect_) {
-            onDisconnect_(shared_from_this());
+    // Entries are relative to 'first', the batch gets a copy of everything parsed.
+    const auto first{ readBegin_ };
+    std::shared_ptr<UpdateBatch> batch;
+
+    for (;;) {
+        const char* data = &readBuffer_[readBegin_];
+        Vms::Net::Frame frame;
+        auto res{ Vms::Net::parseFrame(data, readEnd_ - readBegin_, readCapacity_, frame) };
+        if (res == Vms::Net::ParseResult::NeedMore) {
+            break;
         }
-        return;
+
+        std::string_view key;
+        std::string_view value;
+        if ((res == Vms::Net::ParseResult::Invalid) ||
+            ((frame.type == Vms::Net::FrameUpdate) && !Vms::Net::parseUpdate(frame.payload, key, value)) ||
+            ((frame.type != Vms::Net::FrameUpdate) && (frame.type != Vms::Net::FrameEmpty))) {
+            // No way to find the next frame.
+            VMS_LOG_WARN_LIMITED(_FN, 10, "Bad frame received from " << ep_ << ", disconnecting");
+            send("Error: Bad frame\n");
+            doClose();
+            return false;
+        }
+
+        readBegin_ += frame.size;
+
+        if (frame.type == Vms::Net::FrameEmpty) {
+            continue;
+        }
+
+        if (key.empty() || value.empty()) {
+            VMS_LOG_WARN_LIMITED(_FN, 10, "Malformed input received: " << key << " " << value);
+            send("Error: Malformed input. Correct format: key value\n");
+            continue;
+        }
+
+        if (!batch) {
+            batch = std::make_shared<UpdateBatch>();
+        }
+        batch->entries.push_back(UpdateBatch::Entry{
+            static_cast<std::uint32_t>(key.data() - &readBuffer_[first]), static_cast<std::uint32_t>(key.size()),
+            static_cast<std::uint32_t>(value.data() - &readBuffer_[first]), static_cast<std::uint32_t>(value.size()) });
     }
 
-    try {
-        if (sz > 0) {
-            std::istream is(&b_);
-            std::string line;
-            std::getline(is, line);
+    if (batch && onUpdate_) {
+        batch->data.assign(&readBuffer_[first], readBegin_ - first);
+        onUpdate_(std::move(batch));
+    }
+
+    return true;
+}
+
+void Connection::parseLines()
+{
+    strand_assert(strand_);
 
-            bool format_error{};
+    // Entries are relative to 'first', the batch gets a copy of everything parsed.
+    const auto first{ readBegin_ };
+    std::shared_ptr<UpdateBatch> batch;
 
-            auto spacePos = line.find(' ');
-            if (spacePos == std::string::npos || spacePos == line.length() - 1) {
-                format_error = true;
+    Vms::Net::LineBounds lines[64];
+    for (;;) {
+        const char* data = &readBuffer_[readBegin_];
+        auto numLines = Vms::Net::scanLines(data, readEnd_ - readBegin_, lines, std::size(lines));
+
+        std::size_t begin = 0;
+        for (std::size_t i = 0; i < numLines; ++i) {
+            std::string_view line(data + begin, lines[i].end - begin);
+            std::size_t spacePos = lines[i].space - begin;
+            auto pos = static_cast<std::uint32_t>(readBegin_ + begin - first);
+            begin = lines[i].end + 1;
+
+            if (discarding_) {
+                // The end of a line too long.
+                discarding_ = false;
+                continue;
             }
-            else
-            {
-                const auto& key{ line.substr(0, spacePos) };
-                const auto& value{ line.substr(spacePos + 1) };
-
-                if( key.empty() || value.empty()) {
-                    format_error = true;
-                }
-                else if (onUpdate_){
-                    onUpdate_(key, value);
-                }
+
+            if (!checkLine(line, spacePos)) {
+                continue;
             }
 
-            if( format_error ) {
-                VMS_LOG_WARN(_FN, "Malformed input received: " << line);
-                send("Error: Malformed input. Correct format: key value\n");
+            if (!batch) {
+                batch = std::make_shared<UpdateBatch>();
             }
+            batch->entries.push_back(UpdateBatch::Entry{
+                pos, static_cast<std::uint32_t>(spacePos),
+                pos + static_cast<std::uint32_t>(spacePos) + 1, static_cast<std::uint32_t>(line.size() - spacePos - 1) });
         }
-    } catch (const std::exception& ex) {
-        VMS_LOG_ERROR(_FN, "Exception during read: " << ex.what());
-        close();
-        if (onDisconnect_) {
-            onDisconnect_(shared_from_this());
+
+        readBegin_ += begin;
+
+        if (numLines < std::size(lines)) {
+            break;
+        }
+    }
+
+    if (batch && onUpdate_) {
+        batch->data.assign(&readBuffer_[first], readBegin_ - first);
+        onUpdate_(std::move(batch));
+    }
+}
+
+bool Connection::checkLine(std::string_view line, std::size_t spacePos)
+{
+    strand_assert(strand_);
+
+    if ((spacePos == 0) || (spacePos + 1 >= line.size())) {
+        VMS_LOG_WARN_LIMITED(_FN, 10, "Malformed input received: " << line);
+        send("Error: Malformed input. Correct format: key value\n");
+        return false;
+    }
+
+    return true;
+}
+
+Vms::Core::Awaitable<std::error_code> Connection::flush()
+{
+    strand_assert(strand_);
+
+    if (compress_ && !deflater_ &&
+        ((compressionMode_ == CompressionMode::Always) || (state_ != ConsumerState::Healthy))) {
+        deflater_ = std::make_unique<Vms::Net::Deflater>();
+        VMS_LOG_INFO(_FN, "Compressing updates for " << state_ << " client " << ep_);
+    }
+
+    auto limit{ maxWriteBytes };
+    if (handshakeBytes_ > 0) {
+        // Not frames, so never compressed, nor cut anywhere but before the first frame.
+        limit = std::min(limit, handshakeBytes_);
+    } else if (binary_ && (outbound_.size() > maxWriteBytes)) {
+        // Cut at a frame boundary, so the ring always starts with a whole frame.
+        limit = nextFrame(0);
+        for (auto next{ nextFrame(limit) }; next <= maxWriteBytes; next = nextFrame(limit)) {
+            limit = next;
         }
     }
 
-    async_read_until(s_, b_, "\n",
-    [self = shared_from_this()](const std::error_code& ec, std::size_t sz) {
-        self->onRead(ec, sz);
+    auto buffers{ outbound_.data(limit) };
+    inFlight_ = boost::asio::buffer_size(buffers);
+
+    boost::system::error_code ec;
+    std::size_t sz;
+    if (deflater_ && (handshakeBytes_ == 0)) {
+        sz = co_await writeCompressed(buffers, ec);
+    } else if (uringStream_) {
+        sz = co_await boost::asio::async_write(*uringStream_, buffers,
+            boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+    } else {
+        sz = co_await boost::asio::async_write(s_, buffers,
+            boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+    }
+
+    inFlight_ = 0;
+    outbound_.consume(sz);
+    handshakeBytes_ -= std::min(handshakeBytes_, sz);
+    if (sz > 0) {
+        lastProgress_ = std::chrono::steady_clock::now();
+    }
+
+    co_return ec;
+}
+
+Vms::Core::Awaitable<std::size_t> Connection::writeCompressed(const Vms::Net::OutboundBuffer::ConstBuffers& buffers,
+    boost::system::error_code& ec)
+{
+    strand_assert(strand_);
+
+    // The ring memory stays valid while it's compressed, it's consumed only after the write.
+    // The last chunk's memory is reused.
+    compressDone_ = false;
+    compressPool_->post([self = shared_from_this(), buffers, chunk = std::move(compressedChunk_)]() mutable {
+        chunk.clear();
+        if (!self->deflater_->compressFrame(buffers, chunk)) {
+            chunk.clear();
+        }
+        boost::asio::post(*self->strand_, [self, chunk = std::move(chunk)]() mutable {
+            self->compressedChunk_ = std::move(chunk);
+            self->compressDone_ = true;
+            self->compressSignal_.cancel();
+        });
     });
+
+    // Posted to the strand, so the result can't arrive before the wait starts.
+    while (!compressDone_) {
+        boost::system::error_code ignored;
+        co_await compressSignal_.async_wait(boost::asio::redirect_error(Vms::Core::useAwaitable, ignored));
+    }
+
+    if (compressedChunk_.empty()) {
+        VMS_LOG_ERROR(_FN, "Failed to compress updates for " << ep_);
+        ec = boost::asio::error::invalid_argument;
+        co_return 0;
+    }
+
+    if (uringStream_) {
+        co_await boost::asio::async_write(*uringStream_, boost::asio::buffer(compressedChunk_),
+            boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+    } else {
+        co_await boost::asio::async_write(s_, boost::asio::buffer(compressedChunk_),
+            boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+    }
+    if (ec) {
+        co_return 0;
+    }
+
+    compressedIn_ += inFlight_;
+    compressedOut_ += compressedChunk_.size();
+    co_return inFlight_;
+}
+
+Vms::Core::Awaitable<void> Connection::writeLoop(std::shared_ptr<Connection> self)
+{
+    while (!closed_) {
+        if (outbound_.empty() && resyncing_) {
+            // The backlog is gone, the client gets the whole map again.
+            resyncing_ = false;
+            for (const auto& update : onSnapshot_()) {
+                enqueueUpdate(*update);
+            }
+        }
+
+        if (outbound_.empty() && conflating_) {
+            // The backlog is gone, the client gets the latest value of every key it missed.
+            flushConflated();
+        }
+
+        if (outbound_.empty()) {
+            // Woken up by cancel() from send() or doClose().
+            boost::system::error_code ec;
+            co_await writeSignal_.async_wait(boost::asio::redirect_error(Vms::Core::useAwaitable, ec));
+            continue;
+        }
+
+        auto ec = co_await flush();
+        if (ec) {
+            VMS_LOG_INFO(_FN, "Send to " << ep_ << " failed: " << ec.message());
+            // The read side may not notice, i.e. after a compression failure, closing the
+            // socket ends the read loop, which reports the disconnect.
+            doClose();
+            co_return;
+        }
+    }
+}
+
+Vms::Core::Awaitable<void> Connection::readLoop(std::shared_ptr<Connection> self)
+{
+    for (;;) {
+        auto ec = co_await fill();
+        if (ec) {
+            VMS_LOG_INFO(_FN, "Disconnected " << ep_ << " with ec: " << ec.message());
+            closeSocket();
+            closed_ = true;
+            writeSignal_.cancel();
+            sampleTask_->cancel();
+
+            if (onDisconnect_) {
+                onDisconnect_(self);
+            }
+            co_return;
+        }
+
+        try {
+            // Everything complete of this read.
+            parse();
+        } catch (const std::exception& ex) {
+            VMS_LOG_ERROR(_FN, "Exception during read: " << ex.what());
+            doClose();
+            if (onDisconnect_) {
+                onDisconnect_(self);
+            }
+            co_return;
+        }
+    }
 }
@@ -9,14 +9,214 @@
 # pragma once
 #endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
 
-#include <deque>
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
 
 #include <boost/asio/ip/tcp.hpp>
-#include <boost/asio/streambuf.hpp>
+#include <boost/asio/steady_timer.hpp>
 
 #include "Vms/Core/Types.h"
+#include "Vms/Core/Strand.h"
+#include "Vms/Core/Awaitable.h"
+#include "Vms/Core/LogRecord.h"
+#include "Vms/Core/SerialQueue.h"
+#include "Vms/Core/TimedTask.h"
+#include "Vms/Core/WorkStealingPool.h"
+#include "Vms/Net/Compression.h"
+#include "Vms/Net/OutboundBuffer.h"
+#include "Vms/Net/Uring.h"
+
+/// A map update broadcast to the clients, one instance shared by all of them.
+/**
+ * What's sent is encoded once per protocol, by the first connection sending it that way.
+ */
+class Update
+{
+public:
+    Update(std::string key, std::uint32_t hash)
+        : key_(std::move(key)), hash_(hash)
+    {
+    }
+
+    const std::string& key() const { return key_; }
+
+    std::uint32_t hash() const { return hash_; }
+
+    /// Text protocol, "key hash\n".
+    const std::string& line() const;
+
+    /// Binary protocol, a `Vms::Net::FrameHash` frame.
+    const std::string& frame() const;
+
+private:
+    const std::string key_;
+    const std::uint32_t hash_;
+
+    mutable std::once_flag lineOnce_;
+    mutable std::string line_;
+
+    mutable std::once_flag frameOnce_;
+    mutable std::string frame_;
+};
+
+/// Type alias for a shared pointer to an immutable `Update`.
+using UpdatePtr = std::shared_ptr<const Update>;
+
+/// Type alias for a shared pointer to a group of updates sent together.
+using UpdateListPtr = std::shared_ptr<const std::vector<UpdatePtr>>;
+
+/// The valid "key value" lines received by a single read.
+struct UpdateBatch
+{
+    /// A key and a value, offsets into `data`.
+    struct Entry
+    {
+        std::uint32_t keyPos;
+        std::uint32_t keyLen;
+        std::uint32_t valuePos;
+        std::uint32_t valueLen;
+    };
+
+    /// The bytes read, a single copy for all the lines.
+    std::string data;
+
+    std::vector<Entry> entries;
+
+    inline std::size_t size() const { return entries.size(); }
+
+    inline std::string_view key(std::size_t i) const
+    {
+        return std::string_view(data).substr(entries[i].keyPos, entries[i].keyLen);
+    }
+
+    inline std::string_view value(std::size_t i) const
+    {
+        return std::string_view(data).substr(entries[i].valuePos, entries[i].valueLen);
+    }
+};
+
+/// Type alias for a shared pointer to an immutable `UpdateBatch`.
+using UpdateBatchPtr = std::shared_ptr<const UpdateBatch>;
+
+/// How well a client keeps up with the updates sent to it.
+enum class ConsumerState
+{
+    Healthy,
+    /// Has a backlog older than `SlowConsumerPolicy::lagAge`, is conflated or the kernel
+    /// holds more than the send watermark unsent.
+    Lagging,
+    /// Has a backlog and hasn't taken a single byte for `SlowConsumerPolicy::stallAge`.
+    Stalled
+};
+
+/// What's done to a client once it's found lagging or stalled.
+enum class SlowConsumerAction
+{
+    /// Nothing, the figures are just reported.
+    None,
+    /// Only the latest value of every key is sent until the backlog drains.
+    Conflate,
+    /// The backlog is dropped, updates are ignored until the client takes what's already
+    /// being written, then it gets a snapshot of the whole map.
+    Resync,
+    /// The client is disconnected.
+    Disconnect
+};
+
+/// Parses "none", "conflate", "resync" or "disconnect".
+std::error_code parseSlowConsumerAction(std::string_view str, SlowConsumerAction& action);
+
+/// Which clients asking for compression get it.
+enum class CompressionMode
+{
+    /// None, `Vms::Net::FeatureCompress` is refused.
+    Off,
+    /// The ones found lagging or stalled, from then on.
+    Lagging,
+    /// All of them, right after the hello.
+    Always
+};
+
+/// Parses "off", "lagging" or "always".
+std::error_code parseCompressionMode(std::string_view str, CompressionMode& mode);
+
+/// Slow client detection settings.
+struct SlowConsumerPolicy
+{
+    /// How often a connection is sampled, 0 = never.
+    std::chrono::milliseconds sampleInterval{ 1000 };
+
+    /// Backlog age that makes a client lagging.
+    std::chrono::milliseconds lagAge{ 1000 };
+
+    /// Time without write progress that makes a client with a backlog stalled.
+    std::chrono::milliseconds stallAge{ 10000 };
+
+    SlowConsumerAction lagAction{ SlowConsumerAction::Conflate };
+
+    SlowConsumerAction stallAction{ SlowConsumerAction::Disconnect };
+};
+
+/// Figures of the last sample of a connection.
+struct ConsumerStats
+{
+    ConsumerState state{ ConsumerState::Healthy };
+
+    /// Smoothed round trip time (us), from TCP_INFO.
+    std::uint32_t rttUs{};
+
+    /// Congestion window (segments), from TCP_INFO.
+    std::uint32_t sndCwnd{};
+
+    /// Segments sent but not acknowledged, from TCP_INFO.
+    std::uint32_t unacked{};
+
+    /// Bytes in the socket's send buffer not sent yet.
+    std::uint32_t notsentBytes{};
+
+    /// Bytes queued in the connection's outbound ring.
+    std::size_t backlogBytes{};
+
+    /// Time since the outbound ring was last empty.
+    std::chrono::milliseconds backlogAge{};
+
+    /// Time since the last write completed, while there's a backlog.
+    std::chrono::milliseconds stalledFor{};
+
+    /// Keys waiting in the conflation table.
+    std::size_t conflatedKeys{};
+
+    /// Updates replaced by a later one so far.
+    std::uint64_t numConflated{};
+
+    /// Snapshot resyncs so far.
+    std::uint64_t numResyncs{};
+
+    /// Set once the client's frames are compressed.
+    bool compressed{};
+
+    /// Bytes compressed so far.
+    std::uint64_t compressedIn{};
+
+    /// Bytes they were compressed to.
+    std::uint64_t compressedOut{};
+};
+
+std::ostream& operator<<(std::ostream& os, ConsumerState state);
+
+std::ostream& operator<<(std::ostream& os, const ConsumerStats& stats);
+
+/// Logged as is, formatted by the logger's sink thread.
+template <>
+struct Vms::Core::LogAsRaw<ConsumerStats> : std::true_type {};
 
 /// The Connection class provides a communication link between the server and clients.
 /**
@@ -28,14 +228,47 @@
  *
  * @par Thread Safety
  * @e Distinct @e objects: Safe.@n
- * @e Shared @e objects: Safe with appropriate synchronization (internal mutex used).
+ * @e Shared @e objects: Safe. All socket operations and handlers run on a per-connection
+ * strand, so the connection may be used with an io_service run by several threads.
+ *
+ * The connection is driven by two coroutines on its strand: a read loop and a write loop.
+ * The read loop reads into a fixed-size buffer and parses every complete line of a read in
+ * place, lines and separators are found by a SIMD scan (`Vms::Net::scanLines()`). The valid
+ * lines of a read go to the update callback as a single `UpdateBatch`. A line longer than
+ * the max. line length is dropped. Sent messages are appended to a contiguous outbound ring
+ * and the write loop sends everything queued so far (up to `maxWriteBytes`) with a single
+ * gather write, so a burst of messages costs one syscall, not one per message, and a slow
+ * client only ever has a single write in flight. If a `Vms::Net::Uring` is installed on the
+ * io_service, reads and writes go through io_uring instead of epoll.
+ *
+ * The protocol is text unless the client starts with a hello (see `Vms/Net/Protocol.h`),
+ * then both directions switch to length-prefixed binary frames. The text queued for the
+ * client before is dropped and it's sent a snapshot in binary instead. A binary client may
+ * also ask for key ids: every key is then sent in full once per connection and as a small
+ * integer id afterwards, optionally with the hash XORed with the last one sent for the key.
+ * It may ask for compression as well: depending on the `CompressionMode`, everything written
+ * to it from some point on is deflated, a write at a time, on the hash pool.
+ *
+ * A client that can't keep up doesn't need every update, only the latest state: once more
+ * than the send watermark is queued for it, updates from `sendUpdate()` are conflated into
+ * a latest value per key table instead, and the table is sent as soon as the queue drains.
+ * Memory per connection is then bounded by the number of keys, not by the update rate.
+ *
+ * Every connection is sampled periodically: its backlog (size, age, write progress) and the
+ * kernel's view of the socket (TCP_INFO round trip time, congestion window, unacknowledged
+ * segments and unsent bytes). From that the client is classified as healthy, lagging or
+ * stalled and the `SlowConsumerPolicy` action for the state is taken. The last sample is
+ * available from `consumerStats()`.
  *
  * @par Example Usage
  * @code
  * auto conn = std::make_shared<Connection>(
+ *     ioService,
  *     std::move(socket),
- *     [](const std::string& key, const std::string& value) {
- *         // Update callback logic
+ *     [](UpdateBatchPtr batch) {
+ *         for (std::size_t i = 0; i < batch->size(); ++i) {
+ *             // Update callback logic for batch->key(i), batch->value(i)
+ *         }
  *     },
  *     [](ConnectionPtr conn) {
  *         // Disconnect callback logic
@@ -45,7 +278,7 @@
  * @endcode
  *
  * @par Concepts:
- * - Asynchronous IO
+ * - Asynchronous IO (C++20 coroutines)
  * - Thread-Safe Connection Management
  */
 class Connection : public std::enable_shared_from_this<Connection>
@@ -53,9 +286,10 @@ class Connection : public std::enable_shared_from_this<Connection>
 public:
     /// Type alias for the update callback.
     /**
-     * This callback is invoked when a key-value pair is received from the client.
+     * This callback is invoked once per read with every key-value pair received by it, in
+     * the order received.
      */
-    using UpdateCallback = std::function<void(const std::string&, const std::string&)>;
+    using UpdateCallback = std::function<void(UpdateBatchPtr)>;
 
     /// Type alias for the disconnect callback.
     /**
@@ -63,6 +297,22 @@ public:
      */
     using DisconnectCallback = std::function<void(std::shared_ptr<Connection>)>;
 
+    /// Type alias for the snapshot callback.
+    /**
+     * This callback returns the current value of every key, it's invoked on the
+     * connection's strand when a resynced client is sent a snapshot.
+     */
+    using SnapshotCallback = std::function<std::vector<UpdatePtr>()>;
+
+    /// Max. number of bytes sent by a single write.
+    static const std::size_t maxWriteBytes = 256 * 1024;
+
+    /// Default max. length of a received line, without the newline.
+    static const std::size_t defaultMaxLineLength = 64 * 1024;
+
+    /// Default bytes queued for a client above which its updates are conflated.
+    static const std::size_t defaultSendWatermark = 1024 * 1024;
+
     /// Deleted copy constructor.
     Connection(const Connection&) = delete;
 
@@ -73,16 +323,18 @@ public:
     /**
      * Constructs a new `Connection` object with a given TCP socket and callback handlers.
      *
+     * @param ioService The `boost::asio::io_service` the socket belongs to.
      * @param s The `boost::asio::ip::tcp::socket` associated with the client connection.
      * @param onUpdate Callback invoked when a valid "key value" message is received.
      * @param onDisconnect Callback invoked when the connection is closed or disconnected.
      */
-    explicit Connection(boost::asio::ip::tcp::socket s, UpdateCallback onUpdate, DisconnectCallback onDisconnect);
+    Connection(boost::asio::io_service& ioService, boost::asio::ip::tcp::socket s,
+        UpdateCallback onUpdate, DisconnectCallback onDisconnect);
 
     /// Destructor.
     ~Connection() = default;
 
-    /// Starts the asynchronous read operation.
+    /// Starts the read and write loops.
     /**
      * Begins reading from the socket to process client messages.
      * This must be called after constructing the `Connection` object.
@@ -91,46 +343,252 @@ public:
 
     /// Closes the connection.
     /**
-    * Closes the underlying socket gracefully. Safe to call multiple times.
-    * Notifies the disconnect callback if applicable.
+    * Closes the underlying socket gracefully on the connection's strand. Safe to call
+    * multiple times and from any thread.
     */
     void close();
 
     /// Sends a message to the client asynchronously.
     /**
      * Queues a message to be sent to the client. If there is no ongoing write operation,
-     * it immediately starts writing.
+     * it immediately starts writing. Safe to call from any thread.
      *
-     * @param message The message to send to the client.
+     * @param message The message to send to the client, a text line. A binary protocol
+     * client gets it as a `Vms::Net::FrameMessage` frame without the newline.
      */
     void send(const std::string& message);
 
+    /// Sends a map update to the client asynchronously.
+    /**
+     * Like `send()`, but if the client is slow the update may be conflated with later
+     * updates of the same key, i.e. only the latest value is sent. Safe to call from any thread.
+     *
+     * @param update The update, shared with the other connections.
+     */
+    void sendUpdate(UpdatePtr update);
+
+    /// Sends a group of map updates to the client asynchronously.
+    /**
+     * Same as `sendUpdate()` for every update, in order, but a single post to the
+     * connection's strand. Safe to call from any thread.
+     *
+     * @param updates The updates, shared with the other connections.
+     */
+    void sendUpdates(UpdateListPtr updates);
+
+    /// Sets the number of queued bytes above which updates are conflated.
+    /**
+     * Must be called before `start()`.
+     */
+    void setSendWatermark(std::size_t bytes);
+
+    /// Sets the max. length of a received line, longer ones are dropped.
+    /**
+     * The read buffer holds a single line of that length. Must be called before `start()`.
+     */
+    void setMaxLineLength(std::size_t bytes);
+
+    /// Sets how slow clients are detected and dealt with.
+    /**
+     * Must be called before `start()`.
+     */
+    void setSlowConsumerPolicy(const SlowConsumerPolicy& policy);
+
+    /// Sets the callback providing the snapshot for `SlowConsumerAction::Resync`.
+    /**
+     * Without one, Resync falls back to Conflate. Must be called before `start()`.
+     */
+    void setSnapshotCallback(SnapshotCallback onSnapshot);
+
+    /// Sets which clients asking for compression get it.
+    /**
+     * Must be called before `start()`.
+     *
+     * @param mode Which clients get it.
+     * @param pool Runs the compression, must outlive the connection.
+     */
+    void setCompression(CompressionMode mode, Vms::Core::WorkStealingPool& pool);
+
+    /// The client's remote endpoint.
+    const boost::asio::ip::tcp::endpoint& endpoint() const { return ep_; }
+
+    /// Figures of the last sample. Safe to call from any thread.
+    ConsumerStats consumerStats() const;
+
 private:
-    /// Internal method to handle asynchronous reads.
+    /// Reads lines from the client until disconnected.
+    /**
+     * Collects the valid lines of every read into an `UpdateBatch` for the `UpdateCallback`.
+     *
+     * @param self Keeps the connection alive while the loop runs.
+     */
+    Vms::Core::Awaitable<void> readLoop(std::shared_ptr<Connection> self);
+
+    /// Writes the queued messages to the client until closed.
+    /**
+     * @param self Keeps the connection alive while the loop runs.
+     */
+    Vms::Core::Awaitable<void> writeLoop(std::shared_ptr<Connection> self);
+
+    /// Sends up to `maxWriteBytes` of the outbound ring with one gather write.
+    /**
+     * In the binary protocol the write ends at a frame boundary, unless a single frame is
+     * bigger than that, and the bytes are compressed if compression started.
+     *
+     * Must be awaited on the connection's strand.
+     *
+     * @return The write error, if any.
+     */
+    Vms::Core::Awaitable<std::error_code> flush();
+
+    /// Compresses `buffers` on the compression pool and writes the result.
+    /**
+     * Must be awaited on the connection's strand, `buffers` must stay queued until it completes.
+     *
+     * @param buffers What's written, whole frames.
+     * @param ec Receives the write error, if any.
+     * @return The number of bytes of `buffers` written, all or none.
+     */
+    Vms::Core::Awaitable<std::size_t> writeCompressed(const Vms::Net::OutboundBuffer::ConstBuffers& buffers,
+        boost::system::error_code& ec);
+
+    /// Appends `data` to the outbound ring and wakes up the write loop, must be called on the
+    /// connection's strand.
+    void enqueue(std::string_view data);
+
+    /// Samples the connection, classifies it and takes the policy action, must be called on
+    /// the connection's strand.
+    void sample();
+
+    /// Schedules the next `sample()`, must be called on the connection's strand.
+    void scheduleSample();
+
+    /// Takes the policy action for a lagging or stalled client, must be called on the
+    /// connection's strand.
+    /**
+     * @param entered Set on the first sample in the current state, a resync is done only then.
+     */
+    void act(SlowConsumerAction action, bool entered);
+
+    /// Drops the backlog and makes the write loop send a snapshot once the write in flight
+    /// completes, must be called on the connection's strand.
+    void resync();
+
+    /// Drops what's queued for the client except the part of a line or frame being written,
+    /// and the conflation table, must be called on the connection's strand.
+    /**
+     * If anything is dropped, the key ids are reset as well.
+     *
+     * @return The number of bytes dropped.
+     */
+    std::size_t dropBacklog();
+
+    /// Offset of the frame after the one at `pos` in the outbound ring, binary protocol only.
+    /**
+     * The frames start at `handshakeBytes_`, `flush()` cuts writes at frame boundaries.
+     *
+     * @return `outbound_.size()` if the frame at `pos` is the last one.
+     */
+    std::size_t nextFrame(std::size_t pos) const;
+
+    /// Queues `update` in the connection's protocol, must be called on the connection's strand.
+    void enqueueUpdate(const Update& update);
+
+    /// Queues a message, i.e. an error, in the connection's protocol, must be called on the
+    /// connection's strand.
+    void enqueueMessage(std::string_view message);
+
+    /// Reads more data into the read buffer.
     /**
-     * Reads data from the client until a newline is encountered. Processes the message
-     * and invokes the `UpdateCallback` if the input is valid.
+     * Must be awaited on the connection's strand.
      *
-     * @param ec The error code from the last read operation.
-     * @param sz The number of bytes read.
+     * @return The read error, if any.
+     */
+    Vms::Core::Awaitable<std::error_code> fill();
+
+    /// Parses everything complete in the read buffer, must be called on the connection's strand.
+    /**
+     * Checks for a hello at the start of the connection.
+     */
+    void parse();
+
+    /// Switches to the binary protocol, must be called on the connection's strand.
+    /**
+     * @param features The features the client asked for.
+     */
+    void onHello(std::uint8_t features);
+
+    /// Parses every complete frame in the read buffer and passes the valid updates to the
+    /// `UpdateCallback`, must be called on the connection's strand.
+    /**
+     * @return false if the client violated the protocol and the connection was closed.
+     */
+    bool parseFrames();
+
+    /// Parses every complete line in the read buffer and passes the valid ones to the
+    /// `UpdateCallback`, must be called on the connection's strand.
+    /**
+     * Lines and their first spaces are found by a single `Vms::Net::scanLines()` pass over
+     * the buffer.
      */
-    void onRead(const std::error_code& ec, std::uint32_t sz);
+    void parseLines();
 
-    /// Internal method to handle asynchronous writes.
+    /// Checks a received line, answers it with an error if it's malformed, must be called
+    /// on the connection's strand.
     /**
-     * Writes the queued messages to the client one by one.
-     * Ensures thread-safe access to the message queue.
+     * @param line The line without the trailing newline.
+     * @param spacePos Offset of the first space in `line`, `line.size()` if there's none.
+     * @return true if the line is a valid "key value".
      */
-    void write();
+    bool checkLine(std::string_view line, std::size_t spacePos);
+
+    /// Queues or conflates `update`, must be called on the connection's strand.
+    void queueUpdate(UpdatePtr update);
+
+    /// Adds `update` to the conflation table, must be called on the connection's strand.
+    void conflate(UpdatePtr update);
+
+    /// Moves the conflation table to the outbound ring, must be called on the connection's strand.
+    void flushConflated();
+
+    /// Closes the socket, must be called on the connection's strand.
+    void doClose();
+
+    /// Shuts down and closes the socket without logging, must be called on the connection's strand.
+    /**
+     * The shutdown completes in-flight io_uring operations, closing alone wouldn't.
+     */
+    boost::system::error_code closeSocket();
+
+    /// Strand serializing all socket operations and handlers of this connection.
+    Vms::Core::StrandPtr strand_;
+
+    /// Batches messages from `send()` callers into the strand, one strand post per burst.
+    Vms::Core::SerialQueuePtr sendQueue_;
 
     /// The underlying TCP socket.
     boost::asio::ip::tcp::socket s_;
 
+    /// io_uring view of `s_`, null if the io_service has no `Vms::Net::Uring`.
+    std::unique_ptr<Vms::Net::UringStream> uringStream_;
+
     /// The client's remote endpoint (IP address and port).
     const boost::asio::ip::tcp::endpoint ep_;
 
-    /// Buffer for reading data from the client.
-    boost::asio::streambuf b_;
+    /// Buffer for reading data from the client, holds at most a single line and its newline.
+    std::unique_ptr<char[]> readBuffer_;
+
+    /// Size of `readBuffer_`.
+    std::size_t readCapacity_;
+
+    /// Offset of the first byte of `readBuffer_` not parsed yet, accessed on the strand only.
+    std::size_t readBegin_{};
+
+    /// Offset past the last byte read into `readBuffer_`, accessed on the strand only.
+    std::size_t readEnd_{};
+
+    /// Set while the rest of a line too long is dropped, accessed on the strand only.
+    bool discarding_{};
 
     /// Callback invoked when a key-value pair is received.
     UpdateCallback onUpdate_;
@@ -138,11 +596,117 @@ private:
     /// Callback invoked when the client disconnects.
     DisconnectCallback onDisconnect_;
 
-    /// Queue of messages to be sent to the client.
-    std::deque<std::string> writeQueue_;
+    /// Bytes to be sent to the client, accessed on the strand only.
+    Vms::Net::OutboundBuffer outbound_;
+
+    /// Set while updates are conflated, accessed on the strand only.
+    bool conflating_{};
+
+    /// Latest update of every conflated key in the order the keys were first conflated,
+    /// accessed on the strand only.
+    std::vector<UpdatePtr> conflated_;
+
+    /// Index of every conflated key in `conflated_`, accessed on the strand only.
+    std::unordered_map<std::string, std::size_t> conflatedIndex_;
+
+    /// Number of updates replaced by a later one, accessed on the strand only.
+    std::uint64_t numConflated_{};
+
+    /// Callback providing the snapshot for a resync.
+    SnapshotCallback onSnapshot_;
+
+    /// Slow client detection settings.
+    SlowConsumerPolicy policy_;
+
+    /// Runs `sample()` on the strand.
+    Vms::Core::TimedTaskPtr sampleTask_;
+
+    /// Set while updates are ignored until a snapshot is sent, accessed on the strand only.
+    bool resyncing_{};
+
+    /// Number of resyncs, accessed on the strand only.
+    std::uint64_t numResyncs_{};
+
+    /// State of the last sample, accessed on the strand only.
+    ConsumerState state_{ ConsumerState::Healthy };
+
+    /// Bytes of `outbound_` being written by `flush()`, accessed on the strand only.
+    std::size_t inFlight_{};
+
+    /// When `outbound_` last turned non-empty, accessed on the strand only.
+    std::chrono::steady_clock::time_point backlogSince_;
+
+    /// When the last write completed, accessed on the strand only.
+    std::chrono::steady_clock::time_point lastProgress_;
+
+    /// Protects `stats_`.
+    mutable std::mutex statsMutex_;
+
+    /// Figures of the last sample.
+    ConsumerStats stats_;
+
+    /// Wakes up the write loop waiting on an empty `outbound_`, accessed on the strand only.
+    boost::asio::steady_timer writeSignal_;
+
+    /// Set once the start of the stream was checked for a hello, accessed on the strand only.
+    bool helloChecked_{};
+
+    /// Set if the binary protocol was negotiated, accessed on the strand only.
+    bool binary_{};
+
+    /// Set if `Vms::Net::FeatureKeyIds` was negotiated, accessed on the strand only.
+    bool keyIds_{};
+
+    /// Set if `Vms::Net::FeatureDelta` was negotiated, accessed on the strand only.
+    bool delta_{};
+
+    /// Id and last hash sent of a key.
+    struct KeyState
+    {
+        std::uint32_t id;
+        std::uint32_t lastHash;
+    };
+
+    /// Every key sent since the last key reset, accessed on the strand only.
+    std::unordered_map<std::string, KeyState> keys_;
+
+    /// Frame of the update being queued, accessed on the strand only.
+    std::string encodeBuffer_;
+
+    /// Bytes at the start of `outbound_` that aren't frames, i.e. text queued before the hello
+    /// and the hello itself, never compressed, accessed on the strand only.
+    std::size_t handshakeBytes_{};
+
+    /// Which clients get compression.
+    CompressionMode compressionMode_{ CompressionMode::Off };
+
+    /// Runs compression, null if it's off.
+    Vms::Core::WorkStealingPool* compressPool_{};
+
+    /// Set if `Vms::Net::FeatureCompress` was negotiated, accessed on the strand only.
+    bool compress_{};
+
+    /// Compresses everything written once compression started, null before. Used by
+    /// `compressPool_` during `writeCompressed()` only.
+    std::unique_ptr<Vms::Net::Deflater> deflater_;
+
+    /// Output of the last compression, empty on error, accessed on the strand only.
+    std::string compressedChunk_;
+
+    /// Set once `compressedChunk_` is ready, accessed on the strand only.
+    bool compressDone_{};
+
+    /// Wakes up `writeCompressed()` once `compressedChunk_` is ready.
+    boost::asio::steady_timer compressSignal_;
+
+    /// Bytes compressed so far, accessed on the strand only.
+    std::uint64_t compressedIn_{};
+
+    /// Bytes they were compressed to, accessed on the strand only.
+    std::uint64_t compressedOut_{};
 
-    /// Mutex to ensure thread-safe access to the write queue.
-    std::mutex writeMutex_;
+    /// Set once the connection is closed, accessed on the strand only.
+    bool closed_{};
 };
 
 /// Type alias for a shared pointer to a `Connection` object.
@@ -1,7 +1,7 @@
 #include "Utils.h"
 #include <boost/crc.hpp>
 
-std::uint32_t calcHeavyHash(const std::string& str)
+std::uint32_t calcHeavyHash(std::string_view str)
 {
     // CRC32 is not heavy, but let's assume we're doing something really CPU-intensive here...
     boost::crc_32_type crc32;
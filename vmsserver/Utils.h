@@ -2,7 +2,8 @@
 #define _UTILS_H_
 
 #include "Vms/Core/Types.h"
+#include <string_view>
 
-std::uint32_t calcHeavyHash(const std::string& str);
+std::uint32_t calcHeavyHash(std::string_view str);
 
 #endif
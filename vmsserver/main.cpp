@@ -1,16 +1,21 @@
 #include "Connection.h"
 
+#include <atomic>
 #include <future>
 #include <iostream>
 #include <csignal>
 #include <unordered_map>
 
 #include <boost/program_options.hpp>
-#include <boost/asio/thread_pool.hpp>
-#include <boost/asio/post.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/signal_set.hpp>
 
 #include "Vms/Net/TcpAcceptor.h"
+#include "Vms/Net/Uring.h"
 #include "Vms/Core/Executor.h"
+#include "Vms/Core/TimerWheel.h"
+#include "Vms/Core/WorkStealingPool.h"
 #include "Vms/Core/Logger.h"
 #include "Utils.h"
 
@@ -31,13 +36,200 @@ namespace {
         }
     }
 
-    std::unordered_map<std::string, std::string> map;
+    std::unordered_map<std::string, std::uint32_t> map;
     std::set<ConnectionPtr> clients;
 
-    boost::asio::thread_pool hashPool(std::thread::hardware_concurrency());
+    // Runs heavy hash calculations, created in main() once thread placement is known.
+    std::unique_ptr<Vms::Core::WorkStealingPool> hashPool;
+
+    // Max. length of a line received from a client.
+    std::size_t maxLineLength{ Connection::defaultMaxLineLength };
+
+    // Bytes queued for a client above which its updates are conflated.
+    std::size_t sendWatermark{ Connection::defaultSendWatermark };
+
+    // How slow clients are detected and dealt with.
+    SlowConsumerPolicy slowConsumerPolicy;
+
+    // Which clients asking for compression get it.
+    CompressionMode compressionMode{ CompressionMode::Lagging };
 
     std::mutex mapMutex;
     std::mutex clientsMutex;
+
+    // Number of updates of a batch hashed by a single task.
+    const std::size_t hashChunkSize{ 256 };
+
+    // A batch of updates being hashed, shared by the tasks hashing its chunks.
+    struct HashJob
+    {
+        explicit HashJob(UpdateBatchPtr b)
+        : batch(std::move(b)), updates(batch->size()), pendingChunks((batch->size() + hashChunkSize - 1) / hashChunkSize)
+        {
+        }
+
+        UpdateBatchPtr batch;
+        std::vector<UpdatePtr> updates;
+        std::atomic<std::size_t> pendingChunks;
+    };
+
+    // The current value of every key.
+    std::vector<UpdatePtr> snapshot()
+    {
+        std::vector<UpdatePtr> updates;
+        std::lock_guard<std::mutex> lock(mapMutex);
+        updates.reserve(map.size());
+        for (auto it = map.begin(); it != map.end(); ++it) {
+            updates.push_back(std::make_shared<const Update>(it->first, it->second));
+        }
+        return updates;
+    }
+
+    // Hashes updates [begin, end) of 'job', the task finishing the last chunk applies all of
+    // them to the map and broadcasts them to all connected clients as a group.
+    void hashChunk(const std::shared_ptr<HashJob>& job, std::size_t begin, std::size_t end)
+    {
+        const auto& batch{ *job->batch };
+        for (auto i = begin; i < end; ++i) {
+            // Compute the heavy hash value, it's formatted for the wire by the first client sending it.
+            job->updates[i] = std::make_shared<const Update>(std::string(batch.key(i)), calcHeavyHash(batch.value(i)));
+        }
+
+        if (job->pendingChunks.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+
+        auto updates{ std::make_shared<const std::vector<UpdatePtr>>(std::move(job->updates)) };
+
+        {
+            // Update the shared map under a lock, in the order received
+            std::lock_guard<std::mutex> lock(mapMutex);
+            for (const auto& update : *updates) {
+                map[update->key()] = update->hash();
+            }
+        }
+
+        // Broadcast the updates to all connected clients
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            for (auto& client : clients) {
+                client->sendUpdates(updates);
+            }
+        }
+
+        VMS_LOG_INFO(_FN, "Client's batch of " << updates->size() << " message(s) processing completed, last \""
+            << updates->back()->key() << " " << updates->back()->hash() << "\"");
+    }
+
+    // Hashes every update of 'batch' on the hash pool, a task per chunk of 'hashChunkSize'.
+    void hashBatch(UpdateBatchPtr batch)
+    {
+        auto job{ std::make_shared<HashJob>(std::move(batch)) };
+        auto size{ job->batch->size() };
+
+        if (size <= hashChunkSize) {
+            hashPool->post([job, size]() {
+                hashChunk(job, 0, size);
+            });
+            return;
+        }
+
+        std::vector<Vms::Core::WorkStealingPool::Task> tasks;
+        tasks.reserve(job->pendingChunks);
+        for (std::size_t begin = 0; begin < size; begin += hashChunkSize) {
+            auto end{ std::min(begin + hashChunkSize, size) };
+            tasks.emplace_back([job, begin, end]() {
+                hashChunk(job, begin, end);
+            });
+        }
+        hashPool->post(std::move(tasks));
+    }
+
+    // Logs stats of all the executors on every signal delivered to 'signals'.
+    void waitStatsSignal(boost::asio::signal_set& signals, const std::vector<std::unique_ptr<Vms::Core::Executor>>& executors)
+    {
+        signals.async_wait([&signals, &executors](const boost::system::error_code& ec, int /*signal*/) {
+            if (ec) {
+                return;
+            }
+
+            for (std::size_t i = 0; i < executors.size(); ++i) {
+                VMS_LOG_INFO(_FN, "Executor " << i << ": " << executors[i]->stats());
+            }
+
+            // Healthy clients are only listed in debug, there may be lots of them.
+            std::size_t numLagging{ 0 };
+            std::size_t numStalled{ 0 };
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            for (auto& client : clients) {
+                auto stats{ client->consumerStats() };
+                if (stats.state == ConsumerState::Healthy) {
+                    VMS_LOG_DEBUG(_FN, "Client " << client->endpoint() << ": " << stats);
+                    continue;
+                }
+                if (stats.state == ConsumerState::Lagging) {
+                    ++numLagging;
+                } else {
+                    ++numStalled;
+                }
+                VMS_LOG_INFO(_FN, "Client " << client->endpoint() << ": " << stats);
+            }
+            VMS_LOG_INFO(_FN, "Clients: " << clients.size() << ", lagging " << numLagging << ", stalled " << numStalled);
+
+            waitStatsSignal(signals, executors);
+        });
+    }
+
+    void onAccept(boost::asio::io_service& ioService, boost::asio::ip::tcp::socket s)
+    {
+        auto conn = std::make_shared<Connection>(
+            ioService,
+            std::move(s),
+            [](UpdateBatchPtr batch) {
+                hashBatch(std::move(batch));
+            },
+            [](ConnectionPtr conn) {
+                {
+                    std::lock_guard<std::mutex> lock(clientsMutex);
+                    clients.erase(conn);
+                }
+
+                conn->close(); // Explicitly close the socket.
+                VMS_LOG_INFO(_FN, "Client cleanup complete");
+            });
+
+        conn->setMaxLineLength(maxLineLength);
+        conn->setSendWatermark(sendWatermark);
+        conn->setSlowConsumerPolicy(slowConsumerPolicy);
+        conn->setSnapshotCallback(&snapshot);
+        conn->setCompression(compressionMode, *hashPool);
+
+        conn->sendUpdates(std::make_shared<const std::vector<UpdatePtr>>(snapshot()));
+
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            clients.insert(conn);
+        }
+
+        conn->start();
+    }
+
+    // Accepts connections until 'acceptor' is stopped.
+    Vms::Core::Awaitable<void> acceptLoop(std::shared_ptr<Vms::Net::TcpAcceptor> acceptor)
+    {
+        auto& ioService{ acceptor->ioService() };
+
+        for (;;) {
+            boost::asio::ip::tcp::socket s(ioService);
+            auto ec{ co_await acceptor->accept(s) };
+            if (ec == boost::system::error_code(boost::asio::error::operation_aborted)) {
+                co_return;
+            }
+            if (!ec) {
+                onAccept(ioService, std::move(s));
+            }
+        }
+    }
 }
 
 int main(int argc, char* argv[])
@@ -45,6 +237,27 @@ int main(int argc, char* argv[])
     boost::program_options::variables_map vm;
     std::uint32_t logLevel{ 4 };
     std::uint16_t ipPort{ 8081 };
+    std::uint32_t ioThreads{ 1 };
+    std::uint32_t reactors{ 0 };
+    std::uint32_t hashThreads{ 0 };
+    std::string ioCpusStr;
+    std::string hashCpusStr;
+    std::uint32_t busyPollUs{ 0 };
+    std::uint32_t socketBusyPollUs{ 0 };
+    std::uint32_t backlog{ static_cast<std::uint32_t>(boost::asio::socket_base::max_listen_connections) };
+    std::uint32_t outstandingAccepts{ 4 };
+    std::uint32_t maxLineLengthArg{ static_cast<std::uint32_t>(Connection::defaultMaxLineLength) };
+    std::uint32_t sendWatermarkKb{ static_cast<std::uint32_t>(Connection::defaultSendWatermark / 1024) };
+    std::uint32_t sampleMs{ static_cast<std::uint32_t>(slowConsumerPolicy.sampleInterval.count()) };
+    std::uint32_t lagMs{ static_cast<std::uint32_t>(slowConsumerPolicy.lagAge.count()) };
+    std::uint32_t stallSeconds{ static_cast<std::uint32_t>(slowConsumerPolicy.stallAge.count() / 1000) };
+    std::string lagActionStr{ "conflate" };
+    std::string stallActionStr{ "disconnect" };
+    std::string compressStr{ "lagging" };
+    std::string logFacilityLevels;
+    std::string logFile;
+    std::uint64_t logFileSizeMb{ 0 };
+    std::uint32_t logFiles{ 5 };
 
     try {
         boost::program_options::options_description desc("Options");
@@ -53,14 +266,39 @@ int main(int argc, char* argv[])
             ("help", "Print this help message")
             ("log-level", boost::program_options::value(&logLevel), "Log level(0 - 4), default = 4")
             ("verbose", "Use verbose logging, default = off")
-            ("port", boost::program_options::value(&ipPort), "IP port (numeric), default = 8081");
+            ("log-facility-levels", boost::program_options::value(&logFacilityLevels), "Per-facility log levels overriding log-level, i.e. \"Connection=debug,Net=warn\" (debug, info, warn, error, off), default = none")
+            ("log-async", "Log from a background thread, messages are dropped instead of blocking when it lags, default = off")
+            ("log-file", boost::program_options::value(&logFile), "Log to that file instead of stderr, implies log-async")
+            ("log-file-size", boost::program_options::value(&logFileSizeMb), "Rotate the log file when it grows over that size (MB), default = 0 (never)")
+            ("log-files", boost::program_options::value(&logFiles), "Number of rotated log files kept, default = 5")
+            ("port", boost::program_options::value(&ipPort), "IP port (numeric), default = 8081")
+            ("io-threads", boost::program_options::value(&ioThreads), "Number of I/O threads, default = 1")
+            ("reactors", boost::program_options::value(&reactors), "Number of per-core reactors sharing the port via SO_REUSEPORT, 0 = single shared reactor, default = 0")
+            ("io-cpus", boost::program_options::value(&ioCpusStr), "CPUs for I/O threads, i.e. \"0-1\", \"0,2\" or \"node0\", default = any")
+            ("hash-threads", boost::program_options::value(&hashThreads), "Number of hash threads, default = number of hash-cpus or number of CPUs")
+            ("hash-cpus", boost::program_options::value(&hashCpusStr), "CPUs for hash threads, i.e. \"2-15\" or \"node1\", default = any")
+            ("busy-poll-us", boost::program_options::value(&busyPollUs), "I/O threads poll for that long before blocking (us), default = 0 (off)")
+            ("socket-busy-poll-us", boost::program_options::value(&socketBusyPollUs), "SO_BUSY_POLL for accepted sockets (us), default = 0 (system default)")
+            ("backlog", boost::program_options::value(&backlog), "Listen backlog, default = system max")
+            ("accepts", boost::program_options::value(&outstandingAccepts), "Number of accepts kept in flight per acceptor, default = 4")
+            ("max-line-length", boost::program_options::value(&maxLineLengthArg), "Max. length of a line received from a client, longer ones are dropped, default = 65536")
+            ("send-watermark-kb", boost::program_options::value(&sendWatermarkKb), "KB queued for a slow client above which only the latest value of every key is sent to it, default = 1024")
+            ("client-sample-ms", boost::program_options::value(&sampleMs), "How often every client's backlog and TCP_INFO are sampled (ms), 0 = never, default = 1000")
+            ("lag-ms", boost::program_options::value(&lagMs), "Backlog age making a client lagging (ms), default = 1000")
+            ("lag-action", boost::program_options::value(&lagActionStr), "What's done to a lagging client: none, conflate, resync (drop the backlog, send a snapshot) or disconnect, default = conflate")
+            ("stall-seconds", boost::program_options::value(&stallSeconds), "Time a client with a backlog takes nothing before it's stalled (s), default = 10")
+            ("stall-action", boost::program_options::value(&stallActionStr), "What's done to a stalled client: none, conflate, resync or disconnect, default = disconnect")
+            ("compress", boost::program_options::value(&compressStr), "Which binary protocol clients asking for compression get it, on the hash threads: off, lagging (once found lagging or stalled) or always, default = lagging")
+            ("io-uring", "Do socket I/O through io_uring instead of epoll (Linux), default = off");
 
         store( boost::program_options::command_line_parser(argc, argv).options(desc).run(), vm);
 
         notify(vm);
 
         if (vm.count("help") > 0) {
-            std::cout << desc << std::endl;
+            std::cout << desc << std::endl
+                << "SIGUSR1 logs every I/O thread's loop lag (and clients' state at debug level). Handler run times"
+                << " and pending handler counts only with a VMS_HANDLER_TRACKING build." << std::endl;
             return 1;
         }
     } catch (const boost::program_options::error& e) {
@@ -79,71 +317,169 @@ int main(int argc, char* argv[])
     Vms::Core::logger.setLevel(static_cast<Vms::Core::LogLevel>(Vms::Core::LogLevelOFF - logLevel));
     Vms::Core::logger.setVerbose(vm.count("verbose") > 0);
 
-    Vms::Core::Executor executor;
-    auto acceptor{ std::make_shared<Vms::Net::TcpAcceptor>(executor.ioService(), boost::asio::ip::tcp::v4()) };
+    if (!logFacilityLevels.empty()) {
+        auto ec{ Vms::Core::logger.setFacilityLevels(logFacilityLevels) };
+        if (ec) {
+            VMS_LOG_ERROR(_FN, "Bad log-facility-levels " << logFacilityLevels);
+            return 1;
+        }
+    }
+
+    if ((vm.count("log-async") > 0) || !logFile.empty()) {
+        Vms::Core::AsyncLogOptions logOptions;
+        logOptions.path = logFile;
+        logOptions.maxFileSize = logFileSizeMb * 1024 * 1024;
+        logOptions.maxFiles = logFiles;
+        auto ec{ Vms::Core::logger.startAsync(logOptions) };
+        if (ec) {
+            VMS_LOG_ERROR(_FN, "Can't log to " << logFile << ": " << ec.message());
+            return 1;
+        }
+    }
 
-    boost::asio::ip::tcp::endpoint boundEndpoint;
-    auto ec{ acceptor->bind(boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), ipPort),
-        boundEndpoint) };
-    if (ec) {
-        VMS_LOG_ERROR(_FN, "Can't bind server: " << ec.message());
+    if (ioThreads == 0) {
+        VMS_LOG_ERROR(_FN, "Bad io-threads " << ioThreads);
         return 1;
     }
 
-    ec = acceptor->listen(10, [&](boost::asio::ip::tcp::socket s) {
-        auto conn = std::make_shared<Connection>(
-            std::move(s),
-            [](const std::string& key, const std::string& value) {
-                post(hashPool, [value, key]() {
-                    // Compute the heavy hash value
-                    auto hashValue{ calcHeavyHash(value) };
-                    const auto& message{ key + " " + std::to_string(hashValue) + "\n" };
-
-                    {
-                        // Update the shared map under a lock
-                        std::lock_guard<std::mutex> lock(mapMutex);
-                        map[key] = std::to_string(hashValue);
-                    }
-
-                    // Broadcast the update to all connected clients
-                    std::lock_guard<std::mutex> lock(clientsMutex);
-                    for (auto& client : clients) {
-                        client->send(message);
-                    }
-
-                    VMS_LOG_INFO(_FN, "Client's message \"" + message +"\" processing completed");
-                });
-        },
-        [](ConnectionPtr conn) {
-            {
-                std::lock_guard<std::mutex> lock(clientsMutex);
-                clients.erase(conn);
-            }
+    if (maxLineLengthArg == 0) {
+        VMS_LOG_ERROR(_FN, "Bad max-line-length " << maxLineLengthArg);
+        return 1;
+    }
 
-            conn->close(); // Explicitly close the socket.
-            VMS_LOG_INFO(_FN, "Client cleanup complete");
-            });
+    maxLineLength = maxLineLengthArg;
+    sendWatermark = static_cast<std::size_t>(sendWatermarkKb) * 1024;
 
-        {
-            std::lock_guard<std::mutex> lock(mapMutex);
-            for (auto it = map.begin(); it != map.end(); ++it) {
-                conn->send(it->first + " " + it->second + "\n");
+    if (parseSlowConsumerAction(lagActionStr, slowConsumerPolicy.lagAction)) {
+        VMS_LOG_ERROR(_FN, "Bad lag-action " << lagActionStr);
+        return 1;
+    }
+
+    if (parseSlowConsumerAction(stallActionStr, slowConsumerPolicy.stallAction)) {
+        VMS_LOG_ERROR(_FN, "Bad stall-action " << stallActionStr);
+        return 1;
+    }
+
+    if (parseCompressionMode(compressStr, compressionMode)) {
+        VMS_LOG_ERROR(_FN, "Bad compress " << compressStr);
+        return 1;
+    }
+
+    slowConsumerPolicy.sampleInterval = std::chrono::milliseconds(sampleMs);
+    slowConsumerPolicy.lagAge = std::chrono::milliseconds(lagMs);
+    slowConsumerPolicy.stallAge = std::chrono::seconds(stallSeconds);
+
+    if ((reactors > 0) && (ioThreads > 1)) {
+        VMS_LOG_ERROR(_FN, "Options reactors and io-threads are mutually exclusive");
+        return 1;
+    }
+
+    Vms::Core::CpuSet ioCpus;
+    if (!ioCpusStr.empty()) {
+        auto err{ Vms::Core::parseCpuSet(ioCpusStr, ioCpus) };
+        if (err) {
+            VMS_LOG_ERROR(_FN, "Bad io-cpus " << ioCpusStr << ": " << err.message());
+            return 1;
+        }
+    }
+
+    Vms::Core::CpuSet hashCpus;
+    if (!hashCpusStr.empty()) {
+        auto err{ Vms::Core::parseCpuSet(hashCpusStr, hashCpus) };
+        if (err) {
+            VMS_LOG_ERROR(_FN, "Bad hash-cpus " << hashCpusStr << ": " << err.message());
+            return 1;
+        }
+    }
+
+    if (hashThreads == 0) {
+        hashThreads = hashCpus.empty() ? Vms::Core::numCpus() : static_cast<std::uint32_t>(hashCpus.size());
+    }
+
+    hashPool.reset(new Vms::Core::WorkStealingPool(hashThreads, hashCpus));
+
+    // Shared mode: a single Executor running 'ioThreads' threads with a single acceptor.
+    // Sharded mode: 'reactors' single-threaded Executors, each pinned to its own CPU and
+    // having its own SO_REUSEPORT acceptor, so a connection never leaves its home thread.
+    // Reactor i is pinned to i-th CPU of 'ioCpus' (wrapping around) or i-th CPU of the system.
+    std::vector<std::unique_ptr<Vms::Core::Executor>> executors;
+    if (reactors == 0) {
+        executors.emplace_back(new Vms::Core::Executor(ioThreads, ioCpus, std::chrono::microseconds(busyPollUs)));
+    } else {
+        for (std::uint32_t i = 0; i < reactors; ++i) {
+            auto cpu{ ioCpus.empty() ? (i % Vms::Core::numCpus()) : ioCpus[i % ioCpus.size()] };
+            executors.emplace_back(new Vms::Core::Executor(1, Vms::Core::CpuSet{ cpu }, std::chrono::microseconds(busyPollUs)));
+        }
+    }
+
+    // Slow consumer sampling only needs a coarse timer per connection, a wheel per Executor
+    // keeps all of them off the io_service timer queue.
+    for (auto& executor : executors) {
+        Vms::Core::TimerWheel::install(executor->ioService());
+    }
+
+    if (vm.count("io-uring") > 0) {
+#if defined(SIGPIPE)
+        // Small sends go out as writes from registered buffers, these can't pass MSG_NOSIGNAL.
+        std::signal(SIGPIPE, SIG_IGN);
+#endif
+        for (auto& executor : executors) {
+            auto ec{ Vms::Net::Uring::install(executor->ioService()) };
+            if (ec) {
+                VMS_LOG_ERROR(_FN, "Can't set up io_uring: " << ec.message());
+                return 1;
             }
         }
+    }
 
-        {
-            std::lock_guard<std::mutex> lock(clientsMutex);
-            clients.insert(conn);
+    std::vector<std::shared_ptr<Vms::Net::TcpAcceptor>> acceptors;
+    boost::asio::ip::tcp::endpoint boundEndpoint(boost::asio::ip::tcp::v4(), ipPort);
+
+    for (auto& executor : executors) {
+        auto& ioService{ executor->ioService() };
+        auto acceptor{ std::make_shared<Vms::Net::TcpAcceptor>(ioService, boost::asio::ip::tcp::v4()) };
+
+        // All the acceptors share the port of the first one, this matters when port is 0.
+        auto ec{ acceptor->bind(boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), boundEndpoint.port()),
+            boundEndpoint, reactors > 0) };
+        if (ec) {
+            VMS_LOG_ERROR(_FN, "Can't bind server: " << ec.message());
+            return 1;
         }
 
-        conn->start();
-    });
-    if (ec) {
-        VMS_LOG_ERROR(_FN, "Can't listen server: " << ec.message());
-        return 1;
+        acceptor->setBusyPoll(std::chrono::microseconds(socketBusyPollUs));
+        acceptor->setOutstandingAccepts(outstandingAccepts);
+
+        ec = acceptor->listen(backlog);
+        if (ec) {
+            VMS_LOG_ERROR(_FN, "Can't listen server: " << ec.message());
+            return 1;
+        }
+
+        boost::asio::co_spawn(*acceptor->strand(), acceptLoop(acceptor), boost::asio::detached);
+
+        acceptors.push_back(acceptor);
+    }
+
+    if (reactors == 0) {
+        VMS_LOG_INFO(_FN, "Started at " << boundEndpoint << " with " << ioThreads << " I/O thread(s)"
+            << ((vm.count("io-uring") > 0) ? " using io_uring" : ""));
+    } else {
+        VMS_LOG_INFO(_FN, "Started at " << boundEndpoint << " with " << reactors << " reactor(s)"
+            << ((vm.count("io-uring") > 0) ? " using io_uring" : ""));
     }
 
-    VMS_LOG_INFO(_FN, "Started at " << boundEndpoint);
+    for (auto& executor : executors) {
+        executor->startLagProbe();
+    }
+
+    // Executor stats are reported on demand, i.e. "kill -USR1 <pid>". Only loop lag unless
+    // built with VMS_HANDLER_TRACKING.
+    boost::asio::signal_set statsSignals(executors.front()->ioService());
+#if defined(SIGUSR1)
+    statsSignals.add(SIGUSR1);
+    waitStatsSignal(statsSignals, executors);
+#endif
 
     std::signal(SIGINT, signalHandler);
     std::signal(SIGTERM, signalHandler);
@@ -162,12 +498,16 @@ int main(int argc, char* argv[])
         clients.clear();
     }
 
-    // Stop the thread pool and wait for all tasks to finish
-    hashPool.join();
+    // Stop the hash pool and wait for all tasks to finish
+    hashPool->stop(false);
 
-    executor.stop();
+    for (auto& executor : executors) {
+        executor->stop();
+    }
 
     VMS_LOG_INFO(_FN, "Stopped");
 
+    Vms::Core::logger.stopAsync();
+
     return 0;
 }